@@ -1,8 +1,6 @@
 #include "buf.h"
 #include "xmem.h"
 
-#define BUFFER_PADDING (32)
-
 CharBuf* charbuf_new(char *from)
 {
     assert(from);
@@ -10,7 +8,6 @@ CharBuf* charbuf_new(char *from)
     CharBuf *r = cc_malloc(sizeof(CharBuf));
     size_t buflen = strlen(from);
 
-    // +32 : some little padding, when we check the buffer like this: buffer[index + 2].
     size_t alloclen = (buflen + BUFFER_PADDING) * sizeof(char);
 
     r->buf = (char*) cc_malloc(alloclen);
@@ -41,6 +38,24 @@ CharBuf* charbuf_new(char *from)
     return r;
 }
 
+CharBuf* charbuf_wrap(char *buf, size_t size)
+{
+    assert(buf);
+
+    CharBuf *r = cc_malloc(sizeof(CharBuf));
+    r->buf = buf;
+    r->size = size;
+    r->offset = 0;
+
+    r->line = 1;
+    r->column = 0;
+
+    r->prevc = 0;
+    r->eofs = -1;
+
+    return r;
+}
+
 int charbuf_nextc(CharBuf *b)
 {
 
@@ -129,7 +144,7 @@ int* charbuf_next4(CharBuf *buf)
     int prevc = buf->prevc;
     int eofs = buf->eofs;
 
-    static int lookup[4] = { -1, -1, -1, -1 };
+    int *lookup = buf->lookup;
     lookup[0] = charbuf_nextc(buf);
     lookup[1] = charbuf_nextc(buf);
     lookup[2] = charbuf_nextc(buf);
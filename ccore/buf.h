@@ -14,6 +14,9 @@
 
 #define HC_FEOF (-1)
 
+// +32 : some little padding, when we check the buffer like this: buffer[index + 2].
+#define BUFFER_PADDING (32)
+
 typedef struct char_buf CharBuf;
 
 struct char_buf {
@@ -21,9 +24,14 @@ struct char_buf {
     size_t size, offset;
     size_t line, column;
     int prevc, eofs;
+    int lookup[4]; // what charbuf_next4() gives
 };
 
 CharBuf *charbuf_new(char *from);
+
+/// A buffer read in place: [size] chars, then BUFFER_PADDING zeroes.
+/// It is not copied, nor written to, and has to outlive the CharBuf.
+CharBuf *charbuf_wrap(char *buf, size_t size);
 int charbuf_nextc(CharBuf *b);
 int charbuf_peekc(CharBuf *b);
 int* charbuf_next4(CharBuf *buf);
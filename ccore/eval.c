@@ -1,130 +1,701 @@
 #include "ascii.h"
 #include "hdrs.h"
+#include "eval.h"
 
 size_t eval_integer(char *dec, unsigned base) {
     assert(dec);
+    return eval_integer_slice(slice_new(dec, strlen(dec)), base);
+}
+
+size_t eval_integer_slice(Slice dec, unsigned base) {
+    size_t retval = 0;
+    if (!eval_integer_checked(dec, base, &retval)) {
+        cc_fatal("integer constant is too large: %.*s\n", (int) dec.len, dec.ptr);
+    }
+    return retval;
+}
+
+// Integer constants.
+//
+// The digits are taken 8 at a time: an 8-byte load, a check that every byte
+// is a digit of the base, and a few multiplications/shifts that combine the
+// bytes into one number (SWAR - SIMD within a register). The tail is done
+// one digit at a time. Overflow is checked once per step.
+
+#define SWAR_ONES   (0x0101010101010101ull)
+#define SWAR_HIGHS  (0x8080808080808080ull)
+#define SWAR_ZEROS  (0x3030303030303030ull)
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#   define SWAR_ENABLED (1)
+#else
+#   define SWAR_ENABLED (0)
+#endif
+
+// the value of a digit in any base up to 16, or something >= 16
+static unsigned digit_of(int c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return 0xFF;
+}
+
+static int mul_add_overflow(size_t *acc, size_t mul, size_t add)
+{
+#if defined(__GNUC__)
+    size_t tmp;
+    if (__builtin_mul_overflow(*acc, mul, &tmp)) {
+        return 1;
+    }
+    return __builtin_add_overflow(tmp, add, acc);
+#else
+    if (*acc > (SIZE_MAX - add) / mul) {
+        return 1;
+    }
+    *acc = *acc * mul + add;
+    return 0;
+#endif
+}
+
+static uint64_t load8(char *p)
+{
+    uint64_t x;
+    memcpy(&x, p, sizeof(x));
+    return x;
+}
+
+// every byte is in (m, n); requires m, n <= 128 and all bytes < 128
+static uint64_t swar_between(uint64_t x, uint64_t m, uint64_t n)
+{
+    return ((SWAR_ONES * (127 + n) - (x & SWAR_ONES * 127)) & ~x
+            & ((x & SWAR_ONES * 127) + SWAR_ONES * (127 - m))) & SWAR_HIGHS;
+}
+
+static int swar_is_digits(uint64_t x, unsigned base)
+{
+    if (x & SWAR_HIGHS) {
+        return 0;
+    }
+    if (base == 2) {
+        return (x & 0xFEFEFEFEFEFEFEFEull) == SWAR_ZEROS;
+    }
+    if (base == 8) {
+        return (x & 0xF8F8F8F8F8F8F8F8ull) == SWAR_ZEROS;
+    }
+    if (base == 10) {
+        return (x & 0xF0F0F0F0F0F0F0F0ull) == SWAR_ZEROS
+                && ((x + 0x0606060606060606ull) & 0xF0F0F0F0F0F0F0F0ull) == SWAR_ZEROS;
+    }
+    // 0-9, or a-f after folding the case
+    uint64_t lower = x | 0x2020202020202020ull;
+    return (swar_between(x, '0' - 1, '9' + 1) | swar_between(lower, 'a' - 1, 'f' + 1)) == SWAR_HIGHS;
+}
+
+// 8 decimal digits, the first one is the most significant
+static uint64_t swar_dec8(uint64_t x)
+{
+    x -= SWAR_ZEROS;
+    x = (x * 10) + (x >> 8);
+    x = (((x & 0x000000FF000000FFull) * (100 + (1000000ull << 32)))
+            + (((x >> 16) & 0x000000FF000000FFull) * (1 + (10000ull << 32)))) >> 32;
+    return x;
+}
+
+// 8 digits of a base 2^k: pairs of digits, then pairs of pairs, then the two halves
+static uint64_t swar_pow2_8(uint64_t x, unsigned k)
+{
+    if (k == 4) {
+        // hex letters: the low nibble plus 9
+        x = (x & 0x0F0F0F0F0F0F0F0Full) + ((x >> 6) & SWAR_ONES) * 9;
+    } else {
+        x -= SWAR_ZEROS;
+    }
+    x = ((x << k) | (x >> 8)) & 0x00FF00FF00FF00FFull;
+    x = ((x << (2 * k)) | (x >> 16)) & 0x0000FFFF0000FFFFull;
+    x = ((x << (4 * k)) | (x >> 32)) & ((1ull << (8 * k)) - 1);
+    return x;
+}
+
+int eval_integer_checked(Slice dec, unsigned base, size_t *out) {
+    assert(dec.ptr);
+    assert(out);
     assert(base == 2 || base == 8 || base == 10 || base == 16);
+    assert(dec.len);
 
-    size_t len = strlen(dec);
-    assert(len);
+    unsigned k = base == 2 ? 1 : base == 8 ? 3 : base == 16 ? 4 : 0;
 
     size_t retval = 0;
+    size_t i = 0;
+
+    if (SWAR_ENABLED) {
+        // base^8: 10^8, or 2^(8k)
+        size_t step = k ? ((size_t) 1 << (8 * k)) : 100000000u;
 
-    for (size_t i = 0; i < len; i++) {
-        int c = dec[i];
-        assert(char_correct_for_base(c, base));
-        retval = retval * base + char_value(base, c);
+        for (; i + 8 <= dec.len; i += 8) {
+            uint64_t x = load8(dec.ptr + i);
+            if (!swar_is_digits(x, base)) {
+                cc_fatal("not a digit for base %u in: %.*s\n", base, (int) dec.len, dec.ptr);
+            }
+            size_t chunk = k ? swar_pow2_8(x, k) : swar_dec8(x);
+            if (mul_add_overflow(&retval, step, chunk)) {
+                return 0;
+            }
+        }
     }
 
-    return retval;
+    for (; i < dec.len; i++) {
+        unsigned v = digit_of(dec.ptr[i]);
+        if (v >= base) {
+            cc_fatal("not a digit for base %u in: %.*s\n", base, (int) dec.len, dec.ptr);
+        }
+        if (mul_add_overflow(&retval, base, v)) {
+            return 0;
+        }
+    }
 
+    *out = retval;
+    return 1;
 }
 
-double eval_float_16(char *dec, char *mnt, char *exp, char sig) {
+// Floating constants.
+//
+// Both functions return exactly the double nearest to the value that is written
+// (ties to even), the way strtod() does. Hex constants are assembled from their bits.
+// Decimal ones take the first 19 significant digits, and then:
+//
+// 1) Clinger's fast path: when the digits and 10^|q| are both exact doubles,
+//    one IEEE multiplication or division is already correctly rounded;
+// 2) Eisel-Lemire: multiply by a 128-bit approximation of 10^q from pow10.data,
+//    which gives the answer unless the product lands too close to a halfway point;
+// 3) otherwise - the slow path: compare the exact decimal value with the halfway
+//    points around a candidate using big integers, and step to the right neighbour.
 
-    assert(dec);
-    assert(mnt);
-    assert(exp);
-    assert(sig == '-' || sig == '+');
+#define DBL_MANT_BITS   (52)
+#define DBL_EXP_BIAS    (1023)
+#define DBL_EXP_INF     (0x7FF)
+#define DBL_BITS_INF    ((uint64_t) DBL_EXP_INF << DBL_MANT_BITS)
+#define DBL_MANT_MASK   (((uint64_t) 1 << DBL_MANT_BITS) - 1)
+
+// the range of the pow10.data table
+#define POW10_MIN_EXP   (-342)
+#define POW10_MAX_EXP   (308)
 
-    size_t declen = strlen(dec);
-    size_t mntlen = strlen(mnt);
-    size_t explen = strlen(exp);
+// 19 decimal digits always fit into u64
+#define U64_MAX_DIGITS  (19)
 
-    double realval = 0.0;
+// Exponents past these are inf/zero anyway, but we still have to count digits
+// without overflowing an int.
+#define EXP_SATURATION  (100000)
 
-    for (size_t i = 0; i < declen; i++) {
-        const int c = dec[i];
-        realval = realval * 16.0 + (double) char_value(16, c);
+static const uint64_t pow10_table[][2] = {
+#   define p10(hi, lo) { hi, lo },
+#   include "pow10.data"
+#   undef p10
+};
+
+static const double exact_pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static double bits_to_double(uint64_t bits)
+{
+    double d;
+    memcpy(&d, &bits, sizeof(d));
+    return d;
+}
+
+static uint64_t double_to_bits(double d)
+{
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    return bits;
+}
+
+static int clz64(uint64_t x)
+{
+    assert(x);
+#if defined(__GNUC__)
+    return __builtin_clzll(x);
+#else
+    int n = 0;
+    while (!(x & ((uint64_t) 1 << 63))) {
+        x <<= 1;
+        n++;
     }
+    return n;
+#endif
+}
+
+static void mul64(uint64_t a, uint64_t b, uint64_t *hi, uint64_t *lo)
+{
+#if defined(__SIZEOF_INT128__)
+    unsigned __int128 r = (unsigned __int128) a * b;
+    *hi = (uint64_t) (r >> 64);
+    *lo = (uint64_t) r;
+#else
+    uint64_t a0 = (uint32_t) a, a1 = a >> 32;
+    uint64_t b0 = (uint32_t) b, b1 = b >> 32;
+    uint64_t p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0, p11 = a1 * b1;
+    uint64_t mid = (p00 >> 32) + (uint32_t) p01 + (uint32_t) p10;
+    *hi = p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+    *lo = (mid << 32) | (uint32_t) p00;
+#endif
+}
 
-    if (mntlen > 0) {
-        double m = 0.0625;
-        for (size_t i = 0; i < mntlen; i++) {
-            const int c = mnt[i];
-            realval = realval + (double) char_value(16, c) * m;
-            m *= 0.0625;
+static int eval_exponent(Slice e, char sig)
+{
+    int pow = 0;
+    for (size_t i = 0; i < e.len; i++) {
+        if (pow < EXP_SATURATION) {
+            pow = pow * 10 + (int) char_value(10, e.ptr[i]);
         }
     }
+    return sig == '-' ? -pow : pow;
+}
+
+// The value is: (all significant digits) * 10^q.
+// The first [len] chars of [a] are followed by the [b] ones.
+typedef struct decimal {
+    Slice a;
+    Slice b;
+    int q;
+} Decimal;
 
-    int div = 0;
-    if (sig == '-') {
-        div = 1;
+static size_t dec_digits_count(Decimal *d)
+{
+    return d->a.len + d->b.len;
+}
+
+static int dec_digit(Decimal *d, size_t i)
+{
+    if (i < d->a.len) {
+        return d->a.ptr[i] - '0';
     }
+    return d->b.ptr[i - d->a.len] - '0';
+}
 
-    if (explen > 0) {
+static Decimal make_decimal(Slice dec, Slice mnt, int exp)
+{
+    Decimal d = { .a = dec, .b = mnt, .q = exp - (int) mnt.len };
 
-        int pow = 0;
-        for (size_t i = 0; i < explen; i++) {
-            const int c = exp[i];
-            pow = pow * 10 + (int) char_value(10, c);
+    // leading zeros change nothing, strip them once here
+    while (d.a.len && d.a.ptr[0] == '0') {
+        d.a.ptr++;
+        d.a.len--;
+    }
+    if (d.a.len == 0) {
+        while (d.b.len && d.b.ptr[0] == '0') {
+            d.b.ptr++;
+            d.b.len--;
         }
-        double m = 1.0;
-        for (int i = 0; i < pow; i++) {
-            m *= 2.0;
+    }
+    return d;
+}
+
+// Eisel-Lemire: w * 10^q, w != 0, q in the table range.
+// Returns 0 when the result cannot be decided here.
+static int eisel_lemire(uint64_t w, int q, uint64_t *out)
+{
+    assert(w);
+    assert(q >= POW10_MIN_EXP && q <= POW10_MAX_EXP);
+
+    const uint64_t *pow = pow10_table[q - POW10_MIN_EXP];
+
+    int lz = clz64(w);
+    w <<= lz;
+
+    // floor(log2(10) * q) + 64 + bias - lz
+    int64_t exp2 = ((217706 * (int64_t) q) >> 16) + 64 + DBL_EXP_BIAS - lz;
+
+    uint64_t hi, lo;
+    mul64(w, pow[0], &hi, &lo);
+
+    // the low 9 bits are all ones: the truncated tail of 10^q may carry into them
+    if ((hi & 0x1FF) == 0x1FF && lo + w < w) {
+        uint64_t hi2, lo2;
+        mul64(w, pow[1], &hi2, &lo2);
+
+        uint64_t merged_hi = hi;
+        uint64_t merged_lo = lo + hi2;
+        if (merged_lo < lo) {
+            merged_hi++;
         }
-        if (div) {
-            realval /= m;
-        } else {
-            realval *= m;
+        if ((merged_hi & 0x1FF) == 0x1FF && merged_lo + 1 == 0 && lo2 + w < w) {
+            return 0;
         }
+        hi = merged_hi;
+        lo = merged_lo;
+    }
+
+    // shift to 54 bits
+    uint64_t msb = hi >> 63;
+    uint64_t mant = hi >> (msb + 9);
+    exp2 -= 1 ^ msb;
 
+    // exactly halfway between two doubles: can't tell without the exact value
+    if (lo == 0 && (hi & 0x1FF) == 0 && (mant & 3) == 1) {
+        return 0;
     }
 
-    return realval;
+    // 54 -> 53 bits, round half up (the halfway case is excluded above)
+    mant += mant & 1;
+    mant >>= 1;
+    if (mant >> 53) {
+        mant >>= 1;
+        exp2 += 1;
+    }
+
+    // subnormal, or inf: leave it to the slow path
+    if (exp2 <= 0 || exp2 >= DBL_EXP_INF) {
+        return 0;
+    }
 
+    *out = ((uint64_t) exp2 << DBL_MANT_BITS) | (mant & DBL_MANT_MASK);
+    return 1;
 }
 
-double eval_float_10(char *dec, char *mnt, char *exp, char sig) {
+// Big unsigned integers for the slow path.
+// The operands are bounded: up to BIG_MAX_DIGITS decimal digits times 5^k,
+// where k is limited by the table range and by the number of digits.
 
-    assert(dec);
-    assert(mnt);
-    assert(exp);
-    assert(sig == '-' || sig == '+');
+#define BIG_MAX_DIGITS  (768)
+#define BIG_LIMBS       (160)
+
+typedef struct bignum {
+    uint32_t limb[BIG_LIMBS];
+    size_t size;
+} BigNum;
+
+static void big_mul_small(BigNum *b, uint32_t m, uint32_t add)
+{
+    uint64_t carry = add;
+    for (size_t i = 0; i < b->size; i++) {
+        uint64_t x = (uint64_t) b->limb[i] * m + carry;
+        b->limb[i] = (uint32_t) x;
+        carry = x >> 32;
+    }
+    if (carry) {
+        if (b->size >= BIG_LIMBS) {
+            cc_fatal("floating constant is too big to evaluate");
+        }
+        b->limb[b->size++] = (uint32_t) carry;
+    }
+}
+
+static void big_mul_pow5(BigNum *b, int n)
+{
+    // 5^13 is the biggest power that fits into u32
+    for (; n >= 13; n -= 13) {
+        big_mul_small(b, 1220703125u, 0);
+    }
+    static const uint32_t small[] = { 1, 5, 25, 125, 625, 3125, 15625, 78125, 390625, 1953125,
+            9765625, 48828125, 244140625 };
+    if (n > 0) {
+        big_mul_small(b, small[n], 0);
+    }
+}
 
-    size_t declen = strlen(dec);
-    size_t mntlen = strlen(mnt);
-    size_t explen = strlen(exp);
+static void big_shl(BigNum *b, int n)
+{
+    assert(n >= 0);
+    if (b->size == 0) {
+        return;
+    }
+
+    size_t words = n / 32;
+    int bits = n % 32;
+
+    if (b->size + words + 1 > BIG_LIMBS) {
+        cc_fatal("floating constant is too big to evaluate");
+    }
+
+    b->limb[b->size] = 0;
+    for (ptrdiff_t i = b->size; i >= 0; i--) {
+        uint32_t x = b->limb[i] << bits;
+        if (bits && i > 0) {
+            x |= b->limb[i - 1] >> (32 - bits);
+        }
+        b->limb[i + words] = x;
+    }
+    for (size_t i = 0; i < words; i++) {
+        b->limb[i] = 0;
+    }
+
+    b->size += words + 1;
+    while (b->size && b->limb[b->size - 1] == 0) {
+        b->size--;
+    }
+}
+
+static int big_cmp(BigNum *a, BigNum *b)
+{
+    if (a->size != b->size) {
+        return a->size < b->size ? -1 : 1;
+    }
+    for (size_t i = a->size; i-- > 0;) {
+        if (a->limb[i] != b->limb[i]) {
+            return a->limb[i] < b->limb[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+static void big_from_u64(BigNum *b, uint64_t x)
+{
+    b->size = 0;
+    while (x) {
+        b->limb[b->size++] = (uint32_t) x;
+        x >>= 32;
+    }
+}
+
+// Compare digits*10^q (plus something tiny if [inexact]) with k*2^h.
+static int compare_halfway(BigNum *digits, int q, int inexact, uint64_t k, int h)
+{
+    BigNum lhs = *digits;
+    BigNum rhs;
+    big_from_u64(&rhs, k);
+
+    // digits * 5^q * 2^q <=> k * 2^h
+    if (q >= 0) {
+        big_mul_pow5(&lhs, q);
+    } else {
+        big_mul_pow5(&rhs, -q);
+    }
+    if (q > h) {
+        big_shl(&lhs, q - h);
+    } else {
+        big_shl(&rhs, h - q);
+    }
+
+    int c = big_cmp(&lhs, &rhs);
+    if (c == 0 && inexact) {
+        return 1;
+    }
+    return c;
+}
+
+static double slow_path(Decimal *d, double candidate)
+{
+    BigNum digits = { .size = 0 };
 
-    double realval = 0.0;
+    size_t ndigits = dec_digits_count(d);
+    size_t used = ndigits < BIG_MAX_DIGITS ? ndigits : BIG_MAX_DIGITS;
 
-    for (size_t i = 0; i < declen; i++) {
-        const int c = dec[i];
-        realval = realval * 10.0 + (double) char_value(10, c);
+    // the digits after the first BIG_MAX_DIGITS can't change the result,
+    // only whether we are exactly at a halfway point or just above it
+    int inexact = 0;
+    for (size_t i = used; i < ndigits; i++) {
+        if (dec_digit(d, i) != 0) {
+            inexact = 1;
+            break;
+        }
+    }
+    int q = d->q + (int) (ndigits - used);
+
+    // trailing zeros only make the numbers bigger
+    while (used > 1 && dec_digit(d, used - 1) == 0) {
+        used--;
+        q++;
     }
 
-    if (mntlen > 0) {
-        double m = 0.1;
-        for (size_t i = 0; i < mntlen; i++) {
-            const int c = mnt[i];
-            realval = realval + (double) char_value(10, c) * m;
-            m *= 0.1;
+    for (size_t i = 0; i < used; i++) {
+        uint32_t v = dec_digit(d, i);
+        if (digits.size == 0) {
+            big_from_u64(&digits, v);
+        } else {
+            big_mul_small(&digits, 10, v);
         }
     }
 
-    int div = 0;
-    if (sig == '-') {
-        div = 1;
+    uint64_t bits = double_to_bits(candidate);
+    if (bits > DBL_BITS_INF) {
+        bits = DBL_BITS_INF;
     }
 
-    if (explen > 0) {
+    for (;;) {
+        uint64_t exp = bits >> DBL_MANT_BITS;
+        uint64_t mant = bits & DBL_MANT_MASK;
 
-        int pow = 0;
-        for (size_t i = 0; i < explen; i++) {
-            const int c = exp[i];
-            pow = pow * 10 + (int) char_value(10, c);
+        // bits == mant * 2^h, where mant is the integer mantissa
+        int h = -1074;
+        if (exp) {
+            mant |= (uint64_t) 1 << DBL_MANT_BITS;
+            h = (int) exp - DBL_EXP_BIAS - DBL_MANT_BITS;
         }
-        double m = 1.0;
-        for (int i = 0; i < pow; i++) {
-            m *= 10.0;
+        int odd = (int) (mant & 1);
+
+        if (bits < DBL_BITS_INF) {
+            // halfway to the next one: (2m + 1) * 2^(h - 1)
+            int c = compare_halfway(&digits, q, inexact, 2 * mant + 1, h - 1);
+            if (c > 0 || (c == 0 && odd)) {
+                bits++;
+                continue;
+            }
         }
-        if (div) {
-            realval /= m;
+
+        if (bits > 0) {
+            // halfway to the previous one; at the bottom of a binade the ulp below is half as big
+            int c;
+            if (exp > 1 && (mant & DBL_MANT_MASK) == 0) {
+                c = compare_halfway(&digits, q, inexact, 4 * mant - 1, h - 2);
+            } else {
+                c = compare_halfway(&digits, q, inexact, 2 * mant - 1, h - 1);
+            }
+            if (c < 0 || (c == 0 && odd)) {
+                bits--;
+                continue;
+            }
+        }
+
+        return bits_to_double(bits);
+    }
+}
+
+double eval_float_16(Slice d, Slice m, Slice e, char sig) {
+
+    assert(d.ptr);
+    assert(m.ptr);
+    assert(e.ptr);
+    assert(sig == '-' || sig == '+');
+
+    Decimal digits = make_decimal(d, m, 0);
+    size_t ndigits = dec_digits_count(&digits);
+
+    // the first 16 significant hex digits, the rest only as a sticky bit
+    uint64_t mant = 0;
+    int sticky = 0;
+    int exp2 = eval_exponent(e, sig) - 4 * (int) m.len;
+
+    for (size_t i = 0; i < ndigits; i++) {
+        int c = i < digits.a.len ? digits.a.ptr[i] : digits.b.ptr[i - digits.a.len];
+        int v = (int) char_value(16, c);
+        if (i < 16) {
+            mant = mant * 16 + v;
         } else {
-            realval *= m;
+            exp2 += 4;
+            sticky |= v != 0;
+        }
+    }
+
+    if (mant == 0) {
+        return 0.0;
+    }
+
+    // mant * 2^exp2, normalize to 1.xxx * 2^e with the leading bit at 63
+    int lz = clz64(mant);
+    mant <<= lz;
+    int64_t biased = (int64_t) exp2 - lz + 63 + DBL_EXP_BIAS;
+
+    if (biased >= DBL_EXP_INF) {
+        return bits_to_double(DBL_BITS_INF);
+    }
+
+    // how many low bits do not fit: 11 for normal numbers, more for subnormals
+    int64_t shift = 11;
+    if (biased <= 0) {
+        shift = 12 - biased;
+        biased = 0;
+    }
+    if (shift > 64) {
+        return 0.0;
+    }
+
+    uint64_t kept = shift == 64 ? 0 : mant >> shift;
+    uint64_t rest = shift == 64 ? mant : mant & (((uint64_t) 1 << shift) - 1);
+    uint64_t half = (uint64_t) 1 << (shift - 1);
+
+    if (rest > half || (rest == half && (sticky || (kept & 1)))) {
+        kept += 1;
+    }
+
+    if (biased == 0) {
+        // subnormal; rounding up to 2^52 gives the smallest normal, and the bits agree
+        return bits_to_double(kept);
+    }
+
+    if (kept >> (DBL_MANT_BITS + 1)) {
+        kept >>= 1;
+        biased += 1;
+        if (biased >= DBL_EXP_INF) {
+            return bits_to_double(DBL_BITS_INF);
+        }
+    }
+
+    return bits_to_double(((uint64_t) biased << DBL_MANT_BITS) | (kept & DBL_MANT_MASK));
+}
+
+double eval_float_10(Slice d, Slice m, Slice e, char sig) {
+
+    assert(d.ptr);
+    assert(m.ptr);
+    assert(e.ptr);
+    assert(sig == '-' || sig == '+');
+
+    Decimal digits = make_decimal(d, m, eval_exponent(e, sig));
+    size_t ndigits = dec_digits_count(&digits);
+
+    uint64_t w = 0;
+    size_t taken = ndigits < U64_MAX_DIGITS ? ndigits : U64_MAX_DIGITS;
+    for (size_t i = 0; i < taken; i++) {
+        w = w * 10 + dec_digit(&digits, i);
+    }
+
+    int truncated = 0;
+    for (size_t i = taken; i < ndigits; i++) {
+        if (dec_digit(&digits, i) != 0) {
+            truncated = 1;
+            break;
         }
+    }
+
+    // w * 10^q, and the exact value is in [w, w + 1) * 10^q
+    int q = digits.q + (int) (ndigits - taken);
 
+    if (w == 0) {
+        return 0.0;
+    }
+    if (q < POW10_MIN_EXP) {
+        return 0.0;
+    }
+    if (q > POW10_MAX_EXP) {
+        return bits_to_double(DBL_BITS_INF);
     }
 
-    return realval;
+    if (!truncated && w <= ((uint64_t) 1 << 53)) {
+        if (q >= 0 && q <= 22) {
+            return (double) w * exact_pow10[q];
+        }
+        if (q < 0 && q >= -22) {
+            return (double) w / exact_pow10[-q];
+        }
+    }
+
+    uint64_t bits;
+    if (eisel_lemire(w, q, &bits)) {
+        if (!truncated) {
+            return bits_to_double(bits);
+        }
+        // the digits we threw away are somewhere in (w, w + 1)
+        uint64_t upper;
+        if (w + 1 != 0 && eisel_lemire(w + 1, q, &upper) && upper == bits) {
+            return bits_to_double(bits);
+        }
+    }
+
+    // any candidate close enough will do, the slow path walks to the right one
+    long double approx = (long double) w;
+    for (int i = 0; i < q; i++) {
+        approx *= 10.0L;
+    }
+    for (int i = 0; i > q; i--) {
+        approx /= 10.0L;
+    }
+    return slow_path(&digits, (double) approx);
 }
@@ -2,9 +2,15 @@
 #define CCORE_EVAL_H_
 
 #include <stddef.h>
+#include "str.h"
 
 size_t eval_integer(char *dec, unsigned base);
-double eval_float_16(char *dec, char *mnt, char *exp, char sig);
-double eval_float_10(char *dec, char *mnt, char *exp, char sig);
+size_t eval_integer_slice(Slice dec, unsigned base);
+
+/// The same, but returns 0 instead of wrapping around
+/// when the value does not fit into 64 bits.
+int eval_integer_checked(Slice dec, unsigned base, size_t *out);
+double eval_float_16(Slice dec, Slice mnt, Slice exp, char sig);
+double eval_float_10(Slice dec, Slice mnt, Slice exp, char sig);
 
 #endif /* CCORE_EVAL_H_ */
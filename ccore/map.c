@@ -1,17 +1,161 @@
 #include "map.h"
+#include "str.h"
 
 map_impl(char*, int, str_i32);
 
-size_t hashmap_hash_str(char *key)
+#define MAP_ARENA_FIRST (4 * 1024)
+#define MAP_ARENA_ALIGN (16)
+
+MapArena* map_arena_new()
+{
+    MapArena *arena = cc_malloc(sizeof(MapArena));
+    arena->block = NULL;
+    arena->left = 0;
+    arena->blocks = NULL;
+    arena->nblocks = arena->alloc = 0;
+    return arena;
+}
+
+void* map_arena_alloc(MapArena *arena, size_t size)
+{
+    assert(arena);
+
+    // everything in a block stays aligned for any entry
+    size = (size + MAP_ARENA_ALIGN - 1) & ~((size_t) MAP_ARENA_ALIGN - 1);
+    if (size > arena->left) {
+        // 4K, then twice as much each time, up to 64K: an arena that
+        // stays small costs little
+        size_t block = MAP_ARENA_FIRST << (arena->nblocks < 4 ? arena->nblocks : 4);
+        int alone = size > block / 4;
+        if (alone) {
+            block = size;
+        }
+        if (arena->nblocks == arena->alloc) {
+            arena->alloc = arena->alloc ? arena->alloc * 2 : 16;
+            arena->blocks = cc_realloc(arena->blocks, sizeof(void*) * arena->alloc);
+        }
+        char *at = cc_malloc(block);
+        arena->blocks[arena->nblocks++] = at;
+        if (alone) {
+            return at;
+        }
+        arena->block = at;
+        arena->left = block;
+    }
+    char *at = arena->block;
+    arena->block += size;
+    arena->left -= size;
+    return at;
+}
+
+void map_arena_free(MapArena **arena)
+{
+    assert(arena);
+
+    MapArena *a = *arena;
+    if (a == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < a->nblocks; i += 1) {
+        cc_free(&a->blocks[i]);
+    }
+    cc_free(&a->blocks);
+    cc_free(arena);
+}
+
+// wyhash (Wang Yi, public domain): eight bytes at a time, and a
+// multiply that folds the 128-bit product.
+
+static const uint64_t wy_secret[4] = {
+    0xa0761d6478bd642full, 0xe7037ed1a0b428dbull, 0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull
+};
+
+static void wy_mum(uint64_t *a, uint64_t *b)
+{
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = (__uint128_t) *a * *b;
+    *a = (uint64_t) r;
+    *b = (uint64_t) (r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t) *a, lb = (uint32_t) *b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb, t = rl + (rm0 << 32);
+    uint64_t c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static uint64_t wy_mix(uint64_t a, uint64_t b)
+{
+    wy_mum(&a, &b);
+    return a ^ b;
+}
+
+static uint64_t wy_r8(const unsigned char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static uint64_t wy_r4(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static uint64_t wy_r3(const unsigned char *p, size_t k)
+{
+    return ((uint64_t) p[0] << 16) | ((uint64_t) p[k >> 1] << 8) | p[k - 1];
+}
+
+size_t hashmap_hash_bytes(const void *data, size_t len)
 {
-    unsigned char *str = (unsigned char*) key;
+    const unsigned char *p = (const unsigned char*) data;
+    const uint64_t *s = wy_secret;
+    uint64_t seed = wy_mix(s[0], s[1]);
+    uint64_t a = 0, b = 0;
 
-    // djb2
-    size_t hash = 5381;
-    size_t c;
-    while ((c = *str++))
-        hash = ((hash << 5) + hash) + c; // hash * 33 + c
-    return hash;
+    if (len <= 16) {
+        if (len >= 4) {
+            a = (wy_r4(p) << 32) | wy_r4(p + ((len >> 3) << 2));
+            b = (wy_r4(p + len - 4) << 32) | wy_r4(p + len - 4 - ((len >> 3) << 2));
+        } else if (len > 0) {
+            a = wy_r3(p, len);
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = wy_mix(wy_r8(p) ^ s[1], wy_r8(p + 8) ^ seed);
+                see1 = wy_mix(wy_r8(p + 16) ^ s[2], wy_r8(p + 24) ^ see1);
+                see2 = wy_mix(wy_r8(p + 32) ^ s[3], wy_r8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = wy_mix(wy_r8(p) ^ s[1], wy_r8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = wy_r8(p + i - 16);
+        b = wy_r8(p + i - 8);
+    }
+    a ^= s[1];
+    b ^= seed;
+    wy_mum(&a, &b);
+    return (size_t) wy_mix(a ^ s[0] ^ len, b ^ s[1]);
+}
+
+size_t hashmap_hash_str(char *key)
+{
+    return hashmap_hash_bytes(key, strlen(key));
 }
 
 int hashmap_equal_str(char *key1, char *key2)
@@ -19,6 +163,16 @@ int hashmap_equal_str(char *key1, char *key2)
     return strcmp(key1, key2) == 0;
 }
 
+size_t hashmap_hash_slice(Slice *key)
+{
+    return hashmap_hash_bytes(key->ptr, key->len);
+}
+
+int hashmap_equal_slice(Slice *key1, Slice *key2)
+{
+    return key1->len == key2->len && memcmp(key1->ptr, key2->ptr, key1->len) == 0;
+}
+
 size_t hashmap_hash_int(int key)
 {
     return ((size_t) key);
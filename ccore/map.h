@@ -3,6 +3,22 @@
 
 #include "xmem.h"
 
+// Where the entries of maps may come from, instead of one cc_malloc()
+// each: blocks, given back all at once by map_arena_free(), after every
+// map that took from it is gone. Any number of maps can share one.
+typedef struct map_arena MapArena;
+
+struct map_arena {
+    char *block; // the one the next entry goes in
+    size_t left;
+    void **blocks;
+    size_t nblocks, alloc;
+};
+
+MapArena* map_arena_new();
+void* map_arena_alloc(MapArena *arena, size_t size);
+void map_arena_free(MapArena **arena);
+
 #define MAP_INIT(NAME, hash, equal) { \
       .hash_fn = hash  \
     , .equal_fn = equal   \
@@ -10,6 +26,8 @@
     , .capacity = 0                        \
     , .threshold = 0                        \
     , .table = NULL                        \
+    , .arena = NULL                        \
+    , .spare = NULL                        \
     , .functions = &(map_functions_impl_##NAME) }
 
 #define map_proto(KTYPE, VTYPE, NAME)                                                \
@@ -36,6 +54,8 @@
         size_t capacity;                                                                 \
         struct entry_##NAME** table;                                                     \
         size_t threshold;                                                                \
+        MapArena *arena; /* where the entries come from, when not NULL */                \
+        struct entry_##NAME* spare; /* entries to be used again */                       \
     };                                                                                   \
                                                                                          \
     struct map_result_##NAME {                                                           \
@@ -52,6 +72,13 @@
                                                                                          \
        struct map_result_##NAME (*map_remove)                                            \
            (struct hashmap_##NAME* self, KTYPE key);                                     \
+                                                                                         \
+       struct entry_##NAME* (*map_next)                                                  \
+           (struct hashmap_##NAME* self, size_t *bucket, struct entry_##NAME* entry);    \
+                                                                                         \
+       void (*map_clear)(struct hashmap_##NAME* self);                                   \
+       void (*map_destroy)(struct hashmap_##NAME** self);                                \
+       void (*map_reserve)(struct hashmap_##NAME* self, size_t size);                    \
     };                                                                                   \
                                                                                          \
     struct hashmap_##NAME*                                                               \
@@ -64,7 +91,15 @@
     map_get_##NAME(struct hashmap_##NAME* self, KTYPE key);                              \
                                                                                          \
     struct map_result_##NAME                                                             \
-    map_remove_##NAME(struct hashmap_##NAME *self, KTYPE key);
+    map_remove_##NAME(struct hashmap_##NAME *self, KTYPE key);                           \
+                                                                                         \
+    struct entry_##NAME*                                                                 \
+    map_next_##NAME(struct hashmap_##NAME *self, size_t *bucket,                         \
+        struct entry_##NAME *entry);                                                     \
+                                                                                         \
+    void map_clear_##NAME(struct hashmap_##NAME *self);                                  \
+    void map_destroy_##NAME(struct hashmap_##NAME **self);                               \
+    void map_reserve_##NAME(struct hashmap_##NAME *self, size_t size);
 
 #define map_impl(KTYPE, VTYPE, NAME)                                                 \
                                                                                      \
@@ -73,6 +108,10 @@ struct map_functions_##NAME map_functions_impl_##NAME =
     .map_put = &map_put_##NAME,                                                      \
     .map_get = &map_get_##NAME,                                                      \
     .map_remove = &map_remove_##NAME,                                                \
+    .map_next = &map_next_##NAME,                                                    \
+    .map_clear = &map_clear_##NAME,                                                  \
+    .map_destroy = &map_destroy_##NAME,                                              \
+    .map_reserve = &map_reserve_##NAME,                                              \
 };                                                                                   \
                                                                                      \
 static size_t                                                                        \
@@ -82,11 +121,18 @@ map_index_##NAME(struct hashmap_##NAME* self, KTYPE key, size_t capacity)
 }                                                                                    \
                                                                                      \
 static struct entry_##NAME *                                                         \
-map_entry_new_##NAME(KTYPE key, VTYPE val, struct entry_##NAME* next)                    \
+map_entry_new_##NAME(struct hashmap_##NAME* self, KTYPE key, VTYPE val,             \
+        struct entry_##NAME* next)                                                   \
 {                                                                                    \
-    struct entry_##NAME* entry =                                                     \
-        (struct entry_##NAME*)                                                       \
-            cc_malloc(sizeof(struct entry_##NAME));                                    \
+    struct entry_##NAME* entry = self->spare;                                        \
+    if (entry) {                                                                     \
+        self->spare = entry->next;                                                   \
+    } else if (self->arena) {                                                        \
+        entry = (struct entry_##NAME*)                                               \
+            map_arena_alloc(self->arena, sizeof(struct entry_##NAME));               \
+    } else {                                                                         \
+        entry = (struct entry_##NAME*) cc_malloc(sizeof(struct entry_##NAME));       \
+    }                                                                                \
     entry->key = key;                                                                \
     entry->val = val;                                                                \
     entry->next = next;                                                              \
@@ -117,6 +163,25 @@ map_init_table_##NAME(struct hashmap_##NAME *hashmap)                        \
     hashmap->threshold = hashmap->capacity * MAP_LOAD_FACTOR_##NAME;         \
 }                                                                            \
                                                                                      \
+static void                                                                          \
+map_rehash_##NAME(struct hashmap_##NAME *self, size_t new_capacity)                  \
+{                                                                                    \
+    struct entry_##NAME** new_table = map_empty_table_##NAME(new_capacity);          \
+    for (size_t i = 0; i < self->capacity; i++) {                                    \
+        struct entry_##NAME* next = NULL;                                            \
+        for (struct entry_##NAME* e = self->table[i]; e; e = next) {                 \
+            next = e->next;                                                          \
+            size_t index = map_index_##NAME(self, e->key, new_capacity);             \
+            e->next = new_table[index];                                              \
+            new_table[index] = e;                                                    \
+        }                                                                            \
+    }                                                                                \
+    cc_free(&(self->table));                                                         \
+    self->table = new_table;                                                         \
+    self->capacity = new_capacity;                                                   \
+    self->threshold = new_capacity * MAP_LOAD_FACTOR_##NAME;                         \
+}                                                                                    \
+                                                                                     \
 struct hashmap_##NAME*                                                               \
 map_new_##NAME(size_t (*hash_fn)(KTYPE key), int (*equal_fn)(KTYPE a, KTYPE b))      \
 {                                                                                    \
@@ -162,28 +227,13 @@ map_put_##NAME(struct hashmap_##NAME* self, KTYPE key, VTYPE val)
     }                                                                                \
                                                                                      \
     if (self->size >= self->threshold) {                                             \
-                                                                                     \
-        size_t new_capacity = self->capacity * 2 + 1;                                \
-        struct entry_##NAME** new_table = map_empty_table_##NAME(new_capacity);          \
-        for (size_t i = 0; i < self->capacity; i++) {                                \
-            struct entry_##NAME* next = NULL;                                        \
-            for (struct entry_##NAME* e = self->table[i]; e; e = next) {             \
-                next = e->next;                                                      \
-                size_t index = map_index_##NAME(self, e->key, new_capacity);             \
-                e->next = new_table[index];                                          \
-                new_table[index] = e;                                                \
-            }                                                                        \
-        }                                                                            \
-        cc_free(&(self->table));                                                           \
-        self->table = new_table;                                                     \
-        self->capacity = new_capacity;                                               \
-        self->threshold = new_capacity * MAP_LOAD_FACTOR_##NAME;                     \
-                                                                                     \
+        map_rehash_##NAME(self, self->capacity * 2 + 1);                             \
         index = map_index_##NAME(self, key, self->capacity);                             \
     }                                                                                \
                                                                                      \
     struct entry_##NAME* new_entry = map_entry_new_##NAME(                               \
-          key                                                                        \
+          self                                                                       \
+        , key                                                                        \
         , val                                                                        \
         , self->table[index]);                                                       \
                                                                                      \
@@ -237,7 +287,12 @@ map_remove_##NAME(struct hashmap_##NAME *self, KTYPE key)
                 prev->next = next;                                                   \
             }                                                                        \
             self->size -= 1;                                                         \
-            cc_free(&e);                                                                 \
+            if (self->arena) {                                                       \
+                e->next = self->spare;                                               \
+                self->spare = e;                                                     \
+            } else {                                                                 \
+                cc_free(&e);                                                         \
+            }                                                                        \
                                                                                      \
             struct map_result_##NAME result = { .value = val, .found = 1 };          \
             return result;                                                           \
@@ -246,6 +301,79 @@ map_remove_##NAME(struct hashmap_##NAME *self, KTYPE key)
                                                                                      \
     struct map_result_##NAME result = { .value = ((VTYPE)0), .found = 0 };           \
     return result;                                                                   \
+}                                                                                    \
+                                                                                     \
+struct entry_##NAME*                                                                 \
+map_next_##NAME(struct hashmap_##NAME *self, size_t *bucket,                         \
+        struct entry_##NAME *entry)                                                  \
+{                                                                                    \
+    assert(self);                                                                    \
+    assert(bucket);                                                                  \
+                                                                                     \
+    if (entry && entry->next) {                                                      \
+        return entry->next;                                                          \
+    }                                                                                \
+    for (; *bucket < self->capacity; *bucket += 1) {                                 \
+        if (self->table[*bucket]) {                                                  \
+            return self->table[(*bucket)++];                                         \
+        }                                                                            \
+    }                                                                                \
+    return NULL;                                                                     \
+}                                                                                    \
+                                                                                     \
+void                                                                                 \
+map_clear_##NAME(struct hashmap_##NAME *self)                                        \
+{                                                                                    \
+    assert(self);                                                                    \
+                                                                                     \
+    for (size_t i = 0; i < self->capacity; i++) {                                    \
+        struct entry_##NAME* next = NULL;                                            \
+        for (struct entry_##NAME* e = self->table[i]; e; e = next) {                 \
+            next = e->next;                                                          \
+            e->next = self->spare;                                                   \
+            self->spare = e;                                                         \
+        }                                                                            \
+        self->table[i] = NULL;                                                       \
+    }                                                                                \
+    self->size = 0;                                                                  \
+}                                                                                    \
+                                                                                     \
+void                                                                                 \
+map_destroy_##NAME(struct hashmap_##NAME **self)                                     \
+{                                                                                    \
+    assert(self);                                                                    \
+                                                                                     \
+    struct hashmap_##NAME *map = *self;                                              \
+    if (map == NULL) {                                                               \
+        return;                                                                      \
+    }                                                                                \
+    map_clear_##NAME(map);                                                           \
+    if (map->arena == NULL) {                                                        \
+        struct entry_##NAME* next = NULL;                                            \
+        for (struct entry_##NAME* e = map->spare; e; e = next) {                     \
+            next = e->next;                                                          \
+            cc_free(&e);                                                             \
+        }                                                                            \
+    }                                                                                \
+    cc_free(&(map->table));                                                          \
+    cc_free(self);                                                                   \
+}                                                                                    \
+                                                                                     \
+void                                                                                 \
+map_reserve_##NAME(struct hashmap_##NAME *self, size_t size)                         \
+{                                                                                    \
+    assert(self);                                                                    \
+                                                                                     \
+    if (self->capacity == 0) {                                                       \
+        map_init_table_##NAME(self);                                                 \
+    }                                                                                \
+    size_t capacity = self->capacity;                                                \
+    while ((size_t) (capacity * MAP_LOAD_FACTOR_##NAME) <= size) {                   \
+        capacity = capacity * 2 + 1;                                                 \
+    }                                                                                \
+    if (capacity != self->capacity) {                                                \
+        map_rehash_##NAME(self, capacity);                                           \
+    }                                                                                \
 }
 
 #define map(name) map_##name
@@ -254,10 +382,41 @@ map_remove_##NAME(struct hashmap_##NAME *self, KTYPE key)
 #define map_get(container, k) (container)->functions->map_get(container, k)
 #define map_remove(container, k) (container)->functions->map_remove(container, k)
 #define map_result(name) map_result_##name
+#define map_entry(name) map_entry_##name
+
+/// Takes the entries from arena; only for a map that never had any.
+#define map_use_arena(container, a) (assert((container)->size == 0 && (container)->spare == NULL), (container)->arena = (a))
+
+/// Every entry, in no order: entry is a map_entry(name)*, with ->key
+/// and ->val. Nothing is to be put nor removed meanwhile; the keys and
+/// the values may be changed, or freed.
+#define map_foreach(container, entry) \
+    for (size_t __b__ = 0; \
+         (entry = (container)->functions->map_next(container, &__b__, __b__ ? entry : NULL)); )
+
+/// Drops every entry and keeps the table: the entries are used again
+/// by the next puts.
+#define map_clear(container) (container)->functions->map_clear(container)
+
+/// Frees the map and its entries (not the keys nor the values: they are
+/// the caller's), and sets container to NULL.
+#define map_destroy(container) \
+    do { if (container) (container)->functions->map_destroy(&(container)); } while (0)
+
+/// Makes room for size entries, so that no put rehashes before then.
+#define map_reserve(container, size) (container)->functions->map_reserve(container, size)
+
+size_t hashmap_hash_bytes(const void *data, size_t len);
 
 size_t hashmap_hash_str(char* key);
 int hashmap_equal_str(char* key1, char* key2);
 
+// Keys that are (ptr, len) slices of somebody else's buffer: a lookup
+// needs no NUL-terminated copy of what it looks for.
+struct slice;
+size_t hashmap_hash_slice(struct slice *key);
+int hashmap_equal_slice(struct slice *key1, struct slice *key2);
+
 size_t hashmap_hash_int(int key);
 int hashmap_equal_int(int key1, int key2);
 
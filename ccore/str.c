@@ -478,23 +478,24 @@ vec(str)* sb_split_str(char *input, char *sep, int include_empty)
     return rv;
 }
 
+Slice slice_new(char *ptr, size_t len)
+{
+    assert(ptr);
+    Slice s = { .ptr = ptr, .len = len };
+    return s;
+}
 
+int slice_equal_str(Slice s, char *str)
+{
+    assert(str);
+    size_t len = strlen(str);
+    return s.len == len && memcmp(s.ptr, str, len) == 0;
+}
 
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
+char* slice_dup(Slice s)
+{
+    char *rv = cc_malloc(s.len + 1);
+    memcpy(rv, s.ptr, s.len);
+    rv[s.len] = '\0';
+    return rv;
+}
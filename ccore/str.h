@@ -6,6 +6,14 @@
 
 #define STR_INIT VEC_INIT(i8)
 
+// A view into somebody else's buffer: not owned, not NUL-terminated.
+// Used when we want to look at the parts of an input without copying them.
+typedef struct slice Slice;
+struct slice {
+    char *ptr;
+    size_t len;
+};
+
 int sb_addc(Str *s, char c);
 size_t sb_adds(Str *s, char *news);
 Str* sb_new();
@@ -37,5 +45,9 @@ int sb_char_at(Str *buf, size_t index);
 ptrdiff_t sb_find(char *s, char *p);
 vec(str) *sb_split_str(char *input, char *sep, int include_empty);
 
+Slice slice_new(char *ptr, size_t len);
+int slice_equal_str(Slice s, char *str);
+char* slice_dup(Slice s);
+
 #endif /* STR_H_ */
 
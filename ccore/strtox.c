@@ -6,9 +6,9 @@
 
 static int evaluate(Strtox *);
 
-static void cut_for_base(Str *buffer, Str *out, unsigned base)
+static char* cut_for_base(char *p, char *end, Slice *out, unsigned base)
 {
-    assert(buffer);
+    assert(p);
     assert(out);
 
     int base_ok = base == 2 || base == 8 || base == 10 || base == 16;
@@ -16,196 +16,224 @@ static void cut_for_base(Str *buffer, Str *out, unsigned base)
         cc_fatal("it is not a correct base: %d\n", base);
     }
 
-    while (!sb_is_empty(buffer)) {
-        char peek = sb_peek_last(buffer);
+    char *begin = p;
+    for (; p < end; p++) {
+        char peek = *p;
         int need_break = (base == 2 && !is_bin(peek)) || (base == 8 && !is_oct(peek))
                 || (base == 10 && !is_dec(peek)) || (base == 16 && !is_hex(peek));
         if (need_break) {
             break;
         }
-
-        char c = sb_pop(buffer);
-        sb_addc(out, c);
     }
+
+    *out = slice_new(begin, p - begin);
+    return p;
 }
 
-static char cut_mnt_exp(Str *buffer, Str *mnt, Str *exp, unsigned mnt_base)
+static char* cut_mnt_exp(char *p, char *end, Slice *mnt, Slice *exp, char *exp_sign,
+        unsigned mnt_base)
 {
 
-    assert(buffer);
+    assert(p);
     assert(mnt);
     assert(exp);
+    assert(exp_sign);
 
     int base_ok = mnt_base == 10 || mnt_base == 16;
     if (!base_ok) {
         cc_fatal("it is not a correct base for a mantissa: %d\n", mnt_base);
     }
 
-    char exp_sign = '+';
-    if (!sb_is_empty(buffer) && sb_peek_last(buffer) == '.') {
-        sb_pop(buffer);
-        cut_for_base(buffer, mnt, mnt_base);
+    *exp_sign = '+';
+    if (p < end && *p == '.') {
+        p = cut_for_base(p + 1, end, mnt, mnt_base);
     }
 
-    if (!sb_is_empty(buffer)) {
+    if (p < end) {
 
-        int peek = sb_peek_last(buffer);
+        int peek = *p;
         int is_hex_exp = peek == 'p' || peek == 'P';
         int is_dec_exp = peek == 'e' || peek == 'E';
 
+        // a hex exponent part in a decimal floating constant
         if (is_hex_exp && mnt_base != 16) {
-            cc_fatal("a hex exponent part in a floating constant.");
+            return NULL;
         }
 
         if (is_hex_exp || is_dec_exp) {
-            sb_pop(buffer);
-            peek = sb_peek_last(buffer);
-            if (peek == '-' || peek == '+') {
-                exp_sign = sb_pop(buffer);
+            p++;
+            if (p < end && (*p == '-' || *p == '+')) {
+                *exp_sign = *p++;
+            }
+            p = cut_for_base(p, end, exp, 10);
+
+            // an exponent has no digits: '1e', '1e+', '0x1p'
+            if (exp->len == 0) {
+                return NULL;
             }
-            cut_for_base(buffer, exp, 10);
         }
     }
 
-    return exp_sign;
+    return p;
 }
 
 Strtox *parse_number(char *n)
 {
     assert(n);
-    size_t len = strlen(n);
+
+    Strtox *result = cc_malloc(sizeof(struct strtox));
+    parse_number_into(result, n, strlen(n));
+    return result;
+}
+
+void parse_number_into(Strtox *out, char *n, size_t len)
+{
+    if (!parse_number_checked(out, n, len)) {
+        cc_fatal("not a number: %.*s\n", (int) len, n);
+    }
+}
+
+int parse_number_checked(Strtox *out, char *n, size_t len)
+{
+    assert(out);
+    assert(n);
     assert(len && "an empty input data");
 
-    Str input = STR_INIT;
-    sb_adds_rev(&input, n);
+    out->evaltype = EVALTYPE_ERROR;
+    out->inttype = INTTYPE_ERROR;
+    out->flttype = FLTTYPE_ERROR;
 
-    Str dec = STR_INIT;
-    Str mnt = STR_INIT;
-    Str exp = STR_INIT;
-    Str suf = STR_INIT;
+    char *p = n;
+    char *end = n + len;
+
+    Slice dec = slice_new(p, 0);
+    Slice mnt = slice_new(p, 0);
+    Slice exp = slice_new(p, 0);
 
     char main_sign = '+';
-    if (sb_peek_last(&input) == '+' || sb_peek_last(&input) == '-') {
-        main_sign = sb_pop(&input);
+    if (*p == '+' || *p == '-') {
+        main_sign = *p++;
     }
 
     char exp_sign = '+';
-    int isBin = 0;
-    int isOct = 0;
-    int isHex = 0;
+    unsigned base = 10;
+    size_t prefix = 0;
 
     int evaltype = EVALTYPE_ERROR;
 
-    // NOTE: we're dealing with reversed string
-    if (input.size > 2) {
-        // 0x12 -> 21x0
-        char c1 = sb_char_at(&input, input.size - 1); // 0
-        char c2 = sb_char_at(&input, input.size - 2); // x
-        if (c1 == '0' && (c2 == 'b' || c2 == 'B')) {
-            evaltype = INTEGER_2;
-            isBin = 1;
+    size_t rest = end - p;
+    if (rest > 2 && p[0] == '0') {
+        char c2 = p[1];
+        if (c2 == 'b' || c2 == 'B') {
+            base = 2;
         }
         // rust-like normal octal prefix
-        if (c1 == '0' && (c2 == 'o' || c2 == 'O')) {
-            evaltype = INTEGER_8;
-            isOct = 1;
+        if (c2 == 'o' || c2 == 'O') {
+            base = 8;
+        }
+        if (c2 == 'x' || c2 == 'X') {
+            base = 16;
         }
-        if (c1 == '0' && (c2 == 'x' || c2 == 'X')) {
-            evaltype = INTEGER_16;
-            isHex = 1;
+        if (base != 10) {
+            prefix = 2;
         }
     }
 
-    // a corner cases for c-like octals
-    if (input.size >= 2) {
-        // 07 -> 70
-        char c1 = sb_char_at(&input, input.size - 1); // 0
-        char c2 = sb_char_at(&input, input.size - 2); // 7
-        if (c1 == '0' && is_oct(c2)) {
-            evaltype = INTEGER_8;
-            isOct = 1;
+    // a corner cases for c-like octals: 07, but not 07.5 or 07e1:
+    // a decimal floating constant may start with zeros
+    if (rest >= 2 && p[0] == '0' && is_oct(p[1])) {
+        char *digits = p;
+        while (digits < end && is_dec(*digits)) {
+            digits++;
+        }
+        int floating = digits < end && (*digits == '.' || *digits == 'e' || *digits == 'E');
+        if (!floating) {
+            base = 8;
+            prefix = 1;
         }
     }
 
-    if (isBin || isOct || isHex) {
-        if (isOct) {
-            sb_pop(&input);
-            if (sb_peek_last(&input) == 'o' || sb_peek_last(&input) == 'O') {
-                sb_pop(&input);
-            }
-        } else {
-            sb_pop(&input);
-            sb_pop(&input);
-        }
+    if (base != 10) {
+        p += prefix;
+        evaltype = base;
 
-        // we'he checked that the buffer.size() > 2,
+        // we'he checked that the input has more than a prefix,
         // and now we know, that there's something here.
 
-        if (isBin) {
-            cut_for_base(&input, &dec, 2);
-        }
-
-        if (isOct) {
-            cut_for_base(&input, &dec, 8);
-        }
-
-        if (isHex) {
-            cut_for_base(&input, &dec, 16);
-            exp_sign = cut_mnt_exp(&input, &mnt, &exp, 16);
-            if (mnt.size || exp.size) {
+        p = cut_for_base(p, end, &dec, base);
+        if (base == 16) {
+            char *from = p;
+            p = cut_mnt_exp(p, end, &mnt, &exp, &exp_sign, 16);
+            if (p == NULL) {
+                return 0;
+            }
+            if (p != from) {
                 evaltype = FLOATING_16;
             }
+            // no digits before and after the point: '0x.p1'
+            if (evaltype == FLOATING_16 && dec.len == 0 && mnt.len == 0) {
+                return 0;
+            }
         }
 
+        // 0x, 0b, 0o without digits: '0xg'
+        if (dec.len == 0 && evaltype != FLOATING_16) {
+            return 0;
+        }
     }
 
     else {
 
         evaltype = INTEGER_10;
+        dec = slice_new(p, 0);
 
         // c-like floating constant in a form '.77f'
-        if (sb_peek_last(&input) == '.') {
-            exp_sign = cut_mnt_exp(&input, &mnt, &exp, 10);
-            if (mnt.size || exp.size) {
-                evaltype = FLOATING_10;
+        if (p < end && *p == '.') {
+            p = cut_mnt_exp(p, end, &mnt, &exp, &exp_sign, 10);
+            if (p == NULL) {
+                return 0;
+            }
+            // no digits after the point: '.e1'
+            if (mnt.len == 0) {
+                return 0;
             }
+            evaltype = FLOATING_10;
         }
 
         else {
 
             // parse decimal|floating|floating_exponent
 
-            if (!is_dec(sb_peek_last(&input))) {
-                cc_fatal("not a number: %s\n", n);
+            if (p == end || !is_dec(*p)) {
+                return 0;
             }
 
-            cut_for_base(&input, &dec, 10);
-            exp_sign = cut_mnt_exp(&input, &mnt, &exp, 10);
-            if (mnt.size || exp.size) {
+            p = cut_for_base(p, end, &dec, 10);
+            char *from = p;
+            p = cut_mnt_exp(p, end, &mnt, &exp, &exp_sign, 10);
+            if (p == NULL) {
+                return 0;
+            }
+            // a point or an exponent makes it floating, even with no digits after it: '1.'
+            if (p != from) {
                 evaltype = FLOATING_10;
             }
         }
 
     }
 
-    while (!sb_is_empty(&input)) {
-        sb_addc(&suf, sb_pop(&input));
-    }
-
-    Strtox *result = cc_malloc(sizeof(struct strtox));
-
     assert(evaltype != EVALTYPE_ERROR);
-    result->evaltype = evaltype;
+    out->evaltype = evaltype;
 
-    result->main_sign = main_sign;
-    result->dec = sb_buf_or_empty(&dec);
-    result->mnt = sb_buf_or_empty(&mnt);
-    result->exp = sb_buf_or_empty(&exp);
-    result->exp_sign = exp_sign;
-    result->suf = sb_buf_or_empty(&suf);
+    out->main_sign = main_sign;
+    out->dec = dec;
+    out->mnt = mnt;
+    out->exp = exp;
+    out->exp_sign = exp_sign;
+    out->suf = slice_new(p, end - p);
 
-    evaluate(result);
-    return result;
+    evaluate(out);
+    return 1;
 }
 
 static void set_double(Strtox *n, double x)
@@ -232,9 +260,83 @@ static void set_signed(Strtox *n, ptrdiff_t x)
     n->f64 = (double) x;
 }
 
+// u, l, ll, and their combinations in any order and case (but not lL)
+static int parse_int_suffix(Slice suf, int *is_unsigned, int *longs)
+{
+    *is_unsigned = 0;
+    *longs = 0;
+
+    char *p = suf.ptr;
+    char *end = suf.ptr + suf.len;
+
+    while (p < end) {
+        if ((*p == 'u' || *p == 'U') && !*is_unsigned) {
+            *is_unsigned = 1;
+            p++;
+            continue;
+        }
+        if ((*p == 'l' || *p == 'L') && !*longs) {
+            *longs = 1;
+            if (p + 1 < end && p[1] == p[0]) {
+                *longs = 2;
+                p++;
+            }
+            p++;
+            continue;
+        }
+        return 0;
+    }
+    return 1;
+}
+
+static int integer_type(size_t value, unsigned base, Slice suf)
+{
+    int is_unsigned, longs;
+    if (!parse_int_suffix(suf, &is_unsigned, &longs)) {
+        return INTTYPE_ERROR;
+    }
+
+    int start = longs == 0 ? INTTYPE_INT : longs == 1 ? INTTYPE_LONG : INTTYPE_LLONG;
+    for (int t = start; t <= INTTYPE_ULLONG; t++) {
+        int t_unsigned = t == INTTYPE_UINT || t == INTTYPE_ULONG || t == INTTYPE_ULLONG;
+        if (is_unsigned && !t_unsigned) {
+            continue;
+        }
+        // decimal constants without 'u' are always signed
+        if (!is_unsigned && base == 10 && t_unsigned) {
+            continue;
+        }
+
+        size_t max = t == INTTYPE_INT ? INT32_MAX : t == INTTYPE_UINT ? UINT32_MAX :
+                     t_unsigned ? UINT64_MAX : INT64_MAX;
+        if (value <= max) {
+            return t;
+        }
+    }
+    return INTTYPE_ERROR;
+}
+
+static int floating_type(Slice suf)
+{
+    if (suf.len == 0) {
+        return FLTTYPE_DOUBLE;
+    }
+    if (suf.len == 1 && (suf.ptr[0] == 'f' || suf.ptr[0] == 'F')) {
+        return FLTTYPE_FLOAT;
+    }
+    if (suf.len == 1 && (suf.ptr[0] == 'l' || suf.ptr[0] == 'L')) {
+        return FLTTYPE_LDOUBLE;
+    }
+    return FLTTYPE_ERROR;
+}
+
 static int evaluate(Strtox *n)
 {
+    n->inttype = INTTYPE_ERROR;
+    n->flttype = FLTTYPE_ERROR;
+
     if (n->evaltype == FLOATING_10 || n->evaltype == FLOATING_16) {
+        n->flttype = floating_type(n->suf);
         if (n->evaltype == FLOATING_10) {
             double d = eval_float_10(n->dec, n->mnt, n->exp, n->exp_sign);
             set_double(n, d);
@@ -246,8 +348,13 @@ static int evaluate(Strtox *n)
     }
 
     assert(strtox_is_integer(n));
-    size_t i = eval_integer(n->dec, n->evaltype);
+    size_t i = 0;
+    if (!eval_integer_checked(n->dec, n->evaltype, &i)) {
+        set_unsigned(n, 0);
+        return 1;
+    }
     set_unsigned(n, i);
+    n->inttype = integer_type(i, n->evaltype, n->suf);
 
     return 1;
 }
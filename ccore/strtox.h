@@ -10,6 +10,7 @@
 
 #include <assert.h>
 #include <stddef.h>
+#include "str.h"
 
 /// NOTE:
 /// We assume during parsing that all integers are unsigned,
@@ -44,13 +45,39 @@ struct strtox {
     // exp       = "14"
     // exp_sign  = '+'
     // suf       = ""
+    //
+    // The parts are slices of the input we were given,
+    // nothing is copied, so the input has to outlive them.
 
     char main_sign;
-    char *dec;
-    char *mnt;
-    char *exp;
+    Slice dec;
+    Slice mnt;
+    Slice exp;
     char exp_sign;
-    char *suf;
+    Slice suf;
+
+    // The type of an integer constant: the first one of the list
+    // given by its base and suffix that can represent the value
+    // (C11 6.4.4.1), for a target with 32-bit int and 64-bit long.
+    // INTTYPE_ERROR when nothing fits, the suffix is not valid,
+    // or the constant is not an integer.
+    enum {
+        INTTYPE_ERROR = -1,
+        INTTYPE_INT,
+        INTTYPE_UINT,
+        INTTYPE_LONG,
+        INTTYPE_ULONG,
+        INTTYPE_LLONG,
+        INTTYPE_ULLONG
+    } inttype;
+
+    // The same for floating constants: by the suffix, none, f, or l.
+    enum {
+        FLTTYPE_ERROR = -1,
+        FLTTYPE_FLOAT,
+        FLTTYPE_DOUBLE,
+        FLTTYPE_LDOUBLE
+    } flttype;
 
     // yeah, not a union.
     // need a clean data, without any garbage.
@@ -62,6 +89,14 @@ struct strtox {
 
 Strtox *parse_number(char *n);
 
+/// Parse the first [len] chars of [n] into [out].
+/// The input need not be NUL-terminated, and nothing is allocated.
+void parse_number_into(Strtox *out, char *n, size_t len);
+
+/// The same, but returns 0 instead of a fatal error when the spelling
+/// is not a number: a pp-number like '1.2e' or '0xg' is a valid token.
+int parse_number_checked(Strtox *out, char *n, size_t len);
+
 int strtox_is_integer(Strtox *n);
 
 int strtox_is_floating(Strtox *n);
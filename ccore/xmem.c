@@ -4,13 +4,17 @@
 static void *XMEM_MAX_ADDRESS = 0;
 static void *XMEM_MIN_ADDRESS = ((void*) SIZE_MAX);
 
+// Any thread may allocate: the bounds only move outwards, by a CAS that
+// is retried while another thread moved them less far.
 static void minmax(void *p)
 {
-    if (p > XMEM_MAX_ADDRESS) {
-        XMEM_MAX_ADDRESS = p;
+    void *max = __atomic_load_n(&XMEM_MAX_ADDRESS, __ATOMIC_RELAXED);
+    while (p > max && !__atomic_compare_exchange_n(&XMEM_MAX_ADDRESS, &max, p, 1, __ATOMIC_RELAXED,
+            __ATOMIC_RELAXED)) {
     }
-    if (p < XMEM_MIN_ADDRESS) {
-        XMEM_MIN_ADDRESS = p;
+    void *min = __atomic_load_n(&XMEM_MIN_ADDRESS, __ATOMIC_RELAXED);
+    while (p < min && !__atomic_compare_exchange_n(&XMEM_MIN_ADDRESS, &min, p, 1, __ATOMIC_RELAXED,
+            __ATOMIC_RELAXED)) {
     }
 }
 
@@ -18,7 +22,7 @@ void internal_fatal(const char *_file, int _line, const char *_func,
         const char *fmt, ...)
 {
     va_list args;
-    static char buffer[512];
+    char buffer[512];
 
     va_start(args, fmt);
     vsnprintf(buffer, sizeof(buffer), fmt, args);
@@ -92,7 +96,8 @@ void internal_free(void **ptr, const char *file, int line)
     }
 
     // Slight check whether the pointer is a valid address.
-    if ((*ptr) < XMEM_MIN_ADDRESS || (*ptr) > XMEM_MAX_ADDRESS) {
+    if ((*ptr) < __atomic_load_n(&XMEM_MIN_ADDRESS, __ATOMIC_RELAXED)
+            || (*ptr) > __atomic_load_n(&XMEM_MAX_ADDRESS, __ATOMIC_RELAXED)) {
         cc_fatal(
                 "You want to free a pointer that wan't allocated by cc_malloc(). %s:%d -> %p\n",
                 file, line, (*ptr));
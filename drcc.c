@@ -1,9 +1,14 @@
 #include "drcc.h"
+#include <pthread.h>
 
 vec_impl(struct Token*, token);
+vec_impl(struct PpSym*, sym);
+vec_impl(struct Ident*, ident);
 
-map_impl(char*, Ident*, idents);
-map_impl(char*, int, operators);
+map_impl(struct slice*, int, operators);
+map_impl(char*, Strtox*, numbers);
+map_impl(char*, struct Token*, pastes);
+map_impl(struct SourceFile*, struct SourceFile*, files);
 
 Token *EOF_TOKEN_ENTRY = &(Token ) { .type = TOKEN_EOF, .value = "eof" };
 
@@ -23,55 +28,129 @@ Token* token_copy(Token *another)
     return t;
 }
 
-PpSym* sym_new(Token *macid, vec(token) *repl)
+PpSym* sym_new(Token *macid, vec(token) *repl, unsigned id)
 {
-    Token *unhide = token_copy(macid);
-    unhide->type = T_SPEC_UNHIDE;
-    vec_push_back(repl, unhide);
-
     PpSym *s = cc_malloc(sizeof(PpSym));
     s->macid = macid;
     s->repl = repl;
-    s->is_hidden = 0;
+    s->id = id;
+    s->parm = NULL;
+    s->arity = 0;
     s->is_vararg = 0;
+    s->has_hashes = 0;
+    s->flat_state = FLAT_NONE;
+    s->flat = NULL;
+    s->flat_deps = NULL;
+    s->flat_uses = NULL;
     return s;
 }
 
 // Builtin-names
 //
 
-#define kw(n, namespc) Ident * n##_ident = &(Ident) { .name = STR(n), .ns = namespc, .sym = NULL };
+#define kw(n, namespc) Ident * n##_ident = &(Ident) { .name = STR(n), .id = ID_##n };
+#define kw_reserved(n, namespc) Ident * n##_ident = &(Ident) { .name = "__" STR(n) "__", .id = ID_##n };
 #include "ops"
 
+const IdentClass ident_classes[ID_COUNT] = {
+#   define kw(n, namespc) [ID_##n] = { .ns = namespc, .flags = (namespc) != NS_CPP ? IDENT_KEYWORD : 0 },
+#   define kw_dir(n, namespc, en) [ID_##n] = { .ns = namespc, \
+        .flags = ((namespc) != NS_CPP ? IDENT_KEYWORD : 0) | IDENT_DIRECTIVE, .directive = en },
+#   include "ops"
+};
+
+
+static void ops_put(map(operators) *m, char *op, int type)
+{
+    Slice *key = cc_malloc(sizeof(Slice));
+    *key = slice_new(op, strlen(op));
+    map_put(m, key, type);
+}
 
 map(operators)* make_ops_map()
 {
-    map(operators) *m = map_new(operators, &hashmap_hash_str, &hashmap_equal_str);
+    map(operators) *m = map_new(operators, &hashmap_hash_slice, &hashmap_equal_slice);
 
-#   define op_digr(op, en) map_put(m, op, en);
-#   define op(op, en) map_put(m, op, en);
+#   define op_digr(op, en) ops_put(m, op, en);
+#   define op(op, en) ops_put(m, op, en);
 #   include "ops"
 
     return m;
 }
 
-map(idents)* make_idents_map()
+static map(operators) *shared_ops;
+static pthread_once_t shared_ops_once = PTHREAD_ONCE_INIT;
+
+static void make_shared_ops()
 {
-    map(idents) *m = map_new(idents, &hashmap_hash_str, &hashmap_equal_str);
+    shared_ops = make_ops_map();
+}
 
-#   define kw(n, namespc) map_put(m, STR(n), n##_ident);
-#   include "ops"
+map(operators)* ops_map()
+{
+    pthread_once(&shared_ops_once, &make_shared_ops);
+    return shared_ops;
+}
 
-    return m;
+map(numbers)* make_numbers_map()
+{
+    return map_new(numbers, &hashmap_hash_str, &hashmap_equal_str);
 }
 
-char* toktype_tos(T t)
+map(pastes)* make_pastes_map()
 {
+    return map_new(pastes, &hashmap_hash_str, &hashmap_equal_str);
+}
+
+static size_t hash_file(SourceFile *f)
+{
+    return (size_t) (f->ino * 31 + f->dev);
+}
 
-#   define op_spec(op, en) if(t == en) { return op; };
-#   define op(op, en) if(t == en) { return op; };
-#   define prepr(op, en) if(t == en) { return op; };
+static int equal_file(SourceFile *a, SourceFile *b)
+{
+    return a->dev == b->dev && a->ino == b->ino;
+}
+
+map(files)* make_files_map()
+{
+    return map_new(files, &hash_file, &equal_file);
+}
+
+static char *toktype_names[T_COUNT] = {
+#   define op_spec(op, en) [en] = op,
+#   define op(op, en) [en] = op,
+#   define prepr(op, en) [en] = op,
+#   include "ops"
+};
+
+static const unsigned char ppdirtypes[T_COUNT] = {
+#   define prepr(op, en) [en] = 1,
 #   include "ops"
+};
 
+// The types are numbered in the order of ops: what a build with another
+// ops saved as numbers means something else.
+uint64_t ops_fingerprint()
+{
+    static const char ops[] =
+#   define op_spec(op, en) STR(en) "=" op "\n"
+#   define op(op, en) STR(en) "=" op "\n"
+#   define prepr(op, en) STR(en) "=" op "\n"
+#   include "ops"
+        "";
+    return hashmap_hash_bytes(ops, sizeof(ops) - 1);
+}
+
+char* toktype_tos(T t)
+{
+    if ((unsigned) t < T_COUNT && toktype_names[t]) {
+        return toktype_names[t];
+    }
     return "<unknown-token-type>";
 }
+
+int is_ppdirtype(T t)
+{
+    return (unsigned) t < T_COUNT && ppdirtypes[t];
+}
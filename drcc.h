@@ -10,6 +10,8 @@
 #include "ccore/buf.h"
 #include "ccore/ascii.h"
 #include "ccore/xmem.h"
+#include "ccore/strtox.h"
+#include "hideset.h"
 
 #define STR(x) #x
 
@@ -18,13 +20,24 @@ typedef enum T {
 #   define op(op, en) en,
 #   define prepr(op, en) en,
 #   include "ops"
+    T_COUNT
 } T;
 
+// The builtin names, ID_NONE for any other
+typedef enum ident_id {
+    ID_NONE,
+#   define kw(n, namespc) ID_##n,
+#   include "ops"
+    ID_COUNT
+} ident_id;
+
 struct PpSym;
 struct Ident;
 struct Token;
 
 vec_proto(struct Token*, token);
+vec_proto(struct PpSym*, sym);
+vec_proto(struct Ident*, ident);
 extern struct Token *EOF_TOKEN_ENTRY;
 
 enum string_encoding {
@@ -36,22 +49,51 @@ enum string_encoding {
     STR_ENC_WIDE_L,
 };
 
+// The state of PpSym::flat
+enum flat_state {
+    FLAT_NONE, // not computed, or invalidated by a #define/#undef
+    FLAT_CLOSED, // the expansion is in flat, and nothing in it can expand again
+    FLAT_OPEN, // the expansion depends on what follows it, expand it each time
+    FLAT_BUSY, // being flattened, met again on the way
+};
+
 typedef struct PpSym {
     struct Token *macid; // position, name, debugging
-    vec(token) *repl;
-    vec(token) *parm;
+    vec(token) *repl; // read-only after the definition, the expansions share it
+    vec(token) *parm; // NULL for an object-like macro
     vec(u32) *usage;
-    int is_hidden;
+    unsigned id; // what goes into the hide sets
     int is_vararg;
     int arity;
+    int has_hashes; // # or ## in a function-like macro
+    enum flat_state flat_state;
+    vec(token) *flat; // the full expansion, when it is closed
+    vec(ident) *flat_deps; // every name looked up while it was expanded
+    HideSet *flat_uses; // every macro expanded on the way
 } PpSym;
 
+// A name, in the IdentTable that made it: see idents.h
 typedef struct Ident {
     char *name;
-    unsigned ns; // namespace
-    PpSym *sym;
+    uint32_t id; // an ident_id for the builtin names
 } Ident;
 
+// IdentClass::flags
+#define IDENT_KEYWORD   (1u << 0u) // a keyword in one of the dialects in ns
+#define IDENT_DIRECTIVE (1u << 1u) // '#' name is the directive
+
+// What a builtin name is, by its ident_id
+typedef struct IdentClass {
+    unsigned ns; // namespace
+    unsigned char flags;
+    T directive;
+} IdentClass;
+
+extern const IdentClass ident_classes[ID_COUNT];
+
+/// The class of any name: the one of ID_NONE, nothing, for those not builtin.
+#define ident_class(ident) (&ident_classes[(ident)->id < ID_COUNT ? (ident)->id : ID_NONE])
+
 typedef struct Token {
     T type;
     char *value;
@@ -60,6 +102,8 @@ typedef struct Token {
     int argnum;
     int noexpand;
     Ident *ident;
+    Strtox *number; // TOKEN_NUMBER evaluated by the lexer, shared by equal spellings
+    HideSet *hideset;
     struct {
         char *filename;
         int line;
@@ -71,9 +115,17 @@ typedef struct Token {
     } str;
 } Token;
 
+// A file as the file system knows it, by whatever path it is found.
+typedef struct SourceFile {
+    uint64_t dev;
+    uint64_t ino;
+    Ident *guard; // the whole file is inside #ifndef guard ... #endif
+    int once; // #pragma once
+} SourceFile;
+
 Token* token_new(T type, char *value);
 Token* token_copy(Token *another);
-PpSym* sym_new(Token *macid, vec(token) *repl);
+PpSym* sym_new(Token *macid, vec(token) *repl, unsigned id);
 
 // Token Category
 #define formal     (1u << 0u)
@@ -82,6 +134,7 @@ PpSym* sym_new(Token *macid, vec(token) *repl);
 #define unscanned  (1u << 3u)
 #define hashhash   (1u << 4u)
 #define commaopt   (1u << 5u)
+#define vaopt      (1u << 6u)
 
 // Token Position
 #define fnewline   (1u << 0u)
@@ -98,12 +151,19 @@ PpSym* sym_new(Token *macid, vec(token) *repl);
 #define NS_GNU (1u << 6u)
 #define NS_CPP (NS_IDN)
 
-map_proto(char*, Ident*, idents);
-map_proto(char*, int, operators);
+map_proto(struct slice*, int, operators);
+map_proto(char*, Strtox*, numbers);
+map_proto(char*, struct Token*, pastes);
+map_proto(struct SourceFile*, struct SourceFile*, files);
 
 map(operators)* make_ops_map();
-map(idents)* make_idents_map();
+map(operators)* ops_map(); // made once, and shared: not to be changed
+map(numbers)* make_numbers_map();
+map(pastes)* make_pastes_map();
+map(files)* make_files_map();
 char* toktype_tos(T t);
+uint64_t ops_fingerprint(); // of the token types, for what saves them as numbers
+int is_ppdirtype(T t);
 
 // Identifiers
 
@@ -0,0 +1,187 @@
+#define _POSIX_C_SOURCE 200809L // struct stat::st_mtim
+#include "filecache.h"
+#include "ccore/xmem.h"
+
+map_impl(struct FileData*, struct FileData*, filedata);
+
+static size_t filedata_hash(FileData *f)
+{
+    size_t hash = 14695981039346656037ul;
+    uint64_t parts[] = { f->dev, f->ino, f->size, (uint64_t) f->mtime_sec, (uint64_t) f->mtime_nsec };
+    for (size_t i = 0; i < sizeof(parts) / sizeof(parts[0]); i++) {
+        hash ^= parts[i];
+        hash *= 1099511628211ul;
+    }
+    return hash;
+}
+
+static int filedata_equal(FileData *a, FileData *b)
+{
+    return a->dev == b->dev && a->ino == b->ino && a->size == b->size
+            && a->mtime_sec == b->mtime_sec && a->mtime_nsec == b->mtime_nsec;
+}
+
+FileCache* filecache_new(size_t cap)
+{
+    FileCache *cache = cc_malloc(sizeof(FileCache));
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->entries = map_new(filedata, &filedata_hash, &filedata_equal);
+    cache->unused.prev = cache->unused.next = &cache->unused;
+    cache->bytes = 0;
+    cache->cap = cap;
+    return cache;
+}
+
+static FileCache *global_cache;
+static pthread_once_t global_once = PTHREAD_ONCE_INIT;
+
+static void global_init()
+{
+    global_cache = filecache_new(FILECACHE_DEFAULT_CAP);
+}
+
+FileCache* filecache_global()
+{
+    pthread_once(&global_once, &global_init);
+    return global_cache;
+}
+
+static void unused_unlink(FileData *data)
+{
+    data->prev->next = data->next;
+    data->next->prev = data->prev;
+    data->prev = data->next = NULL;
+}
+
+// Under the lock.
+static void evict(FileCache *cache)
+{
+    while (cache->bytes > cache->cap && cache->unused.next != &cache->unused) {
+        FileData *oldest = cache->unused.next;
+        unused_unlink(oldest);
+        map_remove(cache->entries, oldest);
+        cache->bytes -= oldest->len;
+        cc_free(&oldest->buf);
+        cc_free(&oldest);
+    }
+}
+
+void filecache_set_cap(FileCache *cache, size_t cap)
+{
+    pthread_mutex_lock(&cache->lock);
+    cache->cap = cap;
+    evict(cache);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+// Under the lock: the entry is in use again.
+static FileData* acquire(FileData *data)
+{
+    if (data->refs++ == 0) {
+        unused_unlink(data);
+    }
+    return data;
+}
+
+// Eight bytes at a time: the padding makes the last word safe to read.
+static uint64_t content_hash(char *buf, size_t len)
+{
+    uint64_t hash = len * 0x9e3779b97f4a7c15ull;
+    for (size_t i = 0; i < len; i += 8) {
+        uint64_t word;
+        memcpy(&word, buf + i, 8);
+        if (len - i < 8) {
+            word &= (1ull << ((len - i) * 8)) - 1;
+        }
+        hash = (hash ^ word) * 0xff51afd7ed558ccdull;
+        hash ^= hash >> 32;
+    }
+    return hash;
+}
+
+static int read_into(char *path, FileData *data)
+{
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return 0;
+    }
+    data->buf = cc_malloc(data->size + BUFFER_PADDING);
+    size_t rsize = fread(data->buf, 1, data->size, fp);
+    fclose(fp);
+    if (rsize != data->size) {
+        cc_free(&data->buf);
+        return 0;
+    }
+
+    // Ignore the BOM, if any.
+    size_t offset = 0;
+    unsigned char *u = (unsigned char*) data->buf;
+    if (rsize >= 3 && u[0] == 0xef && u[1] == 0xbb && u[2] == 0xbf) {
+        offset = 3;
+        memmove(data->buf, data->buf + 3, rsize - 3);
+        memset(data->buf + rsize - 3, 0, 3);
+    }
+    data->len = rsize - offset;
+    data->hash = content_hash(data->buf, data->len);
+    return 1;
+}
+
+FileData* filecache_get(FileCache *cache, char *path)
+{
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return NULL;
+    }
+    FileData key = {
+        .dev = (uint64_t) st.st_dev, .ino = (uint64_t) st.st_ino, .size = (uint64_t) st.st_size,
+        .mtime_sec = (int64_t) st.st_mtim.tv_sec, .mtime_nsec = (int64_t) st.st_mtim.tv_nsec
+    };
+
+    pthread_mutex_lock(&cache->lock);
+    map_result(filedata) known = map_get(cache->entries, &key);
+    if (known.found) {
+        FileData *data = acquire(known.value);
+        pthread_mutex_unlock(&cache->lock);
+        return data;
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    // read with the lock released; whoever puts it in first wins
+    FileData *data = cc_malloc(sizeof(FileData));
+    *data = key;
+    if (!read_into(path, data)) {
+        cc_free(&data);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    known = map_get(cache->entries, &key);
+    if (known.found) {
+        FileData *first = acquire(known.value);
+        pthread_mutex_unlock(&cache->lock);
+        cc_free(&data->buf);
+        cc_free(&data);
+        return first;
+    }
+    data->refs = 1;
+    map_put(cache->entries, data, data);
+    cache->bytes += data->len;
+    evict(cache);
+    pthread_mutex_unlock(&cache->lock);
+    return data;
+}
+
+void filecache_release(FileCache *cache, FileData *data)
+{
+    pthread_mutex_lock(&cache->lock);
+    assert(data->refs > 0);
+    if (--data->refs == 0) {
+        // the most recently used is the last
+        data->prev = cache->unused.prev;
+        data->next = &cache->unused;
+        cache->unused.prev->next = data;
+        cache->unused.prev = data;
+        evict(cache);
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
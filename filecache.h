@@ -0,0 +1,60 @@
+#ifndef FILECACHE_H_
+#define FILECACHE_H_
+
+#include "ccore/hdrs.h"
+#include "ccore/buf.h"
+#include "ccore/map.h"
+#include <pthread.h>
+
+// The contents of the files read, shared by everything in the process.
+//
+// A file is known by its identity and by what stat says about its
+// contents: a file that changes is another entry. The contents are kept
+// as a CharBuf reads them, padded and without the BOM; they are never
+// written to, so any number of readers on any thread can use one
+// entry at the same time.
+//
+// An entry lives while it is used. The ones that are not used are
+// dropped, the least recently used first, when the cache holds more
+// than its cap.
+
+typedef struct FileData FileData;
+typedef struct FileCache FileCache;
+
+map_proto(struct FileData*, struct FileData*, filedata);
+
+struct FileData {
+    uint64_t dev, ino, size;
+    int64_t mtime_sec, mtime_nsec;
+
+    char *buf; // len chars, then BUFFER_PADDING zeroes
+    size_t len;
+    uint64_t hash; // of the len chars
+
+    unsigned refs;
+    FileData *prev, *next; // in FileCache::unused, while refs is 0
+};
+
+#define FILECACHE_DEFAULT_CAP ((size_t) 256 * 1024 * 1024)
+
+struct FileCache {
+    pthread_mutex_t lock;
+    map(filedata) *entries;
+    FileData unused; // the least recently used after the head
+    size_t bytes, cap;
+};
+
+FileCache* filecache_new(size_t cap);
+
+/// The one every Context reads from.
+FileCache* filecache_global();
+
+void filecache_set_cap(FileCache *cache, size_t cap);
+
+/// The contents of the file at path, to be given back with filecache_release().
+/// NULL when it cannot be read.
+FileData* filecache_get(FileCache *cache, char *path);
+
+void filecache_release(FileCache *cache, FileData *data);
+
+#endif /* FILECACHE_H_ */
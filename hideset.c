@@ -0,0 +1,234 @@
+#include "hideset.h"
+
+vec_impl(struct HideSet*, hideset);
+map_impl(struct HideSet*, struct HideSet*, hidesets);
+map_impl(struct HideSetPair*, struct HideSet*, hideset_ops);
+
+enum {
+    HS_UNION, HS_INTERSECT
+};
+
+static size_t hs_hash_ids(unsigned *ids, size_t size)
+{
+    // FNV-1a over the ids
+    size_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= ids[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static size_t hs_hash(HideSet *hs)
+{
+    return hs->hash;
+}
+
+static int hs_equal(HideSet *a, HideSet *b)
+{
+    if (a->hash != b->hash || a->size != b->size) {
+        return 0;
+    }
+    return a->size == 0 || memcmp(a->ids, b->ids, a->size * sizeof(unsigned)) == 0;
+}
+
+static size_t hs_pair_hash(HideSetPair *p)
+{
+    return (((size_t) p->a >> 3) * 31 + ((size_t) p->b >> 3)) * 2 + p->op;
+}
+
+static int hs_pair_equal(HideSetPair *x, HideSetPair *y)
+{
+    return x->a == y->a && x->b == y->b && x->op == y->op;
+}
+
+HideSets* hidesets_new()
+{
+    HideSets *t = cc_malloc(sizeof(HideSets));
+    t->interned = map_new(hidesets, &hs_hash, &hs_equal);
+    t->cache = map_new(hideset_ops, &hs_pair_hash, &hs_pair_equal);
+    t->singles = vec_new(hideset);
+
+    t->empty = cc_malloc(sizeof(HideSet));
+    t->empty->ids = NULL;
+    t->empty->size = 0;
+    t->empty->hash = hs_hash_ids(NULL, 0);
+    map_put(t->interned, t->empty, t->empty);
+
+    return t;
+}
+
+void hidesets_free(HideSets **t)
+{
+    assert(t);
+
+    HideSets *table = *t;
+    if (table == NULL) {
+        return;
+    }
+    map_entry(hidesets) *e;
+    map_foreach(table->interned, e) {
+        cc_free(&e->key->ids);
+        cc_free(&e->key);
+    }
+    map_entry(hideset_ops) *op;
+    map_foreach(table->cache, op) {
+        cc_free(&op->key);
+    }
+    map_destroy(table->interned);
+    map_destroy(table->cache);
+    cc_free(&table->singles->data);
+    cc_free(&table->singles);
+    cc_free(t);
+}
+
+// Takes the ownership of [ids] if the set is new, frees them otherwise.
+static HideSet* hs_intern(HideSets *t, unsigned *ids, size_t size)
+{
+    if (size == 0) {
+        if (ids) {
+            cc_free(&ids);
+        }
+        return t->empty;
+    }
+
+    HideSet key = { .ids = ids, .size = size, .hash = hs_hash_ids(ids, size) };
+    map_result(hidesets) opt = map_get(t->interned, &key);
+    if (opt.found) {
+        cc_free(&ids);
+        return opt.value;
+    }
+
+    HideSet *hs = cc_malloc(sizeof(HideSet));
+    *hs = key;
+    map_put(t->interned, hs, hs);
+    return hs;
+}
+
+int hs_contains(HideSet *hs, unsigned id)
+{
+    if (hs == NULL) {
+        return 0;
+    }
+
+    size_t lo = 0;
+    size_t hi = hs->size;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (hs->ids[mid] == id) {
+            return 1;
+        }
+        if (hs->ids[mid] < id) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return 0;
+}
+
+static HideSet* hs_single(HideSets *t, unsigned id)
+{
+    while (vec_size(t->singles) <= id) {
+        vec_push_back(t->singles, NULL);
+    }
+    HideSet *hs = vec_get(t->singles, id);
+    if (hs == NULL) {
+        unsigned *ids = cc_malloc(sizeof(unsigned));
+        ids[0] = id;
+        hs = hs_intern(t, ids, 1);
+        vec_set(t->singles, id, hs);
+    }
+    return hs;
+}
+
+static HideSet* hs_merge(HideSets *t, HideSet *a, HideSet *b, int op)
+{
+    size_t cap = op == HS_UNION ? a->size + b->size : a->size;
+    unsigned *ids = cap ? cc_malloc(cap * sizeof(unsigned)) : NULL;
+    size_t n = 0;
+
+    size_t i = 0, j = 0;
+    while (i < a->size && j < b->size) {
+        if (a->ids[i] == b->ids[j]) {
+            ids[n++] = a->ids[i];
+            i++;
+            j++;
+        } else if (a->ids[i] < b->ids[j]) {
+            if (op == HS_UNION) {
+                ids[n++] = a->ids[i];
+            }
+            i++;
+        } else {
+            if (op == HS_UNION) {
+                ids[n++] = b->ids[j];
+            }
+            j++;
+        }
+    }
+    if (op == HS_UNION) {
+        for (; i < a->size; i++) {
+            ids[n++] = a->ids[i];
+        }
+        for (; j < b->size; j++) {
+            ids[n++] = b->ids[j];
+        }
+    }
+
+    return hs_intern(t, ids, n);
+}
+
+static HideSet* hs_cached(HideSets *t, HideSet *a, HideSet *b, int op)
+{
+    if (a == NULL) {
+        a = t->empty;
+    }
+    if (b == NULL) {
+        b = t->empty;
+    }
+
+    // both are commutative, keep one order in the cache
+    if ((size_t) a > (size_t) b) {
+        HideSet *tmp = a;
+        a = b;
+        b = tmp;
+    }
+
+    if (a == b) {
+        return a;
+    }
+    if (a == t->empty || b == t->empty) {
+        return op == HS_UNION ? (a == t->empty ? b : a) : t->empty;
+    }
+
+    HideSetPair key = { .a = a, .b = b, .op = op };
+    map_result(hideset_ops) opt = map_get(t->cache, &key);
+    if (opt.found) {
+        return opt.value;
+    }
+
+    HideSet *result = hs_merge(t, a, b, op);
+
+    HideSetPair *pair = cc_malloc(sizeof(HideSetPair));
+    *pair = key;
+    map_put(t->cache, pair, result);
+    return result;
+}
+
+HideSet* hs_add(HideSets *t, HideSet *hs, unsigned id)
+{
+    if (hs_contains(hs, id)) {
+        return hs;
+    }
+    return hs_union(t, hs, hs_single(t, id));
+}
+
+HideSet* hs_union(HideSets *t, HideSet *a, HideSet *b)
+{
+    return hs_cached(t, a, b, HS_UNION);
+}
+
+HideSet* hs_intersect(HideSets *t, HideSet *a, HideSet *b)
+{
+    return hs_cached(t, a, b, HS_INTERSECT);
+}
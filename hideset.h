@@ -0,0 +1,56 @@
+#ifndef HIDESET_H_
+#define HIDESET_H_
+
+#include "ccore/hdrs.h"
+#include "ccore/map.h"
+#include "ccore/vec.h"
+
+// Hide sets, Prosser style.
+//
+// Every token carries the set of macros that produced it;
+// a macro name is not expanded if its macro is in the hide set of the name.
+// The sets are immutable and interned: two equal sets are the same pointer,
+// so the results of union/intersection can be cached by a pair of pointers,
+// and expanding a token that was expanded before costs a lookup.
+//
+// A set is a sorted array of macro ids. NULL is a valid empty set.
+
+typedef struct HideSet HideSet;
+typedef struct HideSetPair HideSetPair;
+typedef struct HideSets HideSets;
+
+struct HideSet {
+    unsigned *ids;
+    size_t size;
+    size_t hash;
+};
+
+struct HideSetPair {
+    HideSet *a;
+    HideSet *b;
+    int op;
+};
+
+vec_proto(struct HideSet*, hideset);
+map_proto(struct HideSet*, struct HideSet*, hidesets);
+map_proto(struct HideSetPair*, struct HideSet*, hideset_ops);
+
+// The interning table, one per Scan.
+struct HideSets {
+    HideSet *empty;
+    map(hidesets) *interned;
+    map(hideset_ops) *cache;
+    vec(hideset) *singles; // {id} by id
+};
+
+HideSets* hidesets_new();
+
+/// Frees the table and every set in it, and sets *t to NULL.
+void hidesets_free(HideSets **t);
+
+int hs_contains(HideSet *hs, unsigned id);
+HideSet* hs_add(HideSets *t, HideSet *hs, unsigned id);
+HideSet* hs_union(HideSets *t, HideSet *a, HideSet *b);
+HideSet* hs_intersect(HideSets *t, HideSet *a, HideSet *b);
+
+#endif /* HIDESET_H_ */
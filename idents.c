@@ -0,0 +1,265 @@
+#include "idents.h"
+
+#define NAMES_BLOCK (4 * 1024)
+#define ENTRIES_BLOCK (64)
+#define SHARD_SLOTS (64)
+
+#define load_acquire(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+static IdentSlots* slots_new(IdentShard *shard, size_t size)
+{
+    // from the arena, so zeroes, and kept while the readers may be in it
+    IdentSlots *slots = map_arena_alloc(shard->arena, sizeof(IdentSlots) + sizeof(IdentEntry*) * size);
+    slots->mask = size - 1;
+    return slots;
+}
+
+static size_t slot_of(size_t hash)
+{
+    return hash / IDENT_SHARDS;
+}
+
+static int entry_is(IdentEntry *e, size_t hash, char *ptr, size_t len)
+{
+    return e->hash == hash && e->len == len && memcmp(e->ident->name, ptr, len) == 0;
+}
+
+// With no lock: the entry, or NULL when it was not there when looked at.
+static IdentEntry* shard_find(IdentSlots *slots, size_t hash, char *ptr, size_t len)
+{
+    for (size_t i = slot_of(hash) & slots->mask;; i = (i + 1) & slots->mask) {
+        IdentEntry *e = load_acquire(&slots->at[i]);
+        if (e == NULL) {
+            return NULL;
+        }
+        if (entry_is(e, hash, ptr, len)) {
+            return e;
+        }
+    }
+}
+
+// Under the lock: the entry goes in the first empty slot of its run.
+static void shard_place(IdentSlots *slots, IdentEntry *e)
+{
+    size_t i = slot_of(e->hash) & slots->mask;
+    while (slots->at[i]) {
+        i = (i + 1) & slots->mask;
+    }
+    store_release(&slots->at[i], e);
+}
+
+static void shard_grow(IdentShard *shard)
+{
+    IdentSlots *old = shard->slots;
+    IdentSlots *slots = slots_new(shard, 2 * (old->mask + 1));
+    for (size_t i = 0; i <= old->mask; i += 1) {
+        if (old->at[i]) {
+            shard_place(slots, old->at[i]);
+        }
+    }
+    store_release(&shard->slots, slots);
+}
+
+static IdentEntry* entry_new(IdentShard *shard)
+{
+    if (shard->block_left == 0) {
+        shard->block = map_arena_alloc(shard->arena, sizeof(IdentEntry) * ENTRIES_BLOCK);
+        shard->block_left = ENTRIES_BLOCK;
+    }
+    shard->block_left -= 1;
+    return shard->block++;
+}
+
+static char* names_add(IdentShard *shard, char *ptr, size_t len)
+{
+    size_t size = len + 1;
+    char *at;
+    if (size > NAMES_BLOCK / 4) {
+        at = map_arena_alloc(shard->arena, size);
+    } else {
+        if (size > shard->names_left) {
+            shard->names = map_arena_alloc(shard->arena, NAMES_BLOCK);
+            shard->names_left = NAMES_BLOCK;
+        }
+        at = shard->names;
+        shard->names += size;
+        shard->names_left -= size;
+    }
+    memcpy(at, ptr, len);
+    at[len] = '\0';
+    return at;
+}
+
+static void byid_set(IdentTable *t, Ident *ident)
+{
+    uint32_t chunk = ident->id / IDENT_CHUNK;
+    if (chunk >= IDENT_CHUNKS) {
+        cc_fatal("more than %u names\n", (unsigned) (IDENT_CHUNK * IDENT_CHUNKS));
+    }
+    Ident **ids = load_acquire(&t->byid[chunk]);
+    if (ids == NULL) {
+        Ident **fresh = cc_malloc(sizeof(Ident*) * IDENT_CHUNK);
+        if (__atomic_compare_exchange_n(&t->byid[chunk], &ids, fresh, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            ids = fresh;
+        } else {
+            cc_free(&fresh);
+        }
+    }
+    ids[ident->id % IDENT_CHUNK] = ident;
+}
+
+// Under the lock of the shard: the Ident is in byid before the entry
+// can be found.
+static void shard_add(IdentTable *t, IdentShard *shard, IdentEntry *e)
+{
+    if ((shard->used + 1) * 4 > (shard->slots->mask + 1) * 3) {
+        shard_grow(shard);
+    }
+    byid_set(t, e->ident);
+    shard_place(shard->slots, e);
+    shard->used += 1;
+}
+
+IdentTable* identtable_new()
+{
+    IdentTable *t = cc_malloc(sizeof(IdentTable));
+    for (size_t i = 0; i < IDENT_SHARDS; i += 1) {
+        IdentShard *shard = &t->shards[i];
+        pthread_mutex_init(&shard->lock, NULL);
+        shard->arena = map_arena_new();
+        shard->slots = slots_new(shard, SHARD_SLOTS);
+    }
+    t->count = ID_COUNT;
+
+#   define kw(n, namespc) { \
+        size_t len = strlen(n##_ident->name), hash = hashmap_hash_bytes(n##_ident->name, len); \
+        IdentShard *shard = &t->shards[hash % IDENT_SHARDS]; \
+        IdentEntry *e = entry_new(shard); \
+        *e = (IdentEntry) { .ident = n##_ident, .hash = hash, .len = len }; \
+        shard_add(t, shard, e); \
+    }
+#   include "ops"
+
+    return t;
+}
+
+void identtable_free(IdentTable **t)
+{
+    assert(t);
+
+    IdentTable *table = *t;
+    if (table == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < IDENT_SHARDS; i += 1) {
+        pthread_mutex_destroy(&table->shards[i].lock);
+        map_arena_free(&table->shards[i].arena);
+    }
+    for (size_t i = 0; i < IDENT_CHUNKS; i += 1) {
+        cc_free(&table->byid[i]);
+    }
+    cc_free(t);
+}
+
+Ident* ident_intern_slice(IdentTable *t, char *ptr, size_t len)
+{
+    size_t hash = hashmap_hash_bytes(ptr, len);
+    IdentShard *shard = &t->shards[hash % IDENT_SHARDS];
+
+    IdentEntry *known = shard_find(load_acquire(&shard->slots), hash, ptr, len);
+    if (known) {
+        return known->ident;
+    }
+
+    pthread_mutex_lock(&shard->lock);
+    known = shard_find(shard->slots, hash, ptr, len);
+    if (known == NULL) {
+        known = entry_new(shard);
+        known->ident = &known->own;
+        known->hash = hash;
+        known->len = len;
+        known->own.name = names_add(shard, ptr, len);
+        known->own.id = __atomic_fetch_add(&t->count, 1, __ATOMIC_RELAXED);
+        shard_add(t, shard, known);
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return known->ident;
+}
+
+Ident* ident_intern(IdentTable *t, char *name)
+{
+    return ident_intern_slice(t, name, strlen(name));
+}
+
+uint32_t identtable_count(IdentTable *t)
+{
+    return load_acquire(&t->count);
+}
+
+Ident* ident_byid(IdentTable *t, uint32_t id)
+{
+    assert(id < identtable_count(t));
+    return t->byid[id / IDENT_CHUNK][id % IDENT_CHUNK];
+}
+
+Macros* macros_new()
+{
+    Macros *m = cc_malloc(sizeof(Macros));
+    m->size = 0;
+    m->syms = NULL;
+    m->users = NULL;
+    return m;
+}
+
+void macros_free(Macros **m)
+{
+    assert(m);
+
+    Macros *macros = *m;
+    if (macros == NULL) {
+        return;
+    }
+    for (uint32_t i = 0; i < macros->size; i += 1) {
+        if (macros->users[i]) {
+            cc_free(&macros->users[i]->data);
+            cc_free(&macros->users[i]);
+        }
+    }
+    cc_free(&macros->syms);
+    cc_free(&macros->users);
+    cc_free(m);
+}
+
+static void macros_grow(Macros *m, uint32_t id)
+{
+    if (id < m->size) {
+        return;
+    }
+    uint32_t size = m->size ? m->size : ID_COUNT;
+    while (size <= id) {
+        size *= 2;
+    }
+    m->syms = cc_realloc(m->syms, sizeof(PpSym*) * size);
+    m->users = cc_realloc(m->users, sizeof(vec(sym)*) * size);
+    for (uint32_t i = m->size; i < size; i += 1) {
+        m->syms[i] = NULL;
+        m->users[i] = NULL;
+    }
+    m->size = size;
+}
+
+void macros_set(Macros *m, Ident *ident, PpSym *sym)
+{
+    macros_grow(m, ident->id);
+    m->syms[ident->id] = sym;
+}
+
+vec(sym)* macros_users(Macros *m, Ident *ident)
+{
+    macros_grow(m, ident->id);
+    if (m->users[ident->id] == NULL) {
+        m->users[ident->id] = vec_new(sym);
+    }
+    return m->users[ident->id];
+}
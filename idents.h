@@ -0,0 +1,103 @@
+#ifndef IDENTS_H_
+#define IDENTS_H_
+
+#include "drcc.h"
+#include <pthread.h>
+
+// The names met, interned: one Ident per spelling, shared by every thread.
+//
+// Every Ident of a table has an id, dense from 0: the builtin names have
+// their ident_id, the others come after, in the order they are met. What
+// a name means is not in the Ident but kept by its id, in tables of their
+// own: a table of names can go with any number of scans, on any number of
+// threads, and Idents from it compare by pointer whoever made them.
+//
+// The table is split in shards by the hash of the spelling. A shard is an
+// open addressed array of entries that is read with no lock: a name that
+// is there is found with loads alone. A name that is not there is added
+// under the lock of its shard, which looks again first. An array that is
+// full is copied to one twice as big, and the old one is left as it was
+// for the readers still in it; the arrays, the entries and the spellings
+// of a shard are in its arena, and go with it at once.
+
+#define IDENT_SHARDS (64)
+#define IDENT_CHUNK (4096) // ids per chunk of IdentTable::byid
+#define IDENT_CHUNKS (4096)
+
+typedef struct IdentTable IdentTable;
+typedef struct IdentShard IdentShard;
+typedef struct IdentSlots IdentSlots;
+typedef struct IdentEntry IdentEntry;
+typedef struct Macros Macros;
+
+// An Ident with what it is found by: own for the ones the table made,
+// the builtin one for the others.
+struct IdentEntry {
+    Ident *ident;
+    size_t hash;
+    size_t len;
+    Ident own;
+};
+
+struct IdentSlots {
+    size_t mask; // the size, minus 1, a power of two
+    IdentEntry *at[];
+};
+
+struct IdentShard {
+    pthread_mutex_t lock;
+    IdentSlots *slots; // replaced, never changed, but for an empty slot taken
+    size_t used;
+
+    MapArena *arena;
+    char *names; // the block the next spelling goes in
+    size_t names_left;
+    IdentEntry *block; // the block the next entry goes in
+    size_t block_left;
+};
+
+struct IdentTable {
+    IdentShard shards[IDENT_SHARDS];
+    Ident **byid[IDENT_CHUNKS];
+    uint32_t count;
+};
+
+IdentTable* identtable_new();
+
+/// Frees the table and its Idents, and sets *t to NULL. No thread is to
+/// use it anymore.
+void identtable_free(IdentTable **t);
+
+/// The Ident of the spelling; made, with the next id, when it is new.
+Ident* ident_intern(IdentTable *t, char *name);
+
+/// The same, for the len chars at ptr: they need not end with a '\0',
+/// and are only read.
+Ident* ident_intern_slice(IdentTable *t, char *ptr, size_t len);
+
+/// The Idents made, and the one with an id below that, while no thread
+/// is adding to the table.
+uint32_t identtable_count(IdentTable *t);
+Ident* ident_byid(IdentTable *t, uint32_t id);
+
+// What the names are defined as in one scan, by Ident::id.
+struct Macros {
+    PpSym **syms;
+    vec(sym) **users; // the macros with a flattened expansion that looked the name up
+    uint32_t size; // the ids below have a slot
+};
+
+Macros* macros_new();
+
+/// Frees the tables, and sets *m to NULL; the PpSyms stay, as their tokens do.
+void macros_free(Macros **m);
+
+/// The macro the name is, NULL when it is not one.
+#define macros_get(m, ident) ((ident)->id < (m)->size ? (m)->syms[(ident)->id] : NULL)
+
+void macros_set(Macros *m, Ident *ident, PpSym *sym);
+
+/// The users of the name, made empty when there were none.
+vec(sym)* macros_users(Macros *m, Ident *ident);
+
+#endif /* IDENTS_H_ */
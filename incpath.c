@@ -0,0 +1,197 @@
+#include "incpath.h"
+#include <dirent.h>
+
+map_impl(char*, int, names);
+map_impl(char*, struct DirList*, dirlists);
+map_impl(char*, struct Resolved*, resolved);
+
+IncludePaths* incpaths_new()
+{
+    IncludePaths *paths = cc_malloc(sizeof(IncludePaths));
+    paths->dirs = vec_new(str);
+    paths->dirlists = map_new(dirlists, &hashmap_hash_str, &hashmap_equal_str);
+    paths->resolved = map_new(resolved, &hashmap_hash_str, &hashmap_equal_str);
+    paths->files = make_files_map();
+    return paths;
+}
+
+// normalize() keeps the slash a directory ends with; here it is dropped.
+static char* clean_path(char *path)
+{
+    char *clean = normalize(path);
+    size_t len = strlen(clean);
+    if (len > 1 && clean[len - 1] == '/') {
+        clean[len - 1] = '\0';
+    }
+    return clean;
+}
+
+void incpaths_add_dir(IncludePaths *paths, char *dir)
+{
+    vec_push_back(paths->dirs, clean_path(dir));
+}
+
+void incpaths_free(IncludePaths **paths)
+{
+    assert(paths);
+
+    IncludePaths *p = *paths;
+    if (p == NULL) {
+        return;
+    }
+    char *dir = NULL;
+    vec_foreach(p->dirs, dir)
+    {
+        cc_free(&dir);
+    }
+    cc_free(&p->dirs->data);
+    cc_free(&p->dirs);
+
+    map_entry(dirlists) *d;
+    map_foreach(p->dirlists, d) {
+        map_entry(names) *n;
+        map_foreach(d->val->names, n) {
+            cc_free(&n->key);
+        }
+        map_destroy(d->val->names);
+        cc_free(&d->key);
+        cc_free(&d->val);
+    }
+    map_destroy(p->dirlists);
+
+    map_entry(resolved) *r;
+    map_foreach(p->resolved, r) {
+        if (r->val) {
+            cc_free(&r->val->path);
+            cc_free(&r->val);
+        }
+        cc_free(&r->key);
+    }
+    map_destroy(p->resolved);
+
+    map_entry(files) *f;
+    map_foreach(p->files, f) {
+        cc_free(&f->key);
+    }
+    map_destroy(p->files);
+    cc_free(paths);
+}
+
+static DirList* dir_list(IncludePaths *paths, char *dir)
+{
+    map_result(dirlists) known = map_get(paths->dirlists, dir);
+    if (known.found) {
+        return known.value;
+    }
+
+    DirList *list = cc_malloc(sizeof(DirList));
+    list->names = map_new(names, &hashmap_hash_str, &hashmap_equal_str);
+    DIR *d = opendir(*dir ? dir : ".");
+    list->exists = d != NULL;
+    if (d) {
+        struct dirent *entry = NULL;
+        while ((entry = readdir(d)) != NULL) {
+            map_put(list->names, cc_strdup(entry->d_name), 1);
+        }
+        closedir(d);
+    }
+    map_put(paths->dirlists, cc_strdup(dir), list);
+    return list;
+}
+
+// The path of name in dir, when every part of it is there;
+// the directories on the way are read as well.
+static char* dir_find(IncludePaths *paths, char *dir, char *name)
+{
+    Str path = STR_INIT;
+    sb_adds(&path, dir);
+
+    for (char *at = name;;) {
+        char *slash = strchr(at, '/');
+        char *part = slash ? sb_left(at, (size_t) (slash - at)) : at;
+        DirList *list = dir_list(paths, path.size ? path.data : "");
+        int found = list->exists && map_get(list->names, part).found;
+
+        if (found) {
+            if (path.size && path.data[path.size - 1] != '/') {
+                sb_addc(&path, '/');
+            }
+            sb_adds(&path, part);
+        }
+        if (slash) {
+            cc_free(&part);
+        }
+        if (!found) {
+            cc_free(&path.data);
+            return NULL;
+        }
+        if (slash == NULL) {
+            return path.data;
+        }
+        at = slash + 1;
+    }
+}
+
+SourceFile* incpaths_file(IncludePaths *paths, uint64_t dev, uint64_t ino)
+{
+    SourceFile key = { .dev = dev, .ino = ino, .guard = NULL, .once = 0 };
+    map_result(files) known = map_get(paths->files, &key);
+    if (known.found) {
+        return known.value;
+    }
+    SourceFile *file = cc_malloc(sizeof(SourceFile));
+    *file = key;
+    map_put(paths->files, file, file);
+    return file;
+}
+
+static Resolved* try_dir(IncludePaths *paths, char *dir, char *name)
+{
+    char *found = dir_find(paths, dir, name);
+    if (found == NULL) {
+        return NULL;
+    }
+    // a directory of the same name, or a link to nothing, does not count
+    char *path = clean_path(found);
+    cc_free(&found);
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+        cc_free(&path);
+        return NULL;
+    }
+    Resolved *r = cc_malloc(sizeof(Resolved));
+    r->path = path;
+    r->file = incpaths_file(paths, (uint64_t) st.st_dev, (uint64_t) st.st_ino);
+    return r;
+}
+
+Resolved* incpaths_find(IncludePaths *paths, char *includer_dir, char *name, int angled)
+{
+    Str key = STR_INIT;
+    if (angled) {
+        sb_addc(&key, '<');
+    } else {
+        sb_adds(&key, includer_dir);
+        sb_addc(&key, '"');
+    }
+    sb_adds(&key, name);
+    map_result(resolved) known = map_get(paths->resolved, key.data);
+    if (known.found) {
+        cc_free(&key.data);
+        return known.value;
+    }
+
+    Resolved *r = NULL;
+    if (is_abs_unix(name)) {
+        r = try_dir(paths, "/", name + 1);
+    } else {
+        if (!angled) {
+            r = try_dir(paths, includer_dir, name);
+        }
+        for (size_t i = 0; r == NULL && i < vec_size(paths->dirs); i += 1) {
+            r = try_dir(paths, vec_get(paths->dirs, i), name);
+        }
+    }
+    map_put(paths->resolved, key.data, r);
+    return r;
+}
@@ -0,0 +1,58 @@
+#ifndef INCPATH_H_
+#define INCPATH_H_
+
+#include "drcc.h"
+
+// Where an #include leads.
+//
+// A directory is read once, with readdir, and what is in it is kept:
+// looking for a name in twenty directories costs twenty lookups in
+// memory, and no system call for the directories that do not have it.
+// The answer for an include, by the directory of the includer, the name
+// and its form, is kept as well; only the file found is ever stat'ed,
+// once, to know it by its identity.
+//
+// The file system is taken as it was when it was first looked at.
+
+typedef struct DirList DirList;
+typedef struct IncludePaths IncludePaths;
+typedef struct Resolved Resolved;
+
+map_proto(char*, int, names);
+map_proto(char*, struct DirList*, dirlists);
+map_proto(char*, struct Resolved*, resolved);
+
+struct DirList {
+    int exists;
+    map(names) *names;
+};
+
+struct Resolved {
+    char *path; // normalized
+    SourceFile *file;
+};
+
+struct IncludePaths {
+    vec(str) *dirs; // normalized, in the order given
+    map(dirlists) *dirlists;
+    map(resolved) *resolved; // NULL values for the names not found
+    map(files) *files;
+};
+
+IncludePaths* incpaths_new();
+void incpaths_add_dir(IncludePaths *paths, char *dir);
+
+/// Frees what was found and read, the SourceFiles with it, and sets
+/// *paths to NULL.
+void incpaths_free(IncludePaths **paths);
+
+/// The file "name" or <name> means in a file of the directory includer_dir,
+/// "" for the current one; NULL when there is no such file.
+/// "name" is looked for in includer_dir first, then in the directories
+/// given; <name> only in those.
+Resolved* incpaths_find(IncludePaths *paths, char *includer_dir, char *name, int angled);
+
+/// The file known by its identity, known from now on if it was not.
+SourceFile* incpaths_file(IncludePaths *paths, uint64_t dev, uint64_t ino);
+
+#endif /* INCPATH_H_ */
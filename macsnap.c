@@ -0,0 +1,439 @@
+#define _POSIX_C_SOURCE 200809L // struct stat::st_mtim
+#include "macsnap.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+map_proto(char*, size_t, snapstrings);
+map_impl(char*, size_t, snapstrings);
+
+typedef struct SnapHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t order; // 0x01020304 on the machine that wrote it
+    uint64_t types; // ops_fingerprint() of the build that wrote it
+    uint32_t nfiles, nnames, nmacros, ntokens;
+    uint32_t output, noutput; // the first token, and how many
+    uint32_t strings; // bytes
+    uint32_t ndirs; // the include dirs searched, in order
+} SnapHeader;
+
+typedef struct SnapFileRec {
+    uint64_t dev, ino, size;
+    int64_t mtime_sec, mtime_nsec;
+    uint32_t path, guard, once, pad; // guard: a name + 1, or 0
+} SnapFileRec;
+
+#define SNAP_FUNCTION (1u << 0u)
+#define SNAP_VARARG   (1u << 1u)
+#define SNAP_HASHES   (1u << 2u)
+
+typedef struct SnapMacro {
+    uint32_t macid; // a token
+    uint32_t repl, nrepl; // the first token, and how many
+    uint32_t parm, nparm;
+    uint32_t flags;
+} SnapMacro;
+
+typedef struct SnapToken {
+    uint32_t type, value, fcategory, fposition;
+    int32_t argnum;
+    uint32_t name; // + 1, 0 for a token that is not a name
+    uint32_t filename, line, column;
+} SnapToken;
+
+#define MACSNAP_MAGIC "drccmac"
+#define MACSNAP_ORDER (0x01020304u)
+
+// Saving
+
+typedef struct Writer {
+    Str strings;
+    map(snapstrings) *offsets; // where a string is in strings
+    map(snapstrings) *names; // the index of a name in nametab
+    uint32_t *nametab;
+    size_t nnames, names_alloc;
+    SnapToken *tokens;
+    size_t ntokens, tokens_alloc;
+} Writer;
+
+static uint32_t string_of(Writer *w, char *s)
+{
+    map_result(snapstrings) known = map_get(w->offsets, s);
+    if (known.found) {
+        return (uint32_t) known.value;
+    }
+    size_t at = vec_size(&w->strings);
+    sb_adds(&w->strings, s);
+    sb_addc(&w->strings, '\0');
+    map_put(w->offsets, s, at);
+    return (uint32_t) at;
+}
+
+static uint32_t name_of(Writer *w, Ident *id)
+{
+    map_result(snapstrings) known = map_get(w->names, id->name);
+    if (known.found) {
+        return (uint32_t) known.value + 1;
+    }
+    if (w->nnames == w->names_alloc) {
+        w->names_alloc = w->names_alloc ? w->names_alloc * 2 : 256;
+        w->nametab = cc_realloc(w->nametab, sizeof(uint32_t) * w->names_alloc);
+    }
+    w->nametab[w->nnames] = string_of(w, id->name);
+    map_put(w->names, id->name, w->nnames);
+    return (uint32_t) ++w->nnames;
+}
+
+static uint32_t token_of(Writer *w, Token *t)
+{
+    if (w->ntokens == w->tokens_alloc) {
+        w->tokens_alloc = w->tokens_alloc ? w->tokens_alloc * 2 : 1024;
+        w->tokens = cc_realloc(w->tokens, sizeof(SnapToken) * w->tokens_alloc);
+    }
+    w->tokens[w->ntokens] = (SnapToken) {
+        .type = (uint32_t) t->type, .value = string_of(w, t->value),
+        .fcategory = t->fcategory, .fposition = t->fposition, .argnum = t->argnum,
+        .name = t->ident ? name_of(w, t->ident) : 0,
+        .filename = string_of(w, t->pos.filename ? t->pos.filename : ""),
+        .line = (uint32_t) t->pos.line, .column = (uint32_t) t->pos.column
+    };
+    return (uint32_t) w->ntokens++;
+}
+
+static uint32_t tokens_of(Writer *w, vec(token) *list)
+{
+    uint32_t first = (uint32_t) w->ntokens;
+    Token *t = NULL;
+    vec_foreach(list, t)
+    {
+        token_of(w, t);
+    }
+    return first;
+}
+
+static int write_all(FILE *fp, void *data, size_t size)
+{
+    return size == 0 || fwrite(data, 1, size, fp) == size;
+}
+
+int macsnap_save(char *path, vec(token) *output, Macros *defs, SnapFile *files, size_t nfiles,
+        vec(str) *dirs)
+{
+    Writer w = {
+        .strings = STR_INIT,
+        .offsets = map_new(snapstrings, &hashmap_hash_str, &hashmap_equal_str),
+        .names = map_new(snapstrings, &hashmap_hash_str, &hashmap_equal_str),
+    };
+    SnapMacro *macros = NULL;
+    size_t nmacros = 0, macros_alloc = 0;
+    string_of(&w, "");
+    uint32_t first = tokens_of(&w, output);
+
+    for (uint32_t id = 0; id < defs->size; id += 1) {
+        PpSym *m = defs->syms[id];
+        if (m == NULL) {
+            continue;
+        }
+        if (nmacros == macros_alloc) {
+            macros_alloc = macros_alloc ? macros_alloc * 2 : 256;
+            macros = cc_realloc(macros, sizeof(SnapMacro) * macros_alloc);
+        }
+        SnapMacro *rec = &macros[nmacros++];
+        rec->macid = token_of(&w, m->macid);
+        rec->nrepl = (uint32_t) vec_size(m->repl);
+        rec->repl = tokens_of(&w, m->repl);
+        rec->nparm = m->parm ? (uint32_t) vec_size(m->parm) : 0;
+        rec->parm = m->parm ? tokens_of(&w, m->parm) : 0;
+        rec->flags = (m->parm ? SNAP_FUNCTION : 0) | (m->is_vararg ? SNAP_VARARG : 0)
+                | (m->has_hashes ? SNAP_HASHES : 0);
+    }
+
+    // and a file read twice, once
+    map(snapstrings) *seen = map_new(snapstrings, &hashmap_hash_str, &hashmap_equal_str);
+    SnapFileRec *recs = cc_malloc(sizeof(SnapFileRec) * (nfiles + 1));
+    size_t nrecs = 0;
+    for (size_t i = 0; i < nfiles; i += 1) {
+        SnapFile *f = &files[i];
+        if (map_get(seen, f->path).found) {
+            continue;
+        }
+        map_put(seen, f->path, 1);
+        recs[nrecs++] = (SnapFileRec) {
+            .dev = f->dev, .ino = f->ino, .size = f->size,
+            .mtime_sec = f->mtime_sec, .mtime_nsec = f->mtime_nsec,
+            .path = string_of(&w, f->path),
+            .guard = (f->file && f->file->guard) ? name_of(&w, f->file->guard) : 0,
+            .once = f->file ? (uint32_t) f->file->once : 0
+        };
+    }
+
+    uint32_t *dirtab = cc_malloc(sizeof(uint32_t) * (vec_size(dirs) + 1));
+    char *dir = NULL;
+    vec_foreach(dirs, dir)
+    {
+        dirtab[__i__] = string_of(&w, dir);
+    }
+
+    SnapHeader header = {
+        .magic = MACSNAP_MAGIC, .version = MACSNAP_VERSION, .order = MACSNAP_ORDER, .types = ops_fingerprint(),
+        .nfiles = (uint32_t) nrecs, .nnames = (uint32_t) w.nnames, .nmacros = (uint32_t) nmacros,
+        .ntokens = (uint32_t) w.ntokens, .output = first, .noutput = (uint32_t) vec_size(output),
+        .strings = (uint32_t) vec_size(&w.strings), .ndirs = (uint32_t) vec_size(dirs)
+    };
+
+    // written aside and renamed: a run that restores never sees half of it
+    Str tmp = STR_INIT;
+    char pid[32];
+    snprintf(pid, sizeof(pid), ".%ld", (long) getpid());
+    sb_adds(&tmp, path);
+    sb_adds(&tmp, pid);
+
+    int ok = 0;
+    FILE *fp = fopen(tmp.data, "wb");
+    if (fp) {
+        ok = write_all(fp, &header, sizeof(header))
+                && write_all(fp, recs, sizeof(SnapFileRec) * nrecs)
+                && write_all(fp, dirtab, sizeof(uint32_t) * header.ndirs)
+                && write_all(fp, w.nametab, sizeof(uint32_t) * w.nnames)
+                && write_all(fp, macros, sizeof(SnapMacro) * nmacros)
+                && write_all(fp, w.tokens, sizeof(SnapToken) * w.ntokens)
+                && write_all(fp, w.strings.data, vec_size(&w.strings));
+        ok = (fclose(fp) == 0) && ok;
+        ok = ok && rename(tmp.data, path) == 0;
+        if (!ok) {
+            unlink(tmp.data);
+        }
+    }
+
+    map_destroy(seen);
+    map_destroy(w.offsets);
+    map_destroy(w.names);
+    cc_free(&tmp.data);
+    cc_free(&recs);
+    cc_free(&dirtab);
+    cc_free(&macros);
+    cc_free(&w.nametab);
+    cc_free(&w.tokens);
+    cc_free(&w.strings.data);
+    return ok;
+}
+
+// Loading
+
+static int file_unchanged(char *path, SnapFileRec *rec)
+{
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        return 0;
+    }
+    return (uint64_t) st.st_dev == rec->dev && (uint64_t) st.st_ino == rec->ino
+            && (uint64_t) st.st_size == rec->size
+            && (int64_t) st.st_mtim.tv_sec == rec->mtime_sec
+            && (int64_t) st.st_mtim.tv_nsec == rec->mtime_nsec;
+}
+
+typedef struct Reader {
+    SnapHeader *h;
+    SnapToken *tokens;
+    char *strings;
+    uint32_t *nametab;
+    Ident **idents; // by name, made when first met
+    MacSnapNames *names;
+} Reader;
+
+static int string_ok(Reader *r, uint32_t at)
+{
+    return at < r->h->strings;
+}
+
+static Ident* ident_at(Reader *r, uint32_t name)
+{
+    uint32_t i = name - 1;
+    if (r->idents[i] == NULL) {
+        r->idents[i] = r->names->ident(r->names->ctx, r->strings + r->nametab[i]);
+    }
+    return r->idents[i];
+}
+
+static Token* restore_token(Reader *r, Token *block, uint32_t i)
+{
+    SnapToken *rec = &r->tokens[i];
+    Token *t = &block[i];
+    t->type = (T) rec->type;
+    t->value = r->strings + rec->value;
+    t->fcategory = rec->fcategory;
+    t->fposition = rec->fposition;
+    t->argnum = rec->argnum;
+    t->ident = rec->name ? ident_at(r, rec->name) : NULL;
+    if (t->type == TOKEN_NUMBER && r->names->number) {
+        t->number = r->names->number(r->names->ctx, t->value, strlen(t->value));
+    }
+    t->pos.filename = r->strings + rec->filename;
+    t->pos.line = (int) rec->line;
+    t->pos.column = (int) rec->column;
+    return t;
+}
+
+static vec(token)* restore_tokens(Reader *r, Token *block, uint32_t first, uint32_t n)
+{
+    vec(token) *list = vec_new(token);
+    for (uint32_t i = first; i < first + n; i += 1) {
+        vec_push_back(list, restore_token(r, block, i));
+    }
+    return list;
+}
+
+// Every index in its table, and every string ended within the strings.
+static int snapshot_ok(Reader *r, SnapFileRec *files, uint32_t *dirtab, SnapMacro *macros)
+{
+    SnapHeader *h = r->h;
+    if (h->strings == 0 || r->strings[h->strings - 1] != '\0') {
+        return 0;
+    }
+    for (uint32_t i = 0; i < h->nnames; i += 1) {
+        if (!string_ok(r, r->nametab[i])) {
+            return 0;
+        }
+    }
+    for (uint32_t i = 0; i < h->ntokens; i += 1) {
+        SnapToken *t = &r->tokens[i];
+        if (!string_ok(r, t->value) || !string_ok(r, t->filename) || t->name > h->nnames) {
+            return 0;
+        }
+    }
+    if (h->output > h->ntokens || h->noutput > h->ntokens - h->output) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < h->nmacros; i += 1) {
+        SnapMacro *m = &macros[i];
+        if (m->macid >= h->ntokens || r->tokens[m->macid].name == 0
+                || m->repl > h->ntokens || m->nrepl > h->ntokens - m->repl
+                || m->parm > h->ntokens || m->nparm > h->ntokens - m->parm) {
+            return 0;
+        }
+    }
+    for (uint32_t i = 0; i < h->nfiles; i += 1) {
+        if (!string_ok(r, files[i].path) || files[i].guard > h->nnames) {
+            return 0;
+        }
+    }
+    for (uint32_t i = 0; i < h->ndirs; i += 1) {
+        if (!string_ok(r, dirtab[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// The same dirs, in the same order: with others, an include in the
+// prefix could have found another file.
+static int same_dirs(Reader *r, uint32_t *dirtab, vec(str) *dirs)
+{
+    if (r->h->ndirs != vec_size(dirs)) {
+        return 0;
+    }
+    char *dir = NULL;
+    vec_foreach(dirs, dir)
+    {
+        if (strcmp(r->strings + dirtab[__i__], dir) != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int restore(SnapHeader *h, size_t size, vec(str) *dirs, MacSnapNames *names, MacSnap *out)
+{
+    size_t need = sizeof(SnapHeader) + sizeof(SnapFileRec) * h->nfiles
+            + sizeof(uint32_t) * h->ndirs + sizeof(uint32_t) * h->nnames
+            + sizeof(SnapMacro) * h->nmacros + sizeof(SnapToken) * h->ntokens + h->strings;
+    if (memcmp(h->magic, MACSNAP_MAGIC, sizeof(h->magic)) != 0 || h->version != MACSNAP_VERSION
+            || h->order != MACSNAP_ORDER || h->types != ops_fingerprint() || need != size)
+    {
+        return 0;
+    }
+
+    char *at = (char*) (h + 1);
+    SnapFileRec *files = (SnapFileRec*) at;
+    at += sizeof(SnapFileRec) * h->nfiles;
+    uint32_t *dirtab = (uint32_t*) at;
+    at += sizeof(uint32_t) * h->ndirs;
+    Reader r = { .h = h, .names = names };
+    r.nametab = (uint32_t*) at;
+    at += sizeof(uint32_t) * h->nnames;
+    SnapMacro *macros = (SnapMacro*) at;
+    at += sizeof(SnapMacro) * h->nmacros;
+    r.tokens = (SnapToken*) at;
+    at += sizeof(SnapToken) * h->ntokens;
+    r.strings = at;
+
+    if (!snapshot_ok(&r, files, dirtab, macros) || !same_dirs(&r, dirtab, dirs)) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < h->nfiles; i += 1) {
+        if (!file_unchanged(r.strings + files[i].path, &files[i])) {
+            return 0;
+        }
+    }
+
+    // the strings outlive the mapping: the tokens point into them
+    r.strings = cc_malloc(h->strings);
+    memcpy(r.strings, at, h->strings);
+    r.idents = cc_malloc(sizeof(Ident*) * (h->nnames + 1));
+    Token *block = cc_malloc(sizeof(Token) * (h->ntokens + 1));
+
+    out->output = restore_tokens(&r, block, h->output, h->noutput);
+    out->macros = vec_new(sym);
+    for (uint32_t i = 0; i < h->nmacros; i += 1) {
+        SnapMacro *rec = &macros[i];
+        Token *macid = restore_token(&r, block, rec->macid);
+        PpSym *m = sym_new(macid, restore_tokens(&r, block, rec->repl, rec->nrepl), 0);
+        if (rec->flags & SNAP_FUNCTION) {
+            m->parm = restore_tokens(&r, block, rec->parm, rec->nparm);
+            m->arity = (int) rec->nparm;
+        }
+        m->is_vararg = (rec->flags & SNAP_VARARG) != 0;
+        m->has_hashes = (rec->flags & SNAP_HASHES) != 0;
+        vec_push_back(out->macros, m);
+    }
+
+    out->nfiles = h->nfiles;
+    out->files = cc_malloc(sizeof(SnapFile) * (h->nfiles + 1));
+    for (uint32_t i = 0; i < h->nfiles; i += 1) {
+        SnapFileRec *rec = &files[i];
+        SourceFile *file = cc_malloc(sizeof(SourceFile));
+        *file = (SourceFile) {
+            .dev = rec->dev, .ino = rec->ino,
+            .guard = rec->guard ? ident_at(&r, rec->guard) : NULL,
+            .once = (int) rec->once
+        };
+        out->files[i] = (SnapFile) {
+            .path = r.strings + rec->path, .file = file,
+            .dev = rec->dev, .ino = rec->ino, .size = rec->size,
+            .mtime_sec = rec->mtime_sec, .mtime_nsec = rec->mtime_nsec
+        };
+    }
+    cc_free(&r.idents);
+    return 1;
+}
+
+int macsnap_load(char *path, vec(str) *dirs, MacSnapNames *names, MacSnap *out)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    int ok = 0;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(SnapHeader)) {
+        size_t size = (size_t) st.st_size;
+        void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            ok = restore(map, size, dirs, names, out);
+            munmap(map, size);
+        }
+    }
+    close(fd);
+    return ok;
+}
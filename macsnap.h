@@ -0,0 +1,64 @@
+#ifndef MACSNAP_H_
+#define MACSNAP_H_
+
+#include "drcc.h"
+#include "idents.h"
+
+// A prefix that every file starts with, preprocessed once and saved, to be
+// restored by the next runs instead of preprocessing it again.
+//
+// A snapshot holds what the prefix gave, the definitions that stand at its
+// end, with their replacement lists as they are kept after #define, and
+// the files read to make them: where they are, what stat said about them,
+// and whether they have an include guard or #pragma once, and the include
+// dirs they were found in. It is good while every one of those files is
+// as it was, and for the same dirs only; a file with a guard that is
+// defined, or with #pragma once, is not read again after the restore.
+//
+// Everything in it refers to everything else by index: names, spellings
+// and tokens are in tables, and the file is mapped and read in place.
+// Token types are kept as their numbers, good for a build with the same
+// ops only.
+
+#define MACSNAP_VERSION (3)
+
+typedef struct SnapFile SnapFile;
+typedef struct MacSnap MacSnap;
+typedef struct MacSnapNames MacSnapNames;
+
+// A file read while the macros were defined.
+struct SnapFile {
+    char *path;
+    SourceFile *file; // NULL for the main file: it has no guard
+    uint64_t dev, ino, size;
+    int64_t mtime_sec, mtime_nsec;
+};
+
+// What a restore gives: the tokens the prefix gave; PpSyms with no id,
+// not defined yet, for their macid->ident; and the files, each with a
+// SourceFile of its own that has its guard and once.
+struct MacSnap {
+    vec(token) *output;
+    vec(sym) *macros;
+    SnapFile *files;
+    size_t nfiles;
+};
+
+// How a restored name becomes an Ident, and a number a Strtox (when
+// 'number' is NULL, numbers are not evaluated).
+struct MacSnapNames {
+    void *ctx;
+    struct Ident* (*ident)(void *ctx, char *name);
+    Strtox* (*number)(void *ctx, char *spelling, size_t len);
+};
+
+/// The tokens given, the macros in defs, the files, and the include dirs
+/// (normalized, in order); 0 when the snapshot could not be written.
+int macsnap_save(char *path, vec(token) *output, Macros *defs, SnapFile *files, size_t nfiles,
+        vec(str) *dirs);
+
+/// 0, and nothing in out, when there is no snapshot at path, when one
+/// of its files is not what it was, or when it was saved with other dirs.
+int macsnap_load(char *path, vec(str) *dirs, MacSnapNames *names, MacSnap *out);
+
+#endif /* MACSNAP_H_ */
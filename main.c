@@ -147,72 +147,78 @@ void test_eval()
     Strtox *data = parse_number("0x1.cd05bc61f9e57p+18");
     assert_true(FLOATING_16 == data->evaltype);
     assert_true('+' == data->main_sign);
-    assert_true(strequal("1", data->dec));
-    assert_true(strequal("cd05bc61f9e57", data->mnt));
-    assert_true(strequal("18", data->exp));
+    assert_true(slice_equal_str(data->dec, "1"));
+    assert_true(slice_equal_str(data->mnt, "cd05bc61f9e57"));
+    assert_true(slice_equal_str(data->exp, "18"));
     assert_true('+' == data->exp_sign);
-    assert_true(strequal("", data->suf));
+    assert_true(slice_equal_str(data->suf, ""));
 
     data = parse_number("0x0");
     assert_true(INTEGER_16 == data->evaltype);
-    assert_true(strequal("0", data->dec));
-    assert_true(strequal("", data->mnt));
-    assert_true(strequal("", data->exp));
-    assert_true(strequal("", data->suf));
+    assert_true(slice_equal_str(data->dec, "0"));
+    assert_true(slice_equal_str(data->mnt, ""));
+    assert_true(slice_equal_str(data->exp, ""));
+    assert_true(slice_equal_str(data->suf, ""));
 
     data = parse_number("0");
     assert_true(INTEGER_10 == data->evaltype);
-    assert_true(strequal("0", data->dec));
-    assert_true(strequal("", data->mnt));
-    assert_true(strequal("", data->exp));
-    assert_true(strequal("", data->suf));
+    assert_true(slice_equal_str(data->dec, "0"));
+    assert_true(slice_equal_str(data->mnt, ""));
+    assert_true(slice_equal_str(data->exp, ""));
+    assert_true(slice_equal_str(data->suf, ""));
 
     data = parse_number("01");
     assert_true(INTEGER_8 == data->evaltype);
-    assert_true(strequal("1", data->dec));
-    assert_true(strequal("", data->mnt));
-    assert_true(strequal("", data->exp));
-    assert_true(strequal("", data->suf));
+    assert_true(slice_equal_str(data->dec, "1"));
+    assert_true(slice_equal_str(data->mnt, ""));
+    assert_true(slice_equal_str(data->exp, ""));
+    assert_true(slice_equal_str(data->suf, ""));
 
     data = parse_number("0b0");
     assert_true(INTEGER_2 == data->evaltype);
-    assert_true(strequal("0", data->dec));
-    assert_true(strequal("", data->mnt));
-    assert_true(strequal("", data->exp));
-    assert_true(strequal("", data->suf));
+    assert_true(slice_equal_str(data->dec, "0"));
+    assert_true(slice_equal_str(data->mnt, ""));
+    assert_true(slice_equal_str(data->exp, ""));
+    assert_true(slice_equal_str(data->suf, ""));
 
     data = parse_number("3.14");
     assert_true(FLOATING_10 == data->evaltype);
-    assert_true(strequal("3", data->dec));
-    assert_true(strequal("14", data->mnt));
-    assert_true(strequal("", data->exp));
-    assert_true(strequal("", data->suf));
+    assert_true(slice_equal_str(data->dec, "3"));
+    assert_true(slice_equal_str(data->mnt, "14"));
+    assert_true(slice_equal_str(data->exp, ""));
+    assert_true(slice_equal_str(data->suf, ""));
 
     data = parse_number(".14");
     assert_true(FLOATING_10 == data->evaltype);
-    assert_true(strequal("", data->dec));
-    assert_true(strequal("14", data->mnt));
-    assert_true(strequal("", data->exp));
-    assert_true(strequal("", data->suf));
+    assert_true(slice_equal_str(data->dec, ""));
+    assert_true(slice_equal_str(data->mnt, "14"));
+    assert_true(slice_equal_str(data->exp, ""));
+    assert_true(slice_equal_str(data->suf, ""));
 
     data = parse_number("3.830124e+05");
     assert_true(FLOATING_10 == data->evaltype);
-    assert_true(strequal("3", data->dec));
-    assert_true(strequal("830124", data->mnt));
-    assert_true(strequal("05", data->exp));
-    assert_true(strequal("", data->suf));
+    assert_true(slice_equal_str(data->dec, "3"));
+    assert_true(slice_equal_str(data->mnt, "830124"));
+    assert_true(slice_equal_str(data->exp, "05"));
+    assert_true(slice_equal_str(data->suf, ""));
 
     data = parse_number("383012.4228341295965947L");
     assert_true(FLOATING_10 == data->evaltype);
-    assert_true(strequal("383012", data->dec));
-    assert_true(strequal("4228341295965947", data->mnt));
-    assert_true(strequal("", data->exp));
-    assert_true(strequal("L", data->suf));
+    assert_true(slice_equal_str(data->dec, "383012"));
+    assert_true(slice_equal_str(data->mnt, "4228341295965947"));
+    assert_true(slice_equal_str(data->exp, ""));
+    assert_true(slice_equal_str(data->suf, "L"));
 }
 
 #if 0
-int main(void)
+int main(int argc, char **argv)
 {
+    // the benchmarks print timings, so they run only when asked for
+    if (argc > 1 && streq(argv[1], "bench")) {
+        bench_strtox_stdlib();
+        return 0;
+    }
+
     test_buf_0();
     test_buf_1();
     test_buf_2();
@@ -247,6 +253,30 @@ int main(void)
     test_free();
     test_realloc_in_place();
 
+    test_hideset_intern();
+    test_hideset_ops();
+
+    test_ppexpr_arith();
+    test_ppexpr_invalid();
+    test_ppexpr_names();
+
+    test_incpath_find();
+
+    test_filecache_shared();
+
+    test_tokcache_skip();
+
+    test_identtable_threads();
+
+    test_map_lifecycle();
+    test_map_arena();
+
+    test_tokfile_roundtrip();
+
+    test_macsnap_roundtrip();
+
+    test_scan_preprocess();
+
     test_vec0();
     test_vec1();
     test_vec2();
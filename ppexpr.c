@@ -0,0 +1,477 @@
+#include "ppexpr.h"
+
+typedef struct Parser {
+    Token **tokens;
+    size_t pos, count;
+    PpExpr *e;
+    int names;
+    int error;
+    vec(ident) *typenames; // what the Types being parsed depend on
+} Parser;
+
+// Whether an expression is unsigned, as the usual arithmetic conversions
+// make it. It comes down to its leaves: it is unsigned when is_unsigned is,
+// or when the value of one of the names in Parser::typenames from 'from'
+// up is. The expressions are parsed one inside the other, so the names of
+// the one parsed last are always on top.
+typedef struct Type {
+    int is_unsigned;
+    size_t from;
+} Type;
+
+static Type type_leaf(Parser *p, int is_unsigned)
+{
+    return (Type) { is_unsigned, vec_size(p->typenames) };
+}
+
+// A signed int, whatever the operands were: the names are of no use.
+static Type type_int(Parser *p, Type operand)
+{
+    while (vec_size(p->typenames) > operand.from) {
+        vec_pop_back(p->typenames);
+    }
+    return (Type) { 0, operand.from };
+}
+
+// Unsigned when either one is: l is parsed first, so both have their
+// names on top, together.
+static Type type_either(Type l, Type r)
+{
+    return (Type) { l.is_unsigned || r.is_unsigned, l.from };
+}
+
+// The code may move: the instruction is looked up by its index.
+static size_t emit(Parser *p, enum ppop op)
+{
+    PpExpr *e = p->e;
+    if (e->size == e->alloc) {
+        e->alloc = e->alloc ? e->alloc * 2 : 16;
+        e->code = cc_realloc(e->code, sizeof(PpInsn) * e->alloc);
+    }
+    e->code[e->size] = (PpInsn) { .op = op, .target = 0, .value = { 0, 0 }, .name = NULL };
+    return e->size++;
+}
+
+static Token* peek(Parser *p)
+{
+    return p->pos < p->count ? p->tokens[p->pos] : EOF_TOKEN_ENTRY;
+}
+
+static int accept(Parser *p, T type)
+{
+    if (peek(p)->type == type) {
+        p->pos += 1;
+        return 1;
+    }
+    return 0;
+}
+
+static int char_escape(char **at)
+{
+    char *c = *at;
+    int value = 0;
+    if (*c != '\\') {
+        *at = c + 1;
+        return (unsigned char) *c;
+    }
+    c += 1;
+    switch (*c) {
+    case 'n': value = '\n'; break;
+    case 't': value = '\t'; break;
+    case 'r': value = '\r'; break;
+    case 'a': value = '\a'; break;
+    case 'b': value = '\b'; break;
+    case 'f': value = '\f'; break;
+    case 'v': value = '\v'; break;
+    case 'x':
+        for (c += 1; is_hex(*c); c += 1) {
+            value = value * 16 + (is_dec(*c) ? *c - '0' : (*c | 0x20) - 'a' + 10);
+        }
+        *at = c;
+        return value & 0xff;
+    default:
+        if (*c >= '0' && *c <= '7') {
+            for (int n = 0; n < 3 && *c >= '0' && *c <= '7'; n += 1, c += 1) {
+                value = value * 8 + (*c - '0');
+            }
+            *at = c;
+            return value & 0xff;
+        }
+        value = (unsigned char) *c; // \\ \' \" \?
+        break;
+    }
+    *at = c + 1;
+    return value;
+}
+
+int ppexpr_constant(Token *t, PpValue *out)
+{
+    if (t->type == TOKEN_CHAR) {
+        // a plain 'c' is an int; a char is signed, as it is with gcc on x86
+        char *c = strchr(t->value, '\'') + 1;
+        int64_t value = 0;
+        size_t n = 0;
+        while (*c && *c != '\'') {
+            value = (value << 8) | char_escape(&c);
+            n += 1;
+        }
+        if (n == 1) {
+            value = (signed char) value;
+        }
+        *out = (PpValue) { .value = (uint64_t) value, .is_unsigned = 0 };
+        return n > 0;
+    }
+    if (t->type != TOKEN_NUMBER) {
+        return 0;
+    }
+
+    Strtox number;
+    Strtox *n = t->number;
+    if (n == NULL) {
+        n = &number;
+        if (!parse_number_checked(n, t->value, strlen(t->value))) {
+            return 0;
+        }
+    }
+    if (!strtox_is_integer(n) || n->inttype == INTTYPE_ERROR) {
+        return 0;
+    }
+    int is_unsigned = n->inttype == INTTYPE_UINT || n->inttype == INTTYPE_ULONG || n->inttype == INTTYPE_ULLONG;
+    *out = (PpValue) { .value = n->u64, .is_unsigned = is_unsigned };
+    return 1;
+}
+
+static Type parse_cond(Parser *p);
+
+// a, b: the type of b
+static Type parse_comma(Parser *p)
+{
+    Type type = parse_cond(p);
+    while (!p->error && accept(p, T_COMMA)) {
+        type_int(p, type);
+        emit(p, PPOP_DROP);
+        type = parse_cond(p);
+    }
+    return type;
+}
+
+static Type parse_primary(Parser *p)
+{
+    Token *t = peek(p);
+    p->pos += 1;
+
+    if (t->type == T_LEFT_PAREN) {
+        Type type = parse_comma(p);
+        if (!accept(p, T_RIGHT_PAREN)) {
+            p->error = 1;
+        }
+        return type;
+    }
+
+    if (t->type == TOKEN_IDENT && t->ident == defined_ident) {
+        int paren = accept(p, T_LEFT_PAREN);
+        Token *name = peek(p);
+        if (name->type != TOKEN_IDENT) {
+            p->error = 1;
+            return type_leaf(p, 0);
+        }
+        p->pos += 1;
+        if (paren && !accept(p, T_RIGHT_PAREN)) {
+            p->error = 1;
+            return type_leaf(p, 0);
+        }
+        size_t at = emit(p, PPOP_DEFINED);
+        p->e->code[at].name = name->ident;
+        return type_leaf(p, 0);
+    }
+
+    if (t->type == TOKEN_IDENT) {
+        Type type = type_leaf(p, 0);
+        if (p->names) {
+            size_t at = emit(p, PPOP_NAME);
+            p->e->code[at].name = t->ident;
+            vec_push_back(p->typenames, t->ident);
+        } else {
+            emit(p, PPOP_PUSH);
+        }
+        return type;
+    }
+
+    PpValue value;
+    if (!ppexpr_constant(t, &value)) {
+        p->error = 1;
+        return type_leaf(p, 0);
+    }
+    size_t at = emit(p, PPOP_PUSH);
+    p->e->code[at].value = value;
+    return type_leaf(p, value.is_unsigned);
+}
+
+static Type parse_unary(Parser *p)
+{
+    T type = peek(p)->type;
+    enum ppop op;
+    switch (type) {
+    case T_MINUS: op = PPOP_NEG; break;
+    case T_EXCLAMATION: op = PPOP_NOT; break;
+    case T_TILDE: op = PPOP_COMPL; break;
+    case T_PLUS: op = PPOP_PLUS; break;
+    default:
+        return parse_primary(p);
+    }
+    p->pos += 1;
+    Type operand = parse_unary(p);
+    emit(p, op);
+    return op == PPOP_NOT ? type_int(p, operand) : operand;
+}
+
+static int binary_prec(T type, enum ppop *op)
+{
+    switch (type) {
+    case T_TIMES: *op = PPOP_MUL; return 10;
+    case T_DIVIDE: *op = PPOP_DIV; return 10;
+    case T_PERCENT: *op = PPOP_MOD; return 10;
+    case T_PLUS: *op = PPOP_ADD; return 9;
+    case T_MINUS: *op = PPOP_SUB; return 9;
+    case T_LSHIFT: *op = PPOP_SHL; return 8;
+    case T_RSHIFT: *op = PPOP_SHR; return 8;
+    case T_LT: *op = PPOP_LT; return 7;
+    case T_GT: *op = PPOP_GT; return 7;
+    case T_LE: *op = PPOP_LE; return 7;
+    case T_GE: *op = PPOP_GE; return 7;
+    case T_EQ: *op = PPOP_EQ; return 6;
+    case T_NE: *op = PPOP_NE; return 6;
+    case T_AND: *op = PPOP_AND; return 5;
+    case T_XOR: *op = PPOP_XOR; return 4;
+    case T_OR: *op = PPOP_OR; return 3;
+    case T_AND_AND: *op = PPOP_ANDTHEN; return 2;
+    case T_OR_OR: *op = PPOP_ORELSE; return 1;
+    default:
+        return 0;
+    }
+}
+
+// Precedence climbing: the operators that bind tighter than prec are
+// taken by the recursive call.
+static Type parse_binary(Parser *p, int prec)
+{
+    Type type = parse_unary(p);
+    for (;;) {
+        enum ppop op;
+        int next = binary_prec(peek(p)->type, &op);
+        if (next == 0 || next < prec || p->error) {
+            return type;
+        }
+        p->pos += 1;
+        if (op == PPOP_ANDTHEN || op == PPOP_ORELSE) {
+            size_t jump = emit(p, op);
+            parse_binary(p, next + 1);
+            emit(p, PPOP_BOOL);
+            p->e->code[jump].target = p->e->size;
+            type = type_int(p, type);
+            continue;
+        }
+        Type right = parse_binary(p, next + 1);
+        emit(p, op);
+        if (op == PPOP_SHL || op == PPOP_SHR) {
+            // the type of the left one
+            type_int(p, right);
+        } else if (op >= PPOP_LT && op <= PPOP_NE) {
+            type = type_int(p, type);
+        } else {
+            type = type_either(type, right);
+        }
+    }
+}
+
+// The arms of ?: get the usual arithmetic conversions, whichever one is
+// taken: both go to where they meet, and the value is made unsigned there
+// when the other one would have been.
+static Type parse_cond(Parser *p)
+{
+    Type type = parse_binary(p, 1);
+    if (!accept(p, T_QUESTION)) {
+        return type;
+    }
+    type_int(p, type);
+    size_t jz = emit(p, PPOP_JZ);
+    Type yes = parse_comma(p);
+    size_t jmp = emit(p, PPOP_JMP);
+    if (!accept(p, T_COLON)) {
+        p->error = 1;
+        return yes;
+    }
+    p->e->code[jz].target = p->e->size;
+    Type no = parse_cond(p);
+    p->e->code[jmp].target = p->e->size;
+
+    type = type_either(yes, no);
+    if (type.is_unsigned) {
+        emit(p, PPOP_UNSIGNED);
+        return type;
+    }
+    for (size_t i = type.from; i < vec_size(p->typenames); i += 1) {
+        size_t at = emit(p, PPOP_UNSIGNED_IF);
+        p->e->code[at].name = vec_get(p->typenames, i);
+    }
+    return type;
+}
+
+PpExpr* ppexpr_compile(Token **tokens, size_t count, int names)
+{
+    PpExpr *e = cc_malloc(sizeof(PpExpr));
+    Parser p = { .tokens = tokens, .pos = 0, .count = count, .e = e, .names = names, .error = 0,
+        .typenames = vec_new(ident) };
+
+    parse_comma(&p);
+    cc_free(&p.typenames->data);
+    cc_free(&p.typenames);
+    if (p.error || p.pos != count) {
+        cc_free(&e->code);
+        cc_free(&e);
+        return NULL;
+    }
+    e->stack = cc_malloc(sizeof(PpValue) * (e->size + 1));
+    return e;
+}
+
+void ppexpr_free(PpExpr **e)
+{
+    cc_free(&(*e)->code);
+    cc_free(&(*e)->stack);
+    cc_free(e);
+}
+
+// A macro that is one integer constant, or nothing at all.
+static int name_value(Macros *defs, Ident *name, PpValue *out)
+{
+    PpSym *sym = macros_get(defs, name);
+    if (sym == NULL) {
+        *out = (PpValue) { 0, 0 };
+        return 1;
+    }
+    if (sym->parm || vec_size(sym->repl) != 1) {
+        return 0;
+    }
+    return ppexpr_constant(vec_get(sym->repl, 0), out);
+}
+
+int ppexpr_eval(PpExpr *e, Macros *defs, PpValue *out)
+{
+    PpValue *stack = e->stack;
+    size_t sp = 0;
+
+    for (size_t pc = 0; pc < e->size; pc += 1) {
+        PpInsn *insn = &e->code[pc];
+        enum ppop op = insn->op;
+
+        if (op == PPOP_PUSH) {
+            stack[sp++] = insn->value;
+            continue;
+        }
+        if (op == PPOP_NAME) {
+            if (!name_value(defs, insn->name, &stack[sp++])) {
+                return 0;
+            }
+            continue;
+        }
+        if (op == PPOP_DEFINED) {
+            stack[sp++] = (PpValue) { macros_get(defs, insn->name) != NULL, 0 };
+            continue;
+        }
+        if (op == PPOP_JMP) {
+            pc = insn->target - 1;
+            continue;
+        }
+        if (op == PPOP_UNSIGNED || op == PPOP_UNSIGNED_IF) {
+            PpValue name = { 0, 1 };
+            if (op == PPOP_UNSIGNED_IF && !name_value(defs, insn->name, &name)) {
+                return 0;
+            }
+            stack[sp - 1].is_unsigned |= name.is_unsigned;
+            continue;
+        }
+
+        PpValue *a = &stack[sp - 1];
+        switch (op) {
+        case PPOP_NEG: a->value = -a->value; continue;
+        case PPOP_NOT: *a = (PpValue) { a->value == 0, 0 }; continue;
+        case PPOP_COMPL: a->value = ~a->value; continue;
+        case PPOP_PLUS: continue;
+        case PPOP_BOOL: *a = (PpValue) { a->value != 0, 0 }; continue;
+        case PPOP_DROP: sp -= 1; continue;
+        case PPOP_JZ:
+            sp -= 1;
+            if (a->value == 0) {
+                pc = insn->target - 1;
+            }
+            continue;
+        case PPOP_ANDTHEN:
+        case PPOP_ORELSE:
+            if ((a->value != 0) == (op == PPOP_ORELSE)) {
+                *a = (PpValue) { op == PPOP_ORELSE, 0 };
+                pc = insn->target - 1;
+            } else {
+                sp -= 1;
+            }
+            continue;
+        default:
+            break;
+        }
+
+        // binary: the usual arithmetic conversions come down to
+        // unsigned when either one is
+        PpValue *l = &stack[sp - 2], r = stack[sp - 1];
+        sp -= 1;
+        int u = l->is_unsigned || r.is_unsigned;
+        uint64_t x = l->value, y = r.value;
+        int64_t sx = (int64_t) x, sy = (int64_t) y;
+
+        switch (op) {
+        case PPOP_MUL: x = x * y; break;
+        case PPOP_DIV:
+        case PPOP_MOD:
+            if (y == 0) {
+                cc_fatal("division by zero in #if\n");
+            }
+            if (u) {
+                x = op == PPOP_DIV ? x / y : x % y;
+            } else if (sx == INT64_MIN && sy == -1) {
+                x = op == PPOP_DIV ? x : 0;
+            } else {
+                x = (uint64_t) (op == PPOP_DIV ? sx / sy : sx % sy);
+            }
+            break;
+        case PPOP_ADD: x = x + y; break;
+        case PPOP_SUB: x = x - y; break;
+        case PPOP_SHL:
+            x = y >= 64 ? 0 : x << y;
+            u = l->is_unsigned;
+            break;
+        case PPOP_SHR:
+            u = l->is_unsigned;
+            if (y >= 64) {
+                x = (!u && sx < 0) ? (uint64_t) -1 : 0;
+            } else {
+                x = u ? x >> y : (uint64_t) (sx >> y);
+            }
+            break;
+        case PPOP_LT: x = u ? x < y : sx < sy; u = 0; break;
+        case PPOP_GT: x = u ? x > y : sx > sy; u = 0; break;
+        case PPOP_LE: x = u ? x <= y : sx <= sy; u = 0; break;
+        case PPOP_GE: x = u ? x >= y : sx >= sy; u = 0; break;
+        case PPOP_EQ: x = x == y; u = 0; break;
+        case PPOP_NE: x = x != y; u = 0; break;
+        case PPOP_AND: x = x & y; break;
+        case PPOP_XOR: x = x ^ y; break;
+        case PPOP_OR: x = x | y; break;
+        default:
+            assert(0 && "unknown #if instruction");
+        }
+        *l = (PpValue) { x, u };
+    }
+
+    assert(sp == 1);
+    *out = stack[0];
+    return 1;
+}
@@ -0,0 +1,73 @@
+#ifndef PPEXPR_H_
+#define PPEXPR_H_
+
+#include "drcc.h"
+#include "idents.h"
+
+// The controlling expressions of #if and #elif.
+//
+// An expression is compiled once into a short postfix program, with jumps
+// for && || and ?:, and evaluated in intmax_t/uintmax_t (C11 6.10.1).
+// 'defined X' is kept in the program as a lookup. Any other name may be
+// kept too: it then stands for the value of its macro at the time of the
+// evaluation. That works while the macro is undefined or is one integer
+// constant; when it is anything else, the evaluation gives up, and the
+// caller has to expand the line and compile what it gets instead.
+
+typedef struct PpValue PpValue;
+typedef struct PpInsn PpInsn;
+typedef struct PpExpr PpExpr;
+
+struct PpValue {
+    uint64_t value;
+    int is_unsigned;
+};
+
+enum ppop {
+    PPOP_PUSH, // value
+    PPOP_NAME, // the value of the macro name
+    PPOP_DEFINED, // whether name is a macro
+
+    PPOP_NEG, PPOP_NOT, PPOP_COMPL, PPOP_PLUS,
+
+    PPOP_MUL, PPOP_DIV, PPOP_MOD, PPOP_ADD, PPOP_SUB, PPOP_SHL, PPOP_SHR,
+    PPOP_LT, PPOP_GT, PPOP_LE, PPOP_GE, PPOP_EQ, PPOP_NE,
+    PPOP_AND, PPOP_XOR, PPOP_OR,
+
+    PPOP_ANDTHEN, // pops; when false, pushes 0 and goes to target
+    PPOP_ORELSE, // pops; when true, pushes 1 and goes to target
+    PPOP_BOOL, // the right operand of && or ||
+    PPOP_JZ, // pops, goes to target when false
+    PPOP_JMP,
+    PPOP_DROP, // the left operand of a comma
+    PPOP_UNSIGNED, // where the arms of ?: meet, when one of them is unsigned
+    PPOP_UNSIGNED_IF, // the same, when it is the value of name that is
+};
+
+struct PpInsn {
+    enum ppop op;
+    size_t target;
+    PpValue value;
+    Ident *name;
+};
+
+struct PpExpr {
+    PpInsn *code;
+    size_t size, alloc;
+    PpValue *stack; // as deep as the program is long, the worst case
+};
+
+/// NULL when the tokens are not an expression. With names set, names
+/// are compiled as PPOP_NAME, otherwise they are 0, as what is left
+/// of a name after macro expansion.
+PpExpr* ppexpr_compile(Token **tokens, size_t count, int names);
+
+void ppexpr_free(PpExpr **e);
+
+/// 0 when a name in the program has no plain value in defs.
+int ppexpr_eval(PpExpr *e, Macros *defs, PpValue *out);
+
+/// The value of an integer or a character constant; 0 when it is not one.
+int ppexpr_constant(Token *t, PpValue *out);
+
+#endif /* PPEXPR_H_ */
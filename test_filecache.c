@@ -0,0 +1,51 @@
+#include "filecache.h"
+#include "ccore/utest.h"
+#include <unistd.h>
+
+static void write_file(char *path, char *content)
+{
+    FILE *fp = fopen(path, "wb");
+    assert_true(fp != NULL);
+    fputs(content, fp);
+    fclose(fp);
+}
+
+void test_filecache_shared()
+{
+    char path[] = "/tmp/filecache.XXXXXX";
+    int fd = mkstemp(path);
+    assert_true(fd >= 0);
+    close(fd);
+    write_file(path, "\xef\xbb\xbfint x;\n");
+
+    FileCache *cache = filecache_new(FILECACHE_DEFAULT_CAP);
+    FileData *a = filecache_get(cache, path);
+    FileData *b = filecache_get(cache, path);
+    assert_true(a != NULL && a == b);
+    assert_true(a->refs == 2);
+
+    // without the BOM, and padded
+    assert_true(a->len == 7 && strcmp(a->buf, "int x;\n") == 0);
+    assert_true(a->buf[a->len + BUFFER_PADDING - 1] == '\0');
+
+    // another size is another file
+    write_file(path, "int xy;\n");
+    FileData *c = filecache_get(cache, path);
+    assert_true(c != a && c->len == 8);
+
+    filecache_release(cache, a);
+    filecache_release(cache, b);
+    filecache_release(cache, c);
+    assert_true(cache->bytes == 15);
+
+    // what is not used goes first, what is used stays
+    FileData *d = filecache_get(cache, path);
+    assert_true(d == c);
+    filecache_set_cap(cache, 0);
+    assert_true(cache->bytes == 8);
+    filecache_release(cache, d);
+    assert_true(cache->bytes == 0);
+
+    assert_true(filecache_get(cache, "/nonexistent/file.h") == NULL);
+    unlink(path);
+}
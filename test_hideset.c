@@ -0,0 +1,47 @@
+#include "hideset.h"
+#include "ccore/utest.h"
+
+void test_hideset_intern()
+{
+    HideSets *t = hidesets_new();
+
+    HideSet *a = hs_add(t, NULL, 3);
+    HideSet *b = hs_add(t, NULL, 3);
+    assert_true(a == b);
+    assert_true(a->size == 1);
+
+    // the order of insertion does not matter: the same set is the same pointer
+    HideSet *x = hs_add(t, hs_add(t, hs_add(t, NULL, 5), 1), 3);
+    HideSet *y = hs_add(t, hs_add(t, hs_add(t, NULL, 3), 5), 1);
+    assert_true(x == y);
+    assert_true(x->size == 3);
+    assert_true(x->ids[0] == 1 && x->ids[1] == 3 && x->ids[2] == 5);
+
+    // adding what is already there changes nothing
+    assert_true(hs_add(t, x, 5) == x);
+}
+
+void test_hideset_ops()
+{
+    HideSets *t = hidesets_new();
+
+    HideSet *a = hs_add(t, hs_add(t, NULL, 1), 2);
+    HideSet *b = hs_add(t, hs_add(t, NULL, 2), 3);
+
+    HideSet *u = hs_union(t, a, b);
+    assert_true(u->size == 3);
+    assert_true(hs_contains(u, 1));
+    assert_true(hs_contains(u, 2));
+    assert_true(hs_contains(u, 3));
+    assert_true(!hs_contains(u, 4));
+    assert_true(hs_union(t, b, a) == u);
+
+    HideSet *i = hs_intersect(t, a, b);
+    assert_true(i->size == 1);
+    assert_true(hs_contains(i, 2));
+    assert_true(hs_intersect(t, b, a) == i);
+
+    assert_true(hs_union(t, a, NULL) == a);
+    assert_true(hs_intersect(t, a, NULL)->size == 0);
+    assert_true(!hs_contains(NULL, 1));
+}
@@ -0,0 +1,66 @@
+#include "idents.h"
+#include "ccore/utest.h"
+
+#define THREADS (8)
+#define NAMES (20000)
+
+typedef struct Worker {
+    IdentTable *t;
+    int first;
+    Ident **got; // by name number
+} Worker;
+
+// Every worker interns every name, each from a different one on.
+static void* intern_all(void *arg)
+{
+    Worker *w = arg;
+    char name[32];
+    for (int i = 0; i < NAMES; i += 1) {
+        int n = (w->first + i) % NAMES;
+        snprintf(name, sizeof(name), "name_%d", n);
+        w->got[n] = ident_intern(w->t, name);
+        assert_true(ident_intern(w->t, "define") == define_ident);
+    }
+    return NULL;
+}
+
+void test_identtable_threads()
+{
+    IdentTable *t = identtable_new();
+    assert_true(identtable_count(t) == ID_COUNT);
+    assert_true(ident_intern(t, "while") == while_ident);
+    assert_true(ident_intern_slice(t, "include_next", 7) == include_ident);
+    assert_true(ident_intern(t, "include_next") == include_next_ident);
+
+    pthread_t threads[THREADS];
+    Worker workers[THREADS];
+    for (int i = 0; i < THREADS; i += 1) {
+        workers[i] = (Worker) { .t = t, .first = i * (NAMES / THREADS), .got = cc_malloc(sizeof(Ident*) * NAMES) };
+        assert_true(pthread_create(&threads[i], NULL, &intern_all, &workers[i]) == 0);
+    }
+    for (int i = 0; i < THREADS; i += 1) {
+        pthread_join(threads[i], NULL);
+    }
+
+    // one Ident per name, whoever met it first, and the ids dense
+    assert_true(identtable_count(t) == ID_COUNT + NAMES);
+    char *seen = cc_malloc(identtable_count(t));
+    for (int n = 0; n < NAMES; n += 1) {
+        Ident *id = workers[0].got[n];
+        for (int i = 1; i < THREADS; i += 1) {
+            assert_true(workers[i].got[n] == id);
+        }
+        assert_true(id->id >= ID_COUNT && id->id < identtable_count(t));
+        assert_true(!seen[id->id]);
+        seen[id->id] = 1;
+        assert_true(ident_byid(t, id->id) == id);
+    }
+    assert_true(ident_byid(t, ID_define) == define_ident);
+
+    cc_free(&seen);
+    for (int i = 0; i < THREADS; i += 1) {
+        cc_free(&workers[i].got);
+    }
+    identtable_free(&t);
+    assert_true(t == NULL);
+}
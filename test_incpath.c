@@ -0,0 +1,65 @@
+#include "incpath.h"
+#include "ccore/utest.h"
+
+static char* join(char *dir, char *name)
+{
+    Str path = STR_INIT;
+    sb_adds(&path, dir);
+    sb_addc(&path, '/');
+    sb_adds(&path, name);
+    return path.data;
+}
+
+static void touch(char *dir, char *name)
+{
+    char *path = join(dir, name);
+    FILE *fp = fopen(path, "w");
+    assert_true(fp != NULL);
+    fclose(fp);
+    cc_free(&path);
+}
+
+void test_incpath_find()
+{
+    char root[] = "/tmp/incpath.XXXXXX";
+    assert_true(mkdtemp(root) != NULL);
+
+    // root/src/x.h, root/one/a.h, root/one/sys/ (empty),
+    // root/two/a.h, root/two/sys/t.h
+    char *src = join(root, "src");
+    char *one = join(root, "one");
+    char *two = join(root, "two");
+    char *onesys = join(one, "sys");
+    char *twosys = join(two, "sys");
+    assert_true(mkdir(src, 0700) == 0 && mkdir(one, 0700) == 0 && mkdir(two, 0700) == 0);
+    assert_true(mkdir(onesys, 0700) == 0 && mkdir(twosys, 0700) == 0);
+    touch(src, "x.h");
+    touch(one, "a.h");
+    touch(two, "a.h");
+    touch(twosys, "t.h");
+
+    IncludePaths *paths = incpaths_new();
+    incpaths_add_dir(paths, one);
+    incpaths_add_dir(paths, two);
+
+    // the first directory that has it
+    Resolved *a = incpaths_find(paths, src, "a.h", 1);
+    assert_true(a != NULL && strends(a->path, "/one/a.h"));
+
+    // one/sys is there, but not one/sys/t.h
+    Resolved *t = incpaths_find(paths, src, "sys/t.h", 1);
+    assert_true(t != NULL && strends(t->path, "/two/sys/t.h"));
+
+    // next to the includer for "x.h" only
+    Resolved *x = incpaths_find(paths, src, "x.h", 0);
+    assert_true(x != NULL && strends(x->path, "/src/x.h"));
+    assert_true(incpaths_find(paths, src, "x.h", 1) == NULL);
+
+    // the same file by another name is the same file
+    Resolved *y = incpaths_find(paths, one, "../src/./x.h", 0);
+    assert_true(y != NULL && y->file == x->file && strcmp(y->path, x->path) == 0);
+
+    // the answers are kept
+    assert_true(incpaths_find(paths, src, "a.h", 1) == a);
+    assert_true(incpaths_find(paths, src, "nope.h", 0) == NULL);
+}
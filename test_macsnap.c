@@ -0,0 +1,118 @@
+#define _POSIX_C_SOURCE 200809L // struct stat::st_mtim
+#include "macsnap.h"
+#include "ccore/utest.h"
+
+static IdentTable *names;
+
+static Ident* make_ident(void *ctx, char *name)
+{
+    return ident_intern(names, name);
+}
+
+static Token* name_token(char *name)
+{
+    Token *t = token_new(TOKEN_IDENT, name);
+    t->ident = make_ident(NULL, name);
+    return t;
+}
+
+static void define(Macros *defs, PpSym *m)
+{
+    macros_set(defs, m->macid->ident, m);
+}
+
+void test_macsnap_roundtrip()
+{
+    char dir[] = "/tmp/macsnap.XXXXXX";
+    assert_true(mkdtemp(dir) != NULL);
+    Str header = STR_INIT, snapshot = STR_INIT;
+    sb_adds(&header, dir);
+    sb_adds(&header, "/prefix.h");
+    sb_adds(&snapshot, dir);
+    sb_adds(&snapshot, "/prefix.snap");
+    FILE *fp = fopen(header.data, "w");
+    assert_true(fp != NULL);
+    fputs("#pragma once\n", fp);
+    fclose(fp);
+
+    names = identtable_new();
+    Macros *defined = macros_new();
+
+    // #define ONE 1, #define ADD(a, b) a + b, #define GONE then #undef GONE
+    vec(token) *one = vec_new(token);
+    vec_push_back(one, token_new(TOKEN_NUMBER, "1"));
+    define(defined, sym_new(name_token("ONE"), one, 1));
+
+    vec(token) *parm = vec_new(token);
+    vec_push_back(parm, name_token("a"));
+    vec_push_back(parm, name_token("b"));
+    vec(token) *add = vec_new(token);
+    Token *a = name_token("a");
+    a->fcategory = formal;
+    a->argnum = 0;
+    vec_push_back(add, a);
+    vec_push_back(add, token_new(T_PLUS, "+"));
+    Token *b = name_token("b");
+    b->fcategory = formal;
+    b->argnum = 1;
+    vec_push_back(add, b);
+    PpSym *m = sym_new(name_token("ADD"), add, 2);
+    m->parm = parm;
+    m->arity = 2;
+    define(defined, m);
+
+    define(defined, sym_new(name_token("GONE"), vec_new(token), 3));
+    macros_set(defined, make_ident(NULL, "GONE"), NULL);
+
+    vec(token) *output = vec_new(token);
+    vec_push_back(output, name_token("int"));
+    vec_push_back(output, name_token("x"));
+
+    struct stat st;
+    assert_true(stat(header.data, &st) == 0);
+    SourceFile file = { .dev = st.st_dev, .ino = st.st_ino, .guard = NULL, .once = 1 };
+    SnapFile read = {
+        .path = header.data, .file = &file, .dev = st.st_dev, .ino = st.st_ino, .size = st.st_size,
+        .mtime_sec = st.st_mtim.tv_sec, .mtime_nsec = st.st_mtim.tv_nsec
+    };
+    vec(str) *dirs = vec_new(str);
+    vec_push_back(dirs, "/usr/include");
+    vec_push_back(dirs, dir);
+    assert_true(macsnap_save(snapshot.data, output, defined, &read, 1, dirs));
+
+    // into another table of names
+    names = identtable_new();
+    MacSnapNames hooks = { .ctx = NULL, .ident = &make_ident, .number = NULL };
+    MacSnap snap;
+    assert_true(macsnap_load(snapshot.data, dirs, &hooks, &snap));
+
+    assert_true(vec_size(snap.output) == 2);
+    assert_true(vec_get(snap.output, 1)->ident == make_ident(NULL, "x"));
+    assert_true(vec_size(snap.macros) == 2);
+
+    PpSym *m1 = vec_get(snap.macros, 0);
+    assert_true(m1->macid->ident == make_ident(NULL, "ONE") && m1->parm == NULL);
+    assert_true(vec_size(m1->repl) == 1 && strcmp(vec_get(m1->repl, 0)->value, "1") == 0);
+
+    PpSym *m2 = vec_get(snap.macros, 1);
+    assert_true(m2->macid->ident == make_ident(NULL, "ADD") && m2->arity == 2);
+    assert_true(vec_size(m2->parm) == 2 && vec_size(m2->repl) == 3);
+    Token *rb = vec_get(m2->repl, 2);
+    assert_true(rb->fcategory == formal && rb->argnum == 1 && rb->ident == make_ident(NULL, "b"));
+
+    assert_true(snap.nfiles == 1 && snap.files[0].file->once && snap.files[0].ino == file.ino);
+
+    // other dirs, or the same in another order, do not take it
+    vec(str) *others = vec_new(str);
+    vec_push_back(others, dir);
+    vec_push_back(others, "/usr/include");
+    assert_true(!macsnap_load(snapshot.data, others, &hooks, &snap));
+    vec_pop_back(others);
+    assert_true(!macsnap_load(snapshot.data, others, &hooks, &snap));
+
+    // a file that changed makes it stale
+    fp = fopen(header.data, "a");
+    fputs("int y;\n", fp);
+    fclose(fp);
+    assert_true(!macsnap_load(snapshot.data, dirs, &hooks, &snap));
+}
@@ -0,0 +1,76 @@
+#include "ccore/map.h"
+#include "ccore/str.h"
+#include "ccore/utest.h"
+
+static char *words[] = { "if", "else", "while", "for", "do", "switch", "case", "default", "break", "continue",
+    "return", "goto", "int", "char", "void", "long" };
+
+#define NWORDS (sizeof(words) / sizeof(words[0]))
+
+static int sum_of(map(str_i32) *m)
+{
+    int sum = 0;
+    map_entry(str_i32) *e;
+    map_foreach(m, e) {
+        sum += e->val;
+    }
+    return sum;
+}
+
+void test_map_lifecycle()
+{
+    map(str_i32) *m = map_new(str_i32, &hashmap_hash_str, &hashmap_equal_str);
+    map_reserve(m, 100);
+    size_t capacity = m->capacity;
+    assert_true(m->threshold > 100);
+
+    for (size_t i = 0; i < NWORDS; i += 1) {
+        map_put(m, words[i], (int) i + 1);
+    }
+    assert_true(m->capacity == capacity);
+    assert_true(m->size == NWORDS);
+    assert_true(sum_of(m) == NWORDS * (NWORDS + 1) / 2);
+
+    // the entries go to the spare list, and come back from it
+    map_clear(m);
+    assert_true(m->size == 0);
+    assert_true(m->capacity == capacity);
+    assert_true(sum_of(m) == 0);
+    assert_true(!map_get(m, "if").found);
+    map_entry(str_i32) *spare = m->spare;
+    map_put(m, "while", 7);
+    assert_true(m->spare != spare);
+    assert_true(map_get(m, "while").value == 7);
+
+    map_destroy(m);
+    assert_true(m == NULL);
+    map_destroy(m);
+}
+
+void test_map_arena()
+{
+    MapArena *arena = map_arena_new();
+    map(str_i32) *m = map_new(str_i32, &hashmap_hash_str, &hashmap_equal_str);
+    map_use_arena(m, arena);
+
+    for (size_t i = 0; i < NWORDS; i += 1) {
+        map_put(m, words[i], (int) i);
+    }
+    assert_true(arena->nblocks == 1);
+    assert_true(map_remove(m, "goto").found);
+    assert_true(m->spare != NULL);
+    assert_true(!map_get(m, "goto").found);
+    assert_true(map_get(m, "long").value == NWORDS - 1);
+
+    // slices of a buffer find the names without a copy of them
+    char *text = "int main";
+    Slice a = slice_new(text, 3), b = slice_new("int", 3), c = slice_new(text + 4, 3);
+    assert_true(hashmap_hash_slice(&a) == hashmap_hash_slice(&b));
+    assert_true(hashmap_equal_slice(&a, &b));
+    assert_true(!hashmap_equal_slice(&a, &c));
+    assert_true(hashmap_hash_slice(&a) == hashmap_hash_str("int"));
+
+    map_destroy(m);
+    map_arena_free(&arena);
+    assert_true(arena == NULL);
+}
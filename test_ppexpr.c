@@ -0,0 +1,144 @@
+#include "ppexpr.h"
+#include "ccore/utest.h"
+
+static Token* num(char *value)
+{
+    return token_new(TOKEN_NUMBER, value);
+}
+
+static Token* op(T type)
+{
+    return token_new(type, toktype_tos(type));
+}
+
+static Token* name(Ident *id)
+{
+    Token *t = token_new(TOKEN_IDENT, id->name);
+    t->ident = id;
+    return t;
+}
+
+static int eval(Token **tokens, size_t count, int names, PpValue *out)
+{
+    PpExpr *e = ppexpr_compile(tokens, count, names);
+    if (e == NULL) {
+        return 0;
+    }
+    int ok = ppexpr_eval(e, macros_new(), out);
+    ppexpr_free(&e);
+    return ok;
+}
+
+void test_ppexpr_arith()
+{
+    PpValue v;
+
+    // 1 + 2 * 3 - -4
+    Token *a[] = { num("1"), op(T_PLUS), num("2"), op(T_TIMES), num("3"), op(T_MINUS), op(T_MINUS), num("4") };
+    assert_true(eval(a, 8, 0, &v) && v.value == 11 && !v.is_unsigned);
+
+    // -1 < 0u is false: the usual arithmetic conversions
+    Token *b[] = { op(T_MINUS), num("1"), op(T_LT), num("0u") };
+    assert_true(eval(b, 4, 0, &v) && v.value == 0);
+
+    // (0 ? 1 / 0 : 7) , 0 || 5
+    Token *c[] = { op(T_LEFT_PAREN), num("0"), op(T_QUESTION), num("1"), op(T_DIVIDE), num("0"), op(T_COLON), num("7"),
+            op(T_RIGHT_PAREN), op(T_COMMA), num("0"), op(T_OR_OR), num("5") };
+    assert_true(eval(c, 13, 0, &v) && v.value == 1);
+    assert_true(eval(c, 9, 0, &v) && v.value == 7);
+
+    // (1 ? -1 : 0u) > 0: the arm taken is unsigned, as the other one is
+    Token *g[] = { op(T_LEFT_PAREN), num("1"), op(T_QUESTION), op(T_MINUS), num("1"), op(T_COLON), num("0u"),
+            op(T_RIGHT_PAREN), op(T_GT), num("0") };
+    assert_true(eval(g, 10, 0, &v) && v.value == 1);
+    assert_true(eval(g, 8, 0, &v) && v.is_unsigned);
+    g[1] = num("0");
+    g[4] = num("1u");
+    g[6] = num("0");
+    assert_true(eval(g, 8, 0, &v) && v.is_unsigned && v.value == 0);
+    // the condition does not count
+    g[1] = num("1u");
+    g[4] = num("1");
+    assert_true(eval(g, 8, 0, &v) && !v.is_unsigned);
+
+    // -5 / 2, -5 % 2, -8 >> 1
+    Token *d[] = { op(T_MINUS), num("5"), op(T_DIVIDE), num("2") };
+    assert_true(eval(d, 4, 0, &v) && (int64_t) v.value == -2);
+    d[2] = op(T_PERCENT);
+    assert_true(eval(d, 4, 0, &v) && (int64_t) v.value == -1);
+    Token *e[] = { op(T_MINUS), num("8"), op(T_RSHIFT), num("1") };
+    assert_true(eval(e, 4, 0, &v) && (int64_t) v.value == -4);
+
+    // character constants
+    Token *f[] = { token_new(TOKEN_CHAR, "'\\377'") };
+    assert_true(eval(f, 1, 0, &v) && (int64_t) v.value == -1);
+    f[0] = token_new(TOKEN_CHAR, "'ab'");
+    assert_true(eval(f, 1, 0, &v) && v.value == 24930);
+}
+
+void test_ppexpr_invalid()
+{
+    Token *a[] = { num("1"), op(T_PLUS) };
+    assert_true(ppexpr_compile(a, 2, 0) == NULL);
+    Token *b[] = { op(T_LEFT_PAREN), num("1") };
+    assert_true(ppexpr_compile(b, 2, 0) == NULL);
+    Token *c[] = { num("1"), num("2") };
+    assert_true(ppexpr_compile(c, 2, 0) == NULL);
+    Token *d[] = { num("1.5") };
+    assert_true(ppexpr_compile(d, 1, 0) == NULL);
+
+    // defined 1, defined (1), defined, defined (X
+    Ident x = { .name = "X", .id = ID_COUNT };
+    Token *e[] = { name(defined_ident), num("1") };
+    assert_true(ppexpr_compile(e, 2, 1) == NULL);
+    assert_true(ppexpr_compile(e, 1, 1) == NULL);
+    Token *f[] = { name(defined_ident), op(T_LEFT_PAREN), num("1"), op(T_RIGHT_PAREN) };
+    assert_true(ppexpr_compile(f, 4, 1) == NULL);
+    Token *g[] = { name(defined_ident), op(T_LEFT_PAREN), name(&x) };
+    assert_true(ppexpr_compile(g, 3, 1) == NULL);
+}
+
+void test_ppexpr_names()
+{
+    Ident x = { .name = "X", .id = ID_COUNT };
+    Macros *defs = macros_new();
+    PpValue v;
+
+    // defined X || X == 0, while X is not a macro
+    Token *a[] = { name(defined_ident), name(&x), op(T_OR_OR), name(&x), op(T_EQ), num("0") };
+    PpExpr *e = ppexpr_compile(a, 6, 1);
+    assert_true(e != NULL);
+    assert_true(ppexpr_eval(e, defs, &v) && v.value == 1);
+
+    // #define X 5: the same program sees the new value
+    vec(token) *repl = vec_new(token);
+    vec_push_back(repl, num("5"));
+    macros_set(defs, &x, sym_new(name(&x), repl, 1));
+    Token *b[] = { name(&x), op(T_TIMES), num("2") };
+    PpExpr *g = ppexpr_compile(b, 3, 1);
+    assert_true(ppexpr_eval(g, defs, &v) && v.value == 10);
+    assert_true(ppexpr_eval(e, defs, &v) && v.value == 1);
+
+    // #define X 2+3: it has to be expanded first
+    vec_push_back(repl, op(T_PLUS));
+    assert_true(!ppexpr_eval(g, defs, &v));
+
+    // #define X 5u: the arms of 1 ? -1 : X meet unsigned
+    vec(token) *urepl = vec_new(token);
+    vec_push_back(urepl, num("5u"));
+    Ident y = { .name = "Y", .id = ID_COUNT + 1 };
+    Token *c[] = { num("1"), op(T_QUESTION), op(T_MINUS), num("1"), op(T_COLON), name(&y) };
+    PpExpr *k = ppexpr_compile(c, 6, 1);
+    assert_true(ppexpr_eval(k, defs, &v) && !v.is_unsigned);
+    macros_set(defs, &y, sym_new(name(&y), urepl, 2));
+    assert_true(ppexpr_eval(k, defs, &v) && v.is_unsigned && v.value == (uint64_t) -1);
+    ppexpr_free(&k);
+
+    // without names, a name is 0
+    PpExpr *h = ppexpr_compile(b, 3, 0);
+    assert_true(ppexpr_eval(h, defs, &v) && v.value == 0);
+
+    ppexpr_free(&e);
+    ppexpr_free(&g);
+    ppexpr_free(&h);
+}
@@ -0,0 +1,402 @@
+#include "tokenize.h"
+#include "ccore/utest.h"
+
+static char dir[] = "/tmp/scan.XXXXXX";
+
+static char* join(char *name)
+{
+    Str path = STR_INIT;
+    sb_adds(&path, dir);
+    sb_addc(&path, '/');
+    sb_adds(&path, name);
+    return path.data;
+}
+
+static void write_file(char *name, char *text)
+{
+    char *path = join(name);
+    FILE *fp = fopen(path, "w");
+    assert_true(fp != NULL);
+    fputs(text, fp);
+    fclose(fp);
+    cc_free(&path);
+}
+
+// The spellings of what the file gives, one space between them.
+static char* spellings(char *name, int preprocess)
+{
+    char *path = join(name);
+    Context *ctx = make_context(path);
+    Str out = STR_INIT;
+    if (preprocess) {
+        Scan *s = scan_new(ctx);
+        scan_add_include_dir(s, dir);
+        for (Token *t = scan_get(s); t->type != TOKEN_EOF; t = scan_get(s)) {
+            if (out.size) {
+                sb_addc(&out, ' ');
+            }
+            sb_adds(&out, t->value);
+        }
+        scan_free(&s);
+    } else {
+        Token *t = NULL;
+        vec_foreach(tokenize(ctx), t)
+        {
+            if (t->type == TOKEN_EOF) {
+                break;
+            }
+            if (out.size) {
+                sb_addc(&out, ' ');
+            }
+            sb_adds(&out, t->value);
+        }
+    }
+    return out.size ? out.data : "";
+}
+
+// The input preprocessed, and the expected output only lexed, give the
+// same tokens.
+static void assert_pp(char *input, char *expect)
+{
+    write_file("input.c", input);
+    write_file("expect.c", expect);
+    char *actual = spellings("input.c", 1);
+    char *expected = spellings("expect.c", 0);
+    if (strcmp(actual, expected)) {
+        fprintf(stderr, "expected: %s\n  actual: %s\n", expected, actual);
+    }
+    assert_true(strcmp(actual, expected) == 0);
+}
+
+// C11 6.10.3.5 EXAMPLE 3
+static void test_scan_rescan()
+{
+    assert_pp(
+            "#define x 3\n"
+            "#define f(a) f(x * (a))\n"
+            "#undef x\n"
+            "#define x 2\n"
+            "#define g f\n"
+            "#define z z[0]\n"
+            "#define h g(~\n"
+            "#define m(a) a(w)\n"
+            "#define w 0,1\n"
+            "#define t(a) a\n"
+            "#define p() int\n"
+            "#define q(x) x\n"
+            "#define r(x,y) x ## y\n"
+            "#define str(x) # x\n"
+            "f(y+1) + f(f(z)) % t(t(g)(0) + t)(1);\n"
+            "g(x+(3,4)-w) | h 5) & m\n"
+            "    (f)^m(m);\n"
+            "p() i[q()] = { q(1), r(2,3), r(4,), r(,5), r(,) };\n"
+            "char c[2][6] = { str(hello), str() };\n",
+
+            "f(2 * (y+1)) + f(2 * (f(2 * (z[0])))) % f(2 * (0)) + t(1);\n"
+            "f(2 * (2+(3,4)-0,1)) | f(2 * (~ 5)) & f(2 * (0,1))^m(0,1);\n"
+            "int i[] = { 1, 23, 4, 5, };\n"
+            "char c[2][6] = { \"hello\", \"\" };\n");
+}
+
+// C11 6.10.3.5 EXAMPLE 4 and 5
+static void test_scan_hashes()
+{
+    assert_pp(
+            "#define str(s) # s\n"
+            "#define xstr(s) str(s)\n"
+            "#define debug(s, t) printf(\"x\" # s \"= %d, x\" # t \"= %s\", \\\n"
+            "    x ## s, x ## t)\n"
+            "#define INCFILE(n) vers ## n\n"
+            "#define glue(a, b) a ## b\n"
+            "#define xglue(a, b) glue(a, b)\n"
+            "#define HIGHLOW \"hello\"\n"
+            "#define LOW LOW \", world\"\n"
+            "debug(1, 2);\n"
+            "fputs(str(strncmp(\"abc\\0d\", \"abc\", '\\4') // this goes away\n"
+            "    == 0) str(: \\n), s);\n"
+            "xstr(INCFILE(2).h)\n"
+            "glue(HIGH, LOW);\n"
+            "xglue(HIGH, LOW)\n",
+
+            "printf(\"x\" \"1\" \"= %d, x\" \"2\" \"= %s\", x1, x2);\n"
+            "fputs(\"strncmp(\\\"abc\\\\0d\\\", \\\"abc\\\", '\\\\4') == 0\" \": \\n\", s);\n"
+            "\"vers2.h\"\n"
+            "\"hello\";\n"
+            "\"hello\" \", world\"\n");
+
+    assert_pp(
+            "#define t(x,y,z) x ## y ## z\n"
+            "int j[] = { t(1,2,3), t(,4,5), t(6,,7), t(8,9,),\n"
+            "    t(10,,), t(,11,), t(,,12), t(,,) };\n",
+
+            "int j[] = { 123, 45, 67, 89,\n"
+            "    10, 11, 12, };\n");
+}
+
+// C11 6.10.3.5 EXAMPLE 7, and __VA_OPT__ as C23 has it
+static void test_scan_variadic()
+{
+    assert_pp(
+            "#define debug(...) fprintf(stderr, __VA_ARGS__)\n"
+            "#define showlist(...) puts(#__VA_ARGS__)\n"
+            "#define report(test, ...) ((test)?puts(#test):\\\n"
+            "    printf(__VA_ARGS__))\n"
+            "debug(\"Flag\");\n"
+            "debug(\"X = %d\\n\", x);\n"
+            "showlist(The first, second, and third items.);\n"
+            "report(x>y, \"x is %d but y is %d\", x, y);\n",
+
+            "fprintf(stderr, \"Flag\");\n"
+            "fprintf(stderr, \"X = %d\\n\", x);\n"
+            "puts(\"The first, second, and third items.\");\n"
+            "((x>y)?puts(\"x>y\"): printf(\"x is %d but y is %d\", x, y));\n");
+
+    assert_pp(
+            "#define F(...) f(0 __VA_OPT__(,) __VA_ARGS__)\n"
+            "#define G(X, ...) f(0, X __VA_OPT__(,) __VA_ARGS__)\n"
+            "#define SDEF(sname, ...) S sname __VA_OPT__(= { __VA_ARGS__ })\n"
+            "#define EMP\n"
+            "F(a,b,c) F() F(EMP)\n"
+            "G(a,b,c) G(a,) G(a)\n"
+            "SDEF(foo); SDEF(bar, 1, 2);\n"
+            "#define H3(X, ...) #__VA_OPT__(X##X X##X)\n"
+            "H3(, 0) H3(a, 0) H3(a)\n"
+            "#define E(fmt, ...) e(fmt, ## __VA_ARGS__)\n"
+            "E(x) E(x, 1)\n",
+
+            "f(0, a, b, c) f(0) f(0)\n"
+            "f(0, a, b, c) f(0, a) f(0, a)\n"
+            "S foo; S bar = { 1, 2 };\n"
+            "\"\" \"aa aa\" \"\"\n"
+            "e(x) e(x, 1)\n");
+}
+
+// A name is not replaced again inside its own replacement.
+static void test_scan_recursion()
+{
+    assert_pp(
+            "#define foo foo + 1\n"
+            "#define a b\n"
+            "#define b a\n"
+            "#define f(x) x f\n"
+            "foo; a; b; f(f)(1);\n",
+
+            "foo + 1; a; b; f f(1);\n");
+}
+
+// The sign after e or p is in the pp-number: 1e+5 is one token.
+static void test_scan_pp_numbers()
+{
+    write_file("numbers.c", "1e+5 0x1p-3 1.e-2 1f+1 .5E-1\n");
+    assert_true(strcmp(spellings("numbers.c", 0), "1e+5 0x1p-3 1.e-2 1f + 1 .5E-1") == 0);
+}
+
+static vec(token)* scan_all(Context *ctx)
+{
+    Scan *s = scan_new(ctx);
+    scan_add_include_dir(s, dir);
+    vec(token) *tokens = vec_new(token);
+    for (Token *t = scan_get(s); t->type != TOKEN_EOF; t = scan_get(s)) {
+        vec_push_back(tokens, t);
+    }
+    scan_free(&s);
+    return tokens;
+}
+
+// The numbers evaluated by the lexer, when it is asked to: one Strtox per
+// spelling, kept with the token cache for every context that reads it.
+static void test_scan_eval_numbers()
+{
+    write_file("eval.h", "0x10 1.5f\n");
+    write_file("eval.c", "#include \"eval.h\"\n0x10 017 01.5 1e\n");
+    IdentTable *idents = identtable_new();
+    TokenCache *cache = tokcache_new();
+
+    Context *ctx = make_shared_context(join("eval.c"), idents, cache);
+    context_eval_numbers(ctx, 1);
+    vec(token) *tokens = scan_all(ctx);
+    assert_true(vec_size(tokens) == 6);
+    Strtox *hex = vec_get(tokens, 0)->number;
+    assert_true(hex && hex->evaltype == INTEGER_16 && hex->u64 == 16);
+    Strtox *flt = vec_get(tokens, 1)->number;
+    assert_true(flt && flt->evaltype == FLOATING_10 && flt->flttype == FLTTYPE_FLOAT && flt->f64 == 1.5);
+    assert_true(vec_get(tokens, 2)->number == hex);
+    assert_true(vec_get(tokens, 3)->number->evaltype == INTEGER_8 && vec_get(tokens, 3)->number->u64 == 15);
+    assert_true(vec_get(tokens, 4)->number->evaltype == FLOATING_10 && vec_get(tokens, 4)->number->f64 == 1.5);
+    assert_true(vec_get(tokens, 5)->number->evaltype == EVALTYPE_ERROR);
+    context_free(&ctx);
+
+    // the header's stream still has them; what is lexed without the option has none
+    ctx = make_shared_context(join("eval.c"), idents, cache);
+    tokens = scan_all(ctx);
+    assert_true(vec_get(tokens, 0)->number == hex && hex->u64 == 16);
+    assert_true(vec_get(tokens, 2)->number == NULL);
+    context_free(&ctx);
+
+    tokcache_free(&cache);
+    identtable_free(&idents);
+}
+
+static void test_scan_conditionals()
+{
+    assert_pp(
+            "#define A 2\n"
+            "#if A > 1 && defined(A)\n"
+            "yes1\n"
+            "#else\n"
+            "no1\n"
+            "#endif\n"
+            "#ifdef B\n"
+            "no2\n"
+            "#elif (1 ? -1 : 0) < 0\n"
+            "yes2\n"
+            "#else\n"
+            "#error not here\n"
+            "#endif\n"
+            "#if 0\n"
+            "#if 1 garbage ' that is not lexed\n"
+            "#endif\n"
+            "#else\n"
+            "yes3\n"
+            "#endif\n",
+
+            "yes1\n"
+            "yes2\n"
+            "yes3\n");
+}
+
+static void test_scan_includes()
+{
+    write_file("guarded.h", "#ifndef GUARDED_H\n#define GUARDED_H\nguarded\n#endif\n");
+    write_file("once.h", "#pragma once\nonce\n");
+    write_file("twice.h", "twice\n");
+    assert_pp(
+            "#include \"guarded.h\"\n"
+            "#include <guarded.h>\n"
+            "#include \"once.h\"\n"
+            "#include \"once.h\"\n"
+            "#define TWICE \"twice.h\"\n"
+            "#include TWICE\n"
+            "#include TWICE\n"
+            "GUARDED_H\n",
+
+            "guarded once twice twice\n");
+}
+
+static char* rest(Scan *s)
+{
+    Str out = STR_INIT;
+    for (Token *t = scan_get(s); t->type != TOKEN_EOF; t = scan_get(s)) {
+        if (out.size) {
+            sb_addc(&out, ' ');
+        }
+        sb_adds(&out, t->value);
+    }
+    return out.size ? out.data : "";
+}
+
+// A prefix saved by a scan of it alone, and restored in another file:
+// only for a scan with the same include dirs.
+static void test_scan_prefix()
+{
+    write_file("prefix.h", "#include \"guarded.h\"\n#define P(x) x + 1\nint p = P(0);\n");
+    write_file("user.c", "P(2) GUARDED_H\n");
+    char *snapshot = join("prefix.snap");
+
+    Scan *s = scan_new(make_context(join("prefix.h")));
+    scan_add_include_dir(s, dir);
+    assert_true(scan_save_prefix(s, snapshot));
+
+    s = scan_new(make_context(join("user.c")));
+    scan_add_include_dir(s, dir);
+    assert_true(scan_load_prefix(s, snapshot));
+    assert_true(strcmp(rest(s), "guarded int p = 0 + 1 ; 2 + 1") == 0);
+
+    s = scan_new(make_context(join("user.c")));
+    scan_add_include_dir(s, "/usr/include");
+    assert_true(!scan_load_prefix(s, snapshot));
+    scan_include_prefix(s, join("prefix.h"));
+    assert_true(strcmp(rest(s), "guarded int p = 0 + 1 ; 2 + 1") == 0);
+}
+
+// As -E writes it: no two tokens glued into another, and the lines
+// of the source.
+static void test_scan_write()
+{
+    write_file("write.h", "#define MAX(a, b) ((a) > (b) ? (a) : (b))\n");
+    write_file("write.c",
+            "#include \"write.h\"\n"
+            "#define T int\n"
+            "#define neg(x) -x\n"
+            "#define cat(a, b) a ## b\n"
+            "#define E\n"
+            "T x = MAX(1, 2);\n"
+            "int y = -neg(1) + cat(1, .5) + cat(x, y);\n"
+            "\n"
+            "a E+ +b; x/E*y; z . 5\n");
+    Scan *s = scan_new(make_context(join("write.c")));
+    scan_add_include_dir(s, dir);
+    Str out = STR_INIT;
+    scan_write(s, &out);
+    scan_free(&s);
+    assert_true(strcmp(out.data,
+            "int x = ((1) > (2) ? (1) : (2));\n"
+            "int y = - -1 + 1.5 + xy;\n"
+            "a+ +b; x/ *y; z . 5\n") == 0);
+}
+
+static char* written(char *name, char *prefix, char *snapshot)
+{
+    Scan *s = scan_new(make_context(join(name)));
+    scan_add_include_dir(s, dir);
+    if (snapshot) {
+        assert_true(scan_load_prefix(s, snapshot));
+    } else {
+        scan_include_prefix(s, prefix);
+    }
+    Str out = STR_INIT;
+    scan_write(s, &out);
+    scan_free(&s);
+    return out.data;
+}
+
+// A restored prefix is written as the prefix read again would be: what
+// a macro gave stays on the line of the macro, and a '#' it gave is not
+// at the start of one.
+static void test_scan_write_prefix()
+{
+    write_file("hash.h",
+            "#define HASH \\\n"
+            " #\n"
+            "#define X int q; HASH define Y 1\n"
+            "X\n"
+            "int r;\n");
+    write_file("hash.c", "Y\n");
+    char *prefix = join("hash.h"), *snapshot = join("hash.snap");
+
+    Scan *s = scan_new(make_context(prefix));
+    scan_add_include_dir(s, dir);
+    assert_true(scan_save_prefix(s, snapshot));
+    scan_free(&s);
+
+    char *read = written("hash.c", prefix, NULL);
+    assert_true(strcmp(read, "int q; # define Y 1\nint r;\nY\n") == 0);
+    assert_true(strcmp(written("hash.c", prefix, snapshot), read) == 0);
+}
+
+void test_scan_preprocess()
+{
+    assert_true(mkdtemp(dir) != NULL);
+
+    test_scan_rescan();
+    test_scan_hashes();
+    test_scan_variadic();
+    test_scan_recursion();
+    test_scan_pp_numbers();
+    test_scan_eval_numbers();
+    test_scan_conditionals();
+    test_scan_includes();
+    test_scan_prefix();
+    test_scan_write();
+    test_scan_write_prefix();
+}
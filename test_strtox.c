@@ -11,6 +11,7 @@
 #include <locale.h>
 #include <wchar.h>
 #include <math.h>
+#include <time.h>
 #include "ccore/strtox.h"
 
 #define str(x) #x
@@ -179,6 +180,102 @@ static void test_eval_i64()
     }
 }
 
+static size_t eval_u64(char *s)
+{
+    Strtox *x = parse_number(s);
+    assert(strtox_is_integer(x));
+    return x->u64;
+}
+
+static void test_eval_u64()
+{
+#   define data(DEC, BIN, OCT, HEX) { .expect = DEC##ULL, .d = str(DEC), .b = str(BIN), .o = str(OCT), .h = str(HEX) }
+    struct integers {
+        size_t expect;
+        char *d;
+        char *b;
+        char *o;
+        char *h;
+    } udata[] = {
+#   include "idata/udata.data"
+            };
+#   undef data
+    const size_t len = sizeof(udata) / sizeof(udata[0]);
+
+    size_t fails = 0;
+    for (int i = 0; i < len; i++) {
+        struct integers x = udata[i];
+
+        size_t dec = eval_u64(x.d);
+        size_t bin = eval_u64(x.b);
+        size_t oct = eval_u64(x.o);
+        size_t hex = eval_u64(x.h);
+
+        if (x.expect != dec || x.expect != bin || x.expect != oct || x.expect != hex) {
+            printf("U fail: expect: %lu, but actual: %lu %lu %lu %lu\n", x.expect, dec, bin, oct,
+                    hex);
+            fails++;
+        }
+
+        // the base does not matter for unsigned types, only for signed ones
+        Strtox *h = parse_number(x.h);
+        int expect_type = x.expect <= INT32_MAX ? INTTYPE_INT : x.expect <= UINT32_MAX ? INTTYPE_UINT :
+                          x.expect <= INT64_MAX ? INTTYPE_LONG : INTTYPE_ULONG;
+        assert(h->inttype == expect_type);
+
+        Strtox *d = parse_number(x.d);
+        expect_type = x.expect <= INT32_MAX ? INTTYPE_INT :
+                      x.expect <= INT64_MAX ? INTTYPE_LONG : INTTYPE_ERROR;
+        assert(d->inttype == expect_type);
+    }
+    assert(fails == 0);
+}
+
+static int int_type(char *s)
+{
+    Strtox *x = parse_number(s);
+    assert(strtox_is_integer(x));
+    return x->inttype;
+}
+
+static void test_eval_int_types()
+{
+    assert(int_type("0") == INTTYPE_INT);
+    assert(int_type("2147483647") == INTTYPE_INT);
+    assert(int_type("2147483648") == INTTYPE_LONG);
+    assert(int_type("0x7fffffff") == INTTYPE_INT);
+    assert(int_type("0x80000000") == INTTYPE_UINT);
+    assert(int_type("0x100000000") == INTTYPE_LONG);
+    assert(int_type("0xffffffffffffffff") == INTTYPE_ULONG);
+    assert(int_type("1u") == INTTYPE_UINT);
+    assert(int_type("1U") == INTTYPE_UINT);
+    assert(int_type("4294967296u") == INTTYPE_ULONG);
+    assert(int_type("1l") == INTTYPE_LONG);
+    assert(int_type("1ul") == INTTYPE_ULONG);
+    assert(int_type("1LU") == INTTYPE_ULONG);
+    assert(int_type("1ll") == INTTYPE_LLONG);
+    assert(int_type("1ULL") == INTTYPE_ULLONG);
+    assert(int_type("1llu") == INTTYPE_ULLONG);
+    assert(int_type("0x8000000000000000ll") == INTTYPE_ULLONG);
+    assert(int_type("9223372036854775808ll") == INTTYPE_ERROR);
+    assert(int_type("18446744073709551615u") == INTTYPE_ULONG);
+
+    // bad suffixes
+    assert(int_type("1lL") == INTTYPE_ERROR);
+    assert(int_type("1uu") == INTTYPE_ERROR);
+    assert(int_type("1lul") == INTTYPE_ERROR);
+    assert(int_type("1z") == INTTYPE_ERROR);
+
+    // overflow is reported, not wrapped around
+    assert(int_type("18446744073709551616") == INTTYPE_ERROR);
+    assert(int_type("0x10000000000000000") == INTTYPE_ERROR);
+    assert(int_type("0b11111111111111111111111111111111111111111111111111111111111111111") == INTTYPE_ERROR);
+
+    // leading zeros do not overflow
+    assert(int_type("0000000000000000000000000000000000000001") == INTTYPE_INT);
+    assert(eval_u64("0x00000000000000000000000000000000000000ff") == 255);
+}
+
 static void test_eval_f64()
 {
 
@@ -221,6 +318,141 @@ static void test_eval_f64()
     }
 }
 
+static int same_bits(double a, double b)
+{
+    return memcmp(&a, &b, sizeof(double)) == 0;
+}
+
+static int eval_f64_exact(char *s)
+{
+    double expect = strtod(s, NULL);
+    double actual = eval_float(s);
+    if (!same_bits(expect, actual)) {
+        printf("X fail: %s: expect: %a, but actual: %a\n", s, expect, actual);
+        return 0;
+    }
+    return 1;
+}
+
+static void test_eval_f64_exact()
+{
+#   define data(FLT, DBL, HEX, EXP) str(FLT), str(DBL), str(HEX), str(EXP)
+    char *fdata[] = {
+#       include "idata/fdata.data"
+
+        // the hard ones: halfway points, subnormals, the edges of the range
+        "9007199254740993.0",
+        "2.2250738585072011e-308",
+        "2.2250738585072012e-308",
+        "4.9406564584124654e-324",
+        "2.4703282292062327e-324",
+        "2.4703282292062328e-324",
+        "1.7976931348623157e308",
+        "1.7976931348623158e308",
+        "1e23",
+        "8.41e21",
+        "7.038531e-26",
+        "1e-400",
+        "1e400",
+        "3.141592653589793238462643383279502884197169399375105820974944592307816406286",
+        "9007199254740993.00000000000000000000000000000000000000000000000000000000001",
+        "0x1p-1074",
+        "0x1p-1075",
+        "0x1.8p-1075",
+        "0x1.fffffffffffff8p1023",
+        "0x1.fffffffffffff7ffp1023",
+        "0x1.00000000000008p0",
+        "0x1.00000000000008000001p0",
+        "0x1.00000000000018p0",
+        "0x0.0000000000001p-1022",
+    };
+#   undef data
+    const size_t len = sizeof(fdata) / sizeof(fdata[0]);
+
+    size_t fails = 0;
+    for (size_t i = 0; i < len; i++) {
+        fails += !eval_f64_exact(fdata[i]);
+    }
+    assert(fails == 0);
+}
+
+static void test_parse_number_into()
+{
+    // the spelling is a part of a bigger buffer: not NUL-terminated at its end
+    char *src = "0x1fu+1.5e-3f;";
+    Strtox x;
+
+    parse_number_into(&x, src, 5);
+    assert(x.evaltype == INTEGER_16);
+    assert(slice_equal_str(x.dec, "1f"));
+    assert(slice_equal_str(x.suf, "u"));
+    assert(x.u64 == 31);
+
+    parse_number_into(&x, src + 5, 8);
+    assert(x.evaltype == FLOATING_10);
+    assert(x.main_sign == '+');
+    assert(slice_equal_str(x.dec, "1"));
+    assert(slice_equal_str(x.mnt, "5"));
+    assert(slice_equal_str(x.exp, "3"));
+    assert(x.exp_sign == '-');
+    assert(slice_equal_str(x.suf, "f"));
+
+    parse_number_into(&x, "0o17", 4);
+    assert(x.evaltype == INTEGER_8);
+    assert(slice_equal_str(x.dec, "17"));
+    assert(x.u64 == 15);
+}
+
+static int is_number(char *s)
+{
+    Strtox x;
+    int ok = parse_number_checked(&x, s, strlen(s));
+    assert(ok || x.evaltype == EVALTYPE_ERROR);
+    return ok;
+}
+
+static void test_parse_number_checked()
+{
+    assert(is_number("0"));
+    assert(is_number("1.5f"));
+    assert(is_number("0x1p-3"));
+    assert(is_number(".5e+10"));
+
+    // valid pp-numbers, but not constants
+    assert(!is_number("0xg"));
+    assert(!is_number("0b2"));
+    assert(!is_number("1p3"));
+
+    // an exponent with no digits, a point with no digits around it
+    assert(!is_number("1e"));
+    assert(!is_number("1e+"));
+    assert(!is_number("0x1p"));
+    assert(!is_number("0x1.p"));
+    assert(!is_number(".e1"));
+    assert(!is_number("0x.p1"));
+
+    Strtox x;
+    parse_number_checked(&x, "1.5f", 4);
+    assert(x.flttype == FLTTYPE_FLOAT);
+    parse_number_checked(&x, "1.5", 3);
+    assert(x.flttype == FLTTYPE_DOUBLE);
+    parse_number_checked(&x, "1.5L", 4);
+    assert(x.flttype == FLTTYPE_LDOUBLE);
+    parse_number_checked(&x, "1.5u", 4);
+    assert(x.flttype == FLTTYPE_ERROR);
+    parse_number_checked(&x, "1.", 2);
+    assert(x.evaltype == FLOATING_10 && x.flttype == FLTTYPE_DOUBLE);
+
+    // leading zeros in a decimal floating constant do not make it octal
+    assert(parse_number_checked(&x, "01.5", 4) && x.evaltype == FLOATING_10 && x.f64 == 1.5);
+    assert(parse_number_checked(&x, "00.5", 4) && x.evaltype == FLOATING_10 && x.f64 == 0.5);
+    assert(parse_number_checked(&x, "017.5f", 6) && x.evaltype == FLOATING_10);
+    assert(x.flttype == FLTTYPE_FLOAT && x.f64 == 17.5);
+    assert(parse_number_checked(&x, "017e1", 5) && x.evaltype == FLOATING_10 && x.f64 == 170.0);
+    assert(parse_number_checked(&x, "017", 3) && x.evaltype == INTEGER_8 && x.u64 == 15);
+    assert(parse_number_checked(&x, "017u", 4) && x.evaltype == INTEGER_8 && x.inttype == INTTYPE_UINT);
+}
+
 void test_strtox_stdlib()
 {
     // test_floating();
@@ -228,6 +460,51 @@ void test_strtox_stdlib()
     // test_unsigned();
 
     test_eval_i64();
+    test_eval_u64();
+    test_eval_int_types();
     test_eval_f64();
+    test_eval_f64_exact();
+    test_parse_number_into();
+    test_parse_number_checked();
+}
+
+void bench_strtox_stdlib()
+{
+#   define data(FLT, DBL, HEX, EXP) str(DBL), str(EXP)
+    char *fdata[] = {
+#       include "idata/fdata.data"
+            };
+#   undef data
+    const size_t len = sizeof(fdata) / sizeof(fdata[0]);
+    const int rounds = 64;
+
+    size_t lens[len];
+    for (size_t i = 0; i < len; i++) {
+        lens[i] = strlen(fdata[i]);
+    }
+
+    volatile double sink = 0;
+    Strtox x;
+
+    clock_t start = clock();
+    for (int r = 0; r < rounds; r++) {
+        for (size_t i = 0; i < len; i++) {
+            parse_number_into(&x, fdata[i], lens[i]);
+            sink += x.f64;
+        }
+    }
+    clock_t ours = clock() - start;
+
+    start = clock();
+    for (int r = 0; r < rounds; r++) {
+        for (size_t i = 0; i < len; i++) {
+            sink += strtod(fdata[i], NULL);
+        }
+    }
+    clock_t libc = clock() - start;
+
+    printf("parse_number: %.2f ms, strtod: %.2f ms (%lu constants)\n",
+            1000.0 * ours / CLOCKS_PER_SEC, 1000.0 * libc / CLOCKS_PER_SEC,
+            (unsigned long) (len * rounds));
 }
 
@@ -0,0 +1,55 @@
+#include "tokcache.h"
+#include "ccore/utest.h"
+
+static void directive(vec(token) *tokens, T type)
+{
+    Token *sharp = token_new(T_SHARP, "#");
+    sharp->fposition = fatbol;
+    vec_push_back(tokens, sharp);
+    Token *name = token_new(type, toktype_tos(type));
+    name->fposition = fnewline;
+    vec_push_back(tokens, name);
+}
+
+static void line(vec(token) *tokens)
+{
+    Token *t = token_new(TOKEN_IDENT, "x");
+    t->fposition = fatbol | fnewline;
+    vec_push_back(tokens, t);
+}
+
+void test_tokcache_skip()
+{
+    // 0 #if / 2 x / 3 #if / 5 #else / 7 x / 8 #endif / 10 #elif / 12 #endif / 14 x / 15 eof
+    vec(token) *tokens = vec_new(token);
+    directive(tokens, PT_HIF);
+    line(tokens);
+    directive(tokens, PT_HIF);
+    directive(tokens, PT_HELSE);
+    line(tokens);
+    directive(tokens, PT_HENDIF);
+    directive(tokens, PT_HELIF);
+    directive(tokens, PT_HENDIF);
+    line(tokens);
+    vec_push_back(tokens, EOF_TOKEN_ENTRY);
+
+    FileData data = { .dev = 1, .ino = 2, .size = 3, .len = 3, .hash = 42 };
+    TokenCache *cache = tokcache_new();
+    assert_true(tokcache_get(cache, &data) == NULL);
+
+    TokenStream *stream = tokcache_put(cache, &data, tokens);
+    assert_true(tokcache_get(cache, &data) == stream);
+    assert_true(vec_size(&stream->tokens) == 16);
+
+    assert_true(tokstream_skip(stream, 0) == 10);
+    assert_true(tokstream_skip(stream, 3) == 5);
+    assert_true(tokstream_skip(stream, 5) == 8);
+    assert_true(tokstream_skip(stream, 10) == 12);
+
+    // the first one in stays
+    assert_true(tokcache_put(cache, &data, tokens) == stream);
+
+    // another content is another stream
+    data.hash = 43;
+    assert_true(tokcache_get(cache, &data) == NULL);
+}
@@ -0,0 +1,110 @@
+#define _POSIX_C_SOURCE 200809L // AT_FDCWD
+#include "tokfile.h"
+#include "ccore/utest.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+static int nidents;
+
+static Ident* make_ident(void *ctx, char *name)
+{
+    nidents += 1;
+    Ident *id = cc_malloc(sizeof(Ident));
+    id->name = cc_strdup(name);
+    return id;
+}
+
+static Token* add(vec(token) *tokens, T type, char *value, unsigned fposition, int line, int column)
+{
+    Token *t = token_new(type, value);
+    t->fposition = fposition;
+    t->pos.line = line;
+    t->pos.column = column;
+    vec_push_back(tokens, t);
+    return t;
+}
+
+void test_tokfile_roundtrip()
+{
+    char dir[] = "/tmp/tokfile.XXXXXX";
+    assert_true(mkdtemp(dir) != NULL);
+    tokfile_set_dir(dir, TOKFILE_DEFAULT_CAP);
+
+    // #define x 1 / x x / eof
+    vec(token) *tokens = vec_new(token);
+    add(tokens, T_SHARP, "#", fatbol, 1, 1);
+    add(tokens, PT_HDEFINE, "define", 0, 1, 2);
+    add(tokens, TOKEN_IDENT, "x", fleadws, 1, 9);
+    add(tokens, TOKEN_NUMBER, "1", fleadws | fnewline, 1, 11);
+    add(tokens, TOKEN_IDENT, "x", fatbol, 3, 1);
+    add(tokens, TOKEN_IDENT, "x", fleadws | fnewline, 3, 3);
+    vec_push_back(tokens, EOF_TOKEN_ENTRY);
+
+    FileData data = { .len = 21, .hash = 0x1234 };
+    TokFileNames names = { .ctx = NULL, .ident = &make_ident, .number = NULL };
+    assert_true(tokfile_load(&data, "a.c", &names) == NULL);
+    assert_true(tokfile_save(&data, tokens));
+
+    vec(token) *loaded = tokfile_load(&data, "a.c", &names);
+    assert_true(loaded != NULL && vec_size(loaded) == vec_size(tokens));
+    for (size_t i = 0; i + 1 < vec_size(tokens); i += 1) {
+        Token *a = vec_get(tokens, i), *b = vec_get(loaded, i);
+        assert_true(a->type == b->type && strcmp(a->value, b->value) == 0);
+        assert_true(a->fposition == b->fposition);
+        assert_true(a->pos.line == b->pos.line && a->pos.column == b->pos.column);
+        assert_true(strcmp(b->pos.filename, "a.c") == 0);
+    }
+    assert_true(vec_get(loaded, vec_size(loaded) - 1) == EOF_TOKEN_ENTRY);
+
+    // one Ident per name, the directive name included
+    assert_true(nidents == 2);
+    assert_true(vec_get(loaded, 2)->ident == vec_get(loaded, 5)->ident);
+    assert_true(vec_get(loaded, 1)->ident != NULL && vec_get(loaded, 3)->ident == NULL);
+
+    // a spelling that runs past its column is not loaded
+    Str path = STR_INIT;
+    sb_adds(&path, dir);
+    sb_adds(&path, "/0000000000001234-15.tok");
+    FILE *fp = fopen(path.data, "r+b");
+    assert_true(fp != NULL);
+    char file[512];
+    size_t size = fread(file, 1, sizeof(file), fp);
+    char *define = NULL;
+    for (size_t i = 0; i + 7 <= size && define == NULL; i += 1) {
+        define = memcmp(file + i, "\x06" "define", 7) == 0 ? file + i : NULL;
+    }
+    assert_true(define != NULL);
+    assert_true(fseek(fp, define - file, SEEK_SET) == 0 && fputc(0x7f, fp) == 0x7f);
+    fflush(fp);
+    assert_true(tokfile_load(&data, "a.c", &names) == NULL);
+
+    // nor is a column that ends in the middle of a varint
+    assert_true(fseek(fp, define - file, SEEK_SET) == 0 && fputc(0x06, fp) == 0x06);
+    assert_true(fseek(fp, -1, SEEK_END) == 0 && fputc(0x80, fp) == 0x80);
+    fclose(fp);
+    assert_true(tokfile_load(&data, "a.c", &names) == NULL);
+
+    // nor is one cut short
+    assert_true(truncate(path.data, 64) == 0);
+    assert_true(tokfile_load(&data, "a.c", &names) == NULL);
+
+    // other contents, other file
+    data.hash = 0x1235;
+    assert_true(tokfile_load(&data, "a.c", &names) == NULL);
+
+    // what a writer that died left is removed, what one writes now is not
+    Str stale = STR_INIT, fresh = STR_INIT;
+    sb_adds(&stale, path.data);
+    sb_adds(&stale, ".1.0");
+    sb_adds(&fresh, path.data);
+    sb_adds(&fresh, ".2.0");
+    fclose(fopen(stale.data, "w"));
+    fclose(fopen(fresh.data, "w"));
+    struct timespec old[2] = { { .tv_sec = 1 }, { .tv_sec = 1 } };
+    assert_true(utimensat(AT_FDCWD, stale.data, old, 0) == 0);
+    tokfile_set_dir(dir, TOKFILE_DEFAULT_CAP);
+    assert_true(tokfile_save(&data, tokens));
+    assert_true(access(stale.data, F_OK) != 0 && access(fresh.data, F_OK) == 0);
+
+    tokfile_set_dir(NULL, 0);
+}
@@ -2,6 +2,7 @@
 #define TESTS_H_
 
 void test_strtox_stdlib();
+void bench_strtox_stdlib();
 
 void test_str_0();
 void test_strstarts_1();
@@ -19,6 +20,30 @@ void test_normalize_1();
 void test_free();
 void test_realloc_in_place();
 
+void test_hideset_intern();
+void test_hideset_ops();
+
+void test_ppexpr_arith();
+void test_ppexpr_invalid();
+void test_ppexpr_names();
+
+void test_incpath_find();
+
+void test_filecache_shared();
+
+void test_tokcache_skip();
+
+void test_identtable_threads();
+
+void test_map_lifecycle();
+void test_map_arena();
+
+void test_tokfile_roundtrip();
+
+void test_macsnap_roundtrip();
+
+void test_scan_preprocess();
+
 void test_vec0();
 void test_vec1();
 void test_vec2();
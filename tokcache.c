@@ -0,0 +1,175 @@
+#include "tokcache.h"
+
+map_impl(struct TokenStream*, struct TokenStream*, streams);
+
+static size_t stream_hash(TokenStream *s)
+{
+    return (size_t) (s->hash ^ (s->ino * 31 + s->dev));
+}
+
+static int stream_equal(TokenStream *a, TokenStream *b)
+{
+    return a->dev == b->dev && a->ino == b->ino && a->size == b->size && a->hash == b->hash;
+}
+
+TokenCache* tokcache_new()
+{
+    TokenCache *cache = cc_malloc(sizeof(TokenCache));
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->streams = map_new(streams, &stream_hash, &stream_equal);
+    cache->numbers = make_numbers_map();
+    return cache;
+}
+
+void tokcache_free(TokenCache **cache)
+{
+    assert(cache);
+
+    TokenCache *c = *cache;
+    if (c == NULL) {
+        return;
+    }
+    map_entry(streams) *e;
+    map_foreach(c->streams, e) {
+        TokenStream *stream = e->val;
+        cc_free(&stream->tokens.data);
+        cc_free(&stream->jump_from);
+        cc_free(&stream->jump_to);
+        cc_free(&stream);
+    }
+    map_destroy(c->streams);
+    map_entry(numbers) *n;
+    map_foreach(c->numbers, n) {
+        cc_free(&n->key);
+        cc_free(&n->val);
+    }
+    map_destroy(c->numbers);
+    pthread_mutex_destroy(&c->lock);
+    cc_free(cache);
+}
+
+static TokenStream stream_key(FileData *data)
+{
+    return (TokenStream) { .dev = data->dev, .ino = data->ino, .size = data->len, .hash = data->hash };
+}
+
+TokenStream* tokcache_get(TokenCache *cache, FileData *data)
+{
+    TokenStream key = stream_key(data);
+    pthread_mutex_lock(&cache->lock);
+    map_result(streams) known = map_get(cache->streams, &key);
+    pthread_mutex_unlock(&cache->lock);
+    return known.found ? known.value : NULL;
+}
+
+static int jump_cmp(const void *a, const void *b)
+{
+    size_t x = ((size_t*) a)[0], y = ((size_t*) b)[0];
+    return x < y ? -1 : x > y;
+}
+
+// The directive at i, if a line starts there.
+static T directive_at(vec(token) *tokens, size_t i)
+{
+    Token *t = vec_get(tokens, i);
+    if (t->type != T_SHARP || !(t->fposition & fatbol) || (t->fposition & fnewline)) {
+        return TOKEN_EOF;
+    }
+    return vec_get(tokens, i + 1)->type;
+}
+
+// Links every #if, #elif and #else to the next directive of its #if.
+static void link_groups(TokenStream *stream)
+{
+    vec(token) *tokens = &stream->tokens;
+    vec(u32) *open = vec_new(u32);
+    size_t *pairs = NULL, npairs = 0, alloc = 0;
+
+    for (size_t i = 0; i + 1 < vec_size(tokens); i += 1) {
+        T type = directive_at(tokens, i);
+        int opens = type == PT_HIF || type == PT_HIFDEF || type == PT_HIFNDEF;
+        int goes_on = type == PT_HELIF || type == PT_HELSE || type == PT_HENDIF;
+        if (goes_on && !vec_is_empty(open)) {
+            if (npairs == alloc) {
+                alloc = alloc ? alloc * 2 : 64;
+                pairs = cc_realloc(pairs, sizeof(size_t) * 2 * alloc);
+            }
+            pairs[2 * npairs] = vec_pop_back(open);
+            pairs[2 * npairs + 1] = i;
+            npairs += 1;
+        }
+        if (opens || (goes_on && type != PT_HENDIF)) {
+            vec_push_back(open, (unsigned) i);
+        }
+    }
+
+    if (npairs) {
+        qsort(pairs, npairs, sizeof(size_t) * 2, &jump_cmp);
+    }
+    stream->njumps = npairs;
+    stream->jump_from = npairs ? cc_malloc(sizeof(size_t) * npairs) : NULL;
+    stream->jump_to = npairs ? cc_malloc(sizeof(size_t) * npairs) : NULL;
+    for (size_t i = 0; i < npairs; i += 1) {
+        stream->jump_from[i] = pairs[2 * i];
+        stream->jump_to[i] = pairs[2 * i + 1];
+    }
+    cc_free(&pairs);
+    cc_free(&open->data);
+    cc_free(&open);
+}
+
+TokenStream* tokcache_put(TokenCache *cache, FileData *data, vec(token) *tokens)
+{
+    TokenStream *stream = cc_malloc(sizeof(TokenStream));
+    *stream = stream_key(data);
+    stream->tokens = *tokens;
+    link_groups(stream);
+
+    pthread_mutex_lock(&cache->lock);
+    map_result(streams) known = map_get(cache->streams, stream);
+    if (known.found) {
+        pthread_mutex_unlock(&cache->lock);
+        cc_free(&stream->jump_from);
+        cc_free(&stream->jump_to);
+        cc_free(&stream);
+        return known.value;
+    }
+    map_put(cache->streams, stream, stream);
+    pthread_mutex_unlock(&cache->lock);
+    return stream;
+}
+
+size_t tokstream_skip(TokenStream *stream, size_t at)
+{
+    size_t lo = 0, hi = stream->njumps;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (stream->jump_from[mid] < at) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo < stream->njumps && stream->jump_from[lo] == at) {
+        return stream->jump_to[lo];
+    }
+    return vec_size(&stream->tokens) - 1;
+}
+
+Strtox* tokcache_number(TokenCache *cache, char *spelling, size_t len)
+{
+    pthread_mutex_lock(&cache->lock);
+    map_result(numbers) known = map_get(cache->numbers, spelling);
+    if (known.found) {
+        pthread_mutex_unlock(&cache->lock);
+        return known.value;
+    }
+
+    // the slices of the result point into the key, so the key has to be ours
+    char *key = cc_strdup(spelling);
+    Strtox *number = cc_malloc(sizeof(Strtox));
+    parse_number_checked(number, key, len);
+    map_put(cache->numbers, key, number);
+    pthread_mutex_unlock(&cache->lock);
+    return number;
+}
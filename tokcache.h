@@ -0,0 +1,64 @@
+#ifndef TOKCACHE_H_
+#define TOKCACHE_H_
+
+#include "drcc.h"
+#include "filecache.h"
+
+// The tokens of the files read, kept to be read again.
+//
+// What a file lexes to does not depend on where it is included, only on
+// its contents, and on the table its names are interned in: the tokens
+// point to the Idents, so a cache goes with one table of names. A stream
+// is the whole file, the groups of every #if included, and is never
+// written to once it is in the cache: it is read in place, by any number
+// of scans at a time.
+//
+// A group that is not taken is skipped by a jump: every conditional
+// directive knows where the next one of its #if is.
+//
+// The numbers the tokens are evaluated to (Token::number) are kept here
+// as well, one per spelling: a stream outlives the context that lexed it.
+
+typedef struct TokenStream TokenStream;
+typedef struct TokenCache TokenCache;
+
+map_proto(struct TokenStream*, struct TokenStream*, streams);
+
+struct TokenStream {
+    uint64_t dev, ino, size, hash;
+
+    vec(token) tokens; // up to the EOF_TOKEN_ENTRY
+    size_t *jump_from, *jump_to; // by the index of the '#', sorted by jump_from
+    size_t njumps;
+};
+
+struct TokenCache {
+    pthread_mutex_t lock;
+    map(streams) *streams;
+    map(numbers) *numbers; // by spelling, that the Strtox slices point into
+};
+
+TokenCache* tokcache_new();
+
+/// Frees the cache and its streams, and sets *cache to NULL. The Tokens
+/// are not freed: they are never, whoever made them.
+void tokcache_free(TokenCache **cache);
+
+/// The tokens of the file, NULL when they are not there yet.
+TokenStream* tokcache_get(TokenCache *cache, FileData *data);
+
+/// Takes the tokens of the file, and gives the stream that is in the cache:
+/// another one, when someone else has put it first, and then the tokens
+/// are still the caller's, to free.
+TokenStream* tokcache_put(TokenCache *cache, FileData *data, vec(token) *tokens);
+
+/// The number the spelling (len chars of it) is, evaluated by the first
+/// to ask, and shared with every other; see parse_number_checked().
+Strtox* tokcache_number(TokenCache *cache, char *spelling, size_t len);
+
+/// Where the group that starts at the directive at index 'at' ends:
+/// the index of the '#' of its #elif, #else or #endif, or of the end
+/// of the file when there is none.
+size_t tokstream_skip(TokenStream *stream, size_t at);
+
+#endif /* TOKCACHE_H_ */
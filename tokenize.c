@@ -1,66 +1,220 @@
-#include "drcc.h"
+#include "tokenize.h"
+#include "ppexpr.h"
+#include "incpath.h"
+#include "tokcache.h"
+#include "tokfile.h"
+#include "macsnap.h"
 #include "tests.h"
 
-typedef struct Context {
+struct Context {
     char *filename;
+    FileData *data; // what buffer reads, from filecache_global()
     CharBuf *buffer;
-    map(idents) *ident_hash;
+    IdentTable *idents;
+    int owns_idents; // and tokcache, or shares them with other contexts, on other threads
+    TokenCache *tokcache; // of the files whose names are in idents
     map(operators) *operators;
     vec(token) *tokenlist;
-} Context;
+    int eof; // tokenize_region() has given the last region
+
+    // evaluate pp-numbers while scanning them, see Token::number
+    int eval_numbers;
+    map(numbers) *numbers;
+};
+
+static void ctx_open(Context *ctx, char *filename)
+{
+    ctx->filename = filename;
+    ctx->data = filecache_get(filecache_global(), filename);
+    if (ctx->data == NULL) {
+        cc_fatal("cannot read %s\n", filename);
+    }
+    ctx->buffer = charbuf_wrap(ctx->data->buf, ctx->data->len);
+}
+
+// A context with names and a token cache of its own, or with the ones
+// given when they are not NULL: its Idents are then the ones of every
+// context that shares them, and can be compared with theirs, and a file
+// lexed by one of them is not lexed again by the others.
+static Context* context_in(char *filename, IdentTable *idents, TokenCache *tokcache)
+{
+    assert(filename);
+
+    Context *ctx = cc_malloc(sizeof(struct Context));
+    ctx_open(ctx, filename);
+    ctx->owns_idents = idents == NULL;
+    ctx->idents = idents ? idents : identtable_new();
+    ctx->tokcache = tokcache ? tokcache : tokcache_new();
+    ctx->operators = ops_map();
+    ctx->tokenlist = vec_new(token);
+    ctx->eof = 0;
+    ctx->eval_numbers = 0;
+    ctx->numbers = make_numbers_map();
+    return ctx;
+}
 
 Context* make_context(char *filename)
+{
+    return context_in(filename, NULL, NULL);
+}
+
+Context* make_shared_context(char *filename, IdentTable *idents, TokenCache *tokcache)
+{
+    assert(idents);
+    assert(tokcache);
+    return context_in(filename, idents, tokcache);
+}
+
+void context_eval_numbers(Context *ctx, int eval)
+{
+    ctx->eval_numbers = eval;
+}
+
+// A file included from the one ctx reads: the names, and what has
+// been made of them, are shared.
+Context* make_include_context(Context *includer, char *filename)
 {
     assert(filename);
 
     Context *ctx = cc_malloc(sizeof(struct Context));
-    ctx->filename = filename;
-    ctx->buffer = charbuf_new(hb_readfile2(filename));
-    ctx->ident_hash = make_idents_map();
-    ctx->operators = make_ops_map();
+    *ctx = *includer;
+    ctx_open(ctx, filename);
     ctx->tokenlist = vec_new(token);
+    ctx->eof = 0;
     return ctx;
 }
 
+// Done with the file: its contents may go.
+void context_close(Context *ctx)
+{
+    if (ctx->data) {
+        filecache_release(filecache_global(), ctx->data);
+        ctx->data = NULL;
+    }
+    cc_free(&ctx->buffer);
+}
+
+// Done with a context from make_context(), and with everything made from
+// it: the names, when they are its own, the numbers and the token streams
+// go, and no token it gave is to be used after. A process that reads file after file gives
+// all that back between them.
+void context_free(Context **ctx)
+{
+    assert(ctx);
+
+    Context *c = *ctx;
+    if (c == NULL) {
+        return;
+    }
+    context_close(c);
+    if (c->owns_idents) {
+        identtable_free(&c->idents);
+        tokcache_free(&c->tokcache);
+    }
+
+    map_entry(numbers) *e;
+    map_foreach(c->numbers, e) {
+        cc_free(&e->key);
+    }
+    map_destroy(c->numbers);
+
+    cc_free(&c->tokenlist->data);
+    cc_free(&c->tokenlist);
+    cc_free(ctx);
+}
+
 // markers
 static Token WSP_TOKEN = { };
 static Token EOL_TOKEN = { };
 
 static Ident* ctx_make_ident(Context *ctx, char *name);
 static Token* parse_ident_token(Context *ctx);
+static Token* ctx_place_token(Context *ctx, T type, char *value);
 static Token* ctx_make_token(Context *ctx, T type, char *value);
+static Strtox* ctx_make_number(Context *ctx, char *spelling, size_t len);
 
 static Ident* ctx_make_ident(Context *ctx, char *name)
 {
-    map_result(idents) opt = map_get(ctx->ident_hash, name);
-    if (opt.found) {
-        return opt.value;
-    }
-    Ident *newid = cc_malloc(sizeof(struct Ident));
-    newid->name = cc_strdup(name);
-    map_put(ctx->ident_hash, name, newid);
-    return newid;
+    return ident_intern(ctx->idents, name);
 }
 
-static Token* ctx_make_token(Context *ctx, T type, char *value)
+// The token ends where the buffer is; it takes value as it is, which
+// has to outlive it.
+static Token* ctx_place_token(Context *ctx, T type, char *value)
 {
     assert(value);
 
-    Token *token = token_new(type, value);
+    Token *token = cc_malloc(sizeof(struct Token));
+    token->type = type;
+    token->value = value;
     CharBuf *buffer = ctx->buffer;
     assert(buffer);
 
     int column = (buffer->column - strlen(token->value)) + 1;
+    token->pos.filename = ctx->filename;
     token->pos.line = buffer->line;
     token->pos.column = column;
 
     return token;
 }
 
+static Token* ctx_make_token(Context *ctx, T type, char *value)
+{
+    assert(value);
+    return ctx_place_token(ctx, type, cc_strdup(value));
+}
+
+// One evaluated constant per distinct spelling: '0', '1', '0xff' are
+// evaluated once, by the first context of the token cache to meet them,
+// and then it's just a lookup, in the context's own map first, with no lock.
+// The constants are the cache's: the tokens in its streams point to them.
+// The spelling that is not a valid constant ('1.2.3', '0xg') is still
+// a valid pp-number; it's cached as it's parsed: with the EVALTYPE_ERROR
+// when it's not a number at all ('0xg', '1e'), or with the INTTYPE_ERROR
+// and FLTTYPE_ERROR when the suffix is wrong ('1.2.3' is a FLOATING_10
+// with the suffix '.3').
+static Strtox* ctx_make_number(Context *ctx, char *spelling, size_t len)
+{
+    map_result(numbers) opt = map_get(ctx->numbers, spelling);
+    if (opt.found) {
+        return opt.value;
+    }
+
+    Strtox *number = tokcache_number(ctx->tokcache, spelling, len);
+    map_put(ctx->numbers, cc_strdup(spelling), number);
+    return number;
+}
+
 static Token* parse_ident_token(Context *ctx)
 {
     CharBuf *buf = ctx->buffer;
 
+    // A name with no line joined in it is looked up where it is, and the
+    // buffer is moved past it as charbuf_nextc() would: the token has the
+    // spelling of the Ident, and nothing is copied.
+    char *at = buf->buf + buf->offset;
+    size_t left = buf->size - buf->offset;
+    if (left && is_letter(at[0])) {
+        size_t n = 1;
+        while (n < left && (is_letter(at[n]) || is_dec(at[n]))) {
+            n += 1;
+        }
+        if (n == left || at[n] != '\\') {
+            if (buf->prevc == '\n') {
+                buf->line++;
+                buf->column = 0;
+            }
+            buf->offset += n;
+            buf->column += n;
+            buf->prevc = at[n - 1];
+
+            Ident *ident = ident_intern_slice(ctx->idents, at, n);
+            Token *tok = ctx_place_token(ctx, TOKEN_IDENT, ident->name);
+            tok->ident = ident;
+            return tok;
+        }
+    }
+
     Str sb = STR_INIT;
     sb_addc(&sb, (char) charbuf_nextc(buf));
 
@@ -76,9 +230,11 @@ static Token* parse_ident_token(Context *ctx)
     assert(sb.size);
     char *buffer = sb.data;
 
-    Token *tok = ctx_make_token(ctx, TOKEN_IDENT, buffer);
-    tok->ident = ctx_make_ident(ctx, buffer);
+    Ident *ident = ctx_make_ident(ctx, buffer);
+    Token *tok = ctx_place_token(ctx, TOKEN_IDENT, ident->name);
+    tok->ident = ident;
 
+    cc_free(&sb.data);
     return tok;
 }
 
@@ -108,11 +264,6 @@ static Token* parse_pp_number(Context *ctx)
         int c1 = chars[0];
         int c2 = chars[1];
 
-        if (is_dec(c1) || is_letter(c1) || c1 == '.') {
-            sb_addc(&strbuf, charbuf_nextc(buf));
-            continue;
-        }
-
         if (c1 == 'e' || c1 == 'E' || c1 == 'p' || c1 == 'P') {
             sb_addc(&strbuf, charbuf_nextc(buf));
             if (c2 == '-' || c2 == '+') {
@@ -121,6 +272,11 @@ static Token* parse_pp_number(Context *ctx)
             continue;
         }
 
+        if (is_dec(c1) || is_letter(c1) || c1 == '.') {
+            sb_addc(&strbuf, charbuf_nextc(buf));
+            continue;
+        }
+
         if (c1 == '\'' && (is_dec(c2) || is_letter(c2))) {
             charbuf_nextc(buf); // just skip this tick
             continue;
@@ -129,14 +285,22 @@ static Token* parse_pp_number(Context *ctx)
         break;
     }
 
-    return ctx_make_token(ctx, TOKEN_NUMBER, strbuf.data);
+    Token *tok = ctx_make_token(ctx, TOKEN_NUMBER, strbuf.data);
+    if (ctx->eval_numbers) {
+        tok->number = ctx_make_number(ctx, tok->value, strbuf.size);
+    }
+    return tok;
 
 }
 
+// A quote that is not closed on its line is a token of its own: that is
+// what it is in a group that is not taken, in #error, and in a comment
+// that the lexer is not told about.
 static Token* parse_string_token(Context *ctx, enum string_encoding enc)
 {
     CharBuf *buffer = ctx->buffer;
     assert(buffer);
+    CharBuf start = *buffer;
 
     int endof = charbuf_nextc(buffer);
     T typeoftok = (endof == '\'') ? TOKEN_CHAR : TOKEN_STRING;
@@ -146,11 +310,12 @@ static Token* parse_string_token(Context *ctx, enum string_encoding enc)
 
     for (;;) {
         int next1 = charbuf_nextc(buffer);
-        if (next1 == HC_FEOF) {
-            cc_fatal("%s\n", "unexpected EOF at the middle of the string");
-        }
-        if (next1 == '\n') {
-            cc_fatal("%s\n", "unexpected LF at the middle of the string");
+        if (next1 == HC_FEOF || next1 == '\n') {
+            *buffer = start;
+            charbuf_nextc(buffer);
+            cc_free(&sb.data);
+            char lone[] = { (char) endof, '\0' };
+            return ctx_make_token(ctx, TOKEN_ERROR, lone);
         }
         if (next1 == endof) {
             break;
@@ -239,44 +404,21 @@ Token* nex2(Context *ctx)
     }
 
     if (is_op_start(c1)) {
-        char buf4[] = { c1, c2, c3, c4, '\0' };
-        char buf3[] = { c1, c2, c3, '\0' };
-        char buf2[] = { c1, c2, '\0' };
-        char buf1[] = { c1, '\0' };
-
-        map_result(operators) type4 = map_get(ctx->operators, buf4);
-        map_result(operators) type3 = map_get(ctx->operators, buf3);
-        map_result(operators) type2 = map_get(ctx->operators, buf2);
-        map_result(operators) type1 = map_get(ctx->operators, buf1);
-
-        if (type4.found) {
-            charbuf_nextc(buf);
-            charbuf_nextc(buf);
-            charbuf_nextc(buf);
-            charbuf_nextc(buf);
-
-            return ctx_make_token(ctx, type4.value, buf4);
-        }
-        if (type3.found) {
-            charbuf_nextc(buf);
-            charbuf_nextc(buf);
-            charbuf_nextc(buf);
-
-            return ctx_make_token(ctx, type3.value, buf3);
-        }
-        if (type2.found) {
-            charbuf_nextc(buf);
-            charbuf_nextc(buf);
-
-            return ctx_make_token(ctx, type2.value, buf2);
-        }
-        if (type1.found) {
-            charbuf_nextc(buf);
-
-            return ctx_make_token(ctx, type1.value, buf1);
+        // the longest operator the chars start with
+        char op[] = { c1, c2, c3, c4, '\0' };
+        for (size_t n = 4; n > 0; n -= 1) {
+            Slice key = slice_new(op, n);
+            map_result(operators) type = map_get(ctx->operators, &key);
+            if (type.found) {
+                for (size_t i = 0; i < n; i += 1) {
+                    charbuf_nextc(buf);
+                }
+                op[n] = '\0';
+                return ctx_make_token(ctx, type.value, op);
+            }
         }
 
-        cc_fatal("Unrecognized operator sequence: [%s]\n", buf4);
+        cc_fatal("Unrecognized operator sequence: [%s]\n", op);
     }
 
     if (is_letter(c1)) {
@@ -287,7 +429,8 @@ Token* nex2(Context *ctx)
     }
 
     char otherascii[] = { c1, '\0' };
-    map_result(operators) perhaps = map_get(ctx->operators, otherascii);
+    Slice key = slice_new(otherascii, 1);
+    map_result(operators) perhaps = map_get(ctx->operators, &key);
     if (perhaps.found) {
         charbuf_nextc(buf); // XXX
         return ctx_make_token(ctx, perhaps.value, otherascii);
@@ -300,35 +443,68 @@ Token* nex2(Context *ctx)
     return ctx_make_token(ctx, TOKEN_ERROR, unknown);
 }
 
-void tokenize_context(Context *ctx)
+// The lines up to and including the next directive line, or up to the end
+// of the file. The directive decides what is lexed next: a group that is
+// not taken is skipped in the buffer, and never becomes tokens.
+// The name of a directive is told from an identifier here, once: what is
+// lexed is not changed later, and may be read by any number of scans.
+// Every region is a list of its own, so what points into the earlier
+// ones stays good.
+static void mark_directive(vec(token) *line)
+{
+    if (vec_size(line) == 1) {
+        vec_get(line, 0)->type = PT_HEOL;
+        return;
+    }
+    Token *pp = vec_get(line, 1);
+    if (pp->type != TOKEN_IDENT) {
+        return;
+    }
+    const IdentClass *class = ident_class(pp->ident);
+    if (class->flags & IDENT_DIRECTIVE) {
+        pp->type = class->directive;
+    }
+}
+
+vec(token)* tokenize_region(Context *ctx)
 {
+    vec(token) *region = vec_new(token);
     vec(token) line = VEC_INIT(token);
     int nextws = 0;
 
     for (;;) {
         Token *t = nex2(ctx);
-        if (t == EOF_TOKEN_ENTRY) {
-            vec_add_all(ctx->tokenlist, &line);
-            vec_push_back(ctx->tokenlist, t);
-            break;
-        }
-        if (nextws) {
-            t->fposition |= fleadws;
+        if (nextws && t != EOF_TOKEN_ENTRY) {
+            // the markers are shared by every thread, and never written to
+            if (t != &EOL_TOKEN && t != &WSP_TOKEN) {
+                t->fposition |= fleadws;
+            }
             nextws = 0;
         }
-        if (t == &EOL_TOKEN) {
-            if (vec_is_empty(&line)) {
-                continue;
-            }
-            Token *first = vec_get(&line, 0);
-            Token *last = vec_get(&line, line.size - 1);
-            last->fposition |= fnewline;
-            first->fposition |= fatbol;
-            first->fposition |= fleadws;
-
-            vec_add_all(ctx->tokenlist, &line);
-            vec_reset(&line);
+        if (t == &EOL_TOKEN || t == EOF_TOKEN_ENTRY) {
+            int directive = 0;
+            if (!vec_is_empty(&line)) {
+                Token *first = vec_get(&line, 0);
+                Token *last = vec_get(&line, line.size - 1);
+                last->fposition |= fnewline;
+                first->fposition |= fatbol;
+                first->fposition |= fleadws;
+                directive = first->type == T_SHARP;
+                if (directive) {
+                    mark_directive(&line);
+                }
 
+                vec_add_all(region, &line);
+                vec_reset(&line);
+            }
+            if (t == EOF_TOKEN_ENTRY) {
+                vec_push_back(region, t);
+                ctx->eof = 1;
+                break;
+            }
+            if (directive) {
+                break;
+            }
             continue;
         }
 
@@ -339,6 +515,130 @@ void tokenize_context(Context *ctx)
 
         vec_push_back(&line, t);
     }
+    return region;
+}
+
+void tokenize_context(Context *ctx)
+{
+    while (!ctx->eof) {
+        vec_add_all(ctx->tokenlist, tokenize_region(ctx));
+    }
+}
+
+static int is_ident_char(int c)
+{
+    return is_letter(c) || is_dec(c);
+}
+
+static int is_directive(char *at, char *end, char *name)
+{
+    size_t len = strlen(name);
+    return (size_t) (end - at) >= len && !strncmp(at, name, len) && !is_ident_char(at[len]);
+}
+
+// The rest of a line that has a '/' in it: literals are passed over, so
+// that what they hold is not taken for a comment, and a comment may end
+// lines below. Returns where the line ends, counting the lines passed.
+static char* skip_line_slow(char *p, char *end, size_t *lines)
+{
+    while (p < end && *p != '\n') {
+        char c = *p;
+        if (c == '"' || c == '\'') {
+            for (p += 1; p < end && *p != c && *p != '\n'; p += 1) {
+                if (*p == '\\' && p + 1 < end && p[1] != '\n') {
+                    p += 1;
+                }
+            }
+            if (p < end && *p == c) {
+                p += 1;
+            }
+            continue;
+        }
+        if (c == '/' && p + 1 < end && p[1] == '/') {
+            char *nl = memchr(p, '\n', end - p);
+            return nl ? nl : end;
+        }
+        if (c == '/' && p + 1 < end && p[1] == '*') {
+            char *q = p + 2;
+            for (;;) {
+                q = memchr(q, '*', end - q);
+                if (q == NULL || (q + 1 < end && q[1] == '/')) {
+                    break;
+                }
+                q += 1;
+            }
+            char *close = q ? q + 2 : end;
+            for (char *nl = memchr(p, '\n', close - p); nl; nl = memchr(nl + 1, '\n', close - nl - 1)) {
+                *lines += 1;
+            }
+            p = close;
+            continue;
+        }
+        p += 1;
+    }
+    return p;
+}
+
+// Skips a group that is not taken without making tokens of it: only line
+// starts, comments and literals matter, and most lines are just looked
+// for their end and for a '/'. Stops at the start of the #elif, #else or
+// #endif line of this group, or at the end of the file.
+void skip_group(Context *ctx)
+{
+    CharBuf *buf = ctx->buffer;
+    char *p = buf->buf + buf->offset;
+    char *end = buf->buf + buf->size;
+    size_t lines = 0;
+    int depth = 0;
+
+    while (p < end) {
+        char *line = p;
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\f')) {
+            p += 1;
+        }
+        if (p < end && *p == '#') {
+            p += 1;
+            while (p < end && (*p == ' ' || *p == '\t')) {
+                p += 1;
+            }
+            if (is_directive(p, end, "if") || is_directive(p, end, "ifdef") || is_directive(p, end, "ifndef")) {
+                depth += 1;
+            } else if (is_directive(p, end, "endif")) {
+                if (depth == 0) {
+                    p = line;
+                    break;
+                }
+                depth -= 1;
+            } else if (depth == 0 && (is_directive(p, end, "elif") || is_directive(p, end, "else"))) {
+                p = line;
+                break;
+            }
+        }
+
+        // to the end of the line, and of the lines joined to it
+        for (;;) {
+            char *nl = memchr(p, '\n', end - p);
+            char *eol = nl ? nl : end;
+            if (memchr(p, '/', eol - p)) {
+                eol = skip_line_slow(p, end, &lines);
+            }
+            if (eol == end) {
+                p = end;
+                break;
+            }
+            lines += 1;
+            p = eol + 1;
+            int joined = (eol > buf->buf && eol[-1] == '\\')
+                    || (eol > buf->buf + 1 && eol[-1] == '\r' && eol[-2] == '\\');
+            if (!joined) {
+                break;
+            }
+        }
+    }
+
+    buf->offset = p - buf->buf;
+    buf->line += lines;
+    buf->column = 0;
 }
 
 vec(token)* tokenize(Context *ctx)
@@ -347,198 +647,2327 @@ vec(token)* tokenize(Context *ctx)
     return ctx->tokenlist;
 }
 
-typedef struct Scan {
+// A piece of a replacement list waiting to be rescanned.
+// The tokens belong to the macro definition and are shared by all of its
+// expansions, so they are never written to: the hide set of the expansion
+// is kept here, and a token is copied only when it has to be changed.
+typedef struct Span {
+    Token **base;
+    size_t begin, end;
+    HideSet *hs;
+} Span;
+
+// The rescan stack: spans are stored in place, in fixed-size chunks,
+// so a push never moves or copies what is already there, and an expansion
+// of any length is one record. The chunk that gets empty is kept for the next push.
+#define SPAN_CHUNK (64)
+
+typedef struct SpanChunk {
+    Span spans[SPAN_CHUNK];
+    size_t size;
+    struct SpanChunk *prev;
+} SpanChunk;
+
+typedef struct SpanStack {
+    SpanChunk *top;
+    SpanChunk *spare;
+    size_t size;
+} SpanStack;
+
+static Span* spans_push(SpanStack *st)
+{
+    SpanChunk *top = st->top;
+    if (top == NULL || top->size == SPAN_CHUNK) {
+        SpanChunk *chunk = st->spare;
+        if (chunk) {
+            st->spare = NULL;
+        } else {
+            chunk = cc_malloc(sizeof(SpanChunk));
+        }
+        chunk->size = 0;
+        chunk->prev = top;
+        st->top = top = chunk;
+    }
+    st->size += 1;
+    return &top->spans[top->size++];
+}
+
+static Span* spans_peek(SpanStack *st)
+{
+    assert(st->size);
+    return &st->top->spans[st->top->size - 1];
+}
+
+static void spans_pop(SpanStack *st)
+{
+    assert(st->size);
+    SpanChunk *top = st->top;
+    st->size -= 1;
+    top->size -= 1;
+    if (top->size == 0) {
+        st->top = top->prev;
+        if (st->spare) {
+            cc_free(&st->spare);
+        }
+        st->spare = top;
+    }
+}
+
+// Pre-expanded arguments, remembered across calls. A slot is good while
+// no macro has been defined or undefined since it was filled: the
+// expansion of a run of tokens depends on nothing else.
+#define ARGCACHE_SIZE (1024)
+
+typedef struct ArgCacheSlot {
+    size_t hash;
+    unsigned generation;
+    Span raw;
+    Span expanded;
+} ArgCacheSlot;
+
+// The #if and #elif lines met so far, by where they are. The program
+// compiled from a line as it is written stays good; when it cannot be
+// evaluated, the value of the expanded line is kept instead, along with
+// the definitions of the names its expansion looked up.
+#define CONDCACHE_SIZE (256)
+
+typedef struct CondCacheSlot {
+    char *filename;
+    int line;
+    PpExpr *expr; // NULL when the line is not an expression as it is
+    int value;
+    vec(ident) *deps; // NULL when there is no value
+    vec(sym) *meant; // what deps were defined as, then
+} CondCacheSlot;
+
+// Where a file is in matching the pattern of an include guard:
+// #ifndef X as the first thing in it, and its #endif as the last.
+enum guard_state {
+    GUARD_START, GUARD_INSIDE, GUARD_AFTER, GUARD_NONE
+};
+
+// A file being included, and the state of its includer, put aside.
+typedef struct Include {
+    Context *ctx;
+    TokenStream *stream;
     vec(token) *tokens;
-    vec(token) *rescan;
     size_t size, offset;
-} Scan;
 
-Scan* scan_new(vec(token) *tokens)
+    SourceFile *file;
+    size_t conds; // the depth of Scan::conds at its start
+    enum guard_state guard;
+    Ident *guard_name;
+} Include;
+
+#define INCLUDE_DEPTH_MAX (200)
+
+// The state of an #if group, in Scan::conds
+#define COND_TAKEN (1u << 0u) // one of its branches has been taken
+#define COND_ELSE  (1u << 1u) // #else has been seen
+
+struct Scan {
+    Context *ctx;
+    TokenStream *stream; // what tokens is, when the whole file is there
+    vec(token) *tokens; // the current region of the source
+    size_t directive_at; // where the '#' of the directive done last is in tokens
+    Token *source_at; // the token taken from the source last, NULL before the first
+    SpanStack rescan;
+    size_t size, offset;
+    vec(u32) *conds;
+    HideSets *hidesets;
+    HideSet *hs; // the hide set of the token popped last
+    Macros *defs; // what the names are defined as
+    unsigned macros; // the last PpSym::id given
+    unsigned generation; // bumped by every #define and #undef
+    ArgCacheSlot *argcache;
+    CondCacheSlot *condcache;
+
+    // While a macro is flattened or an argument is pre-expanded, the spans
+    // below floor and the source are out of reach. While flattening, the
+    // names looked up and the macros expanded are collected; the expansion
+    // of an #if line is counted as flattening for that.
+    size_t floor;
+    unsigned isolated;
+    unsigned flattening;
+    vec(ident) *deps;
+    HideSet *uses;
+
+    // # and ##: the spelling is built in scratch, and a paste is lexed
+    // from there by the paster, which shares the names with ctx.
+    // What a spelling lexes to is kept in pasted.
+    Str scratch;
+    CharBuf pastebuf;
+    Context paster;
+    map(pastes) *pasted;
+
+    // The pieces of an expansion built token by token, before they go
+    // on the rescan stack. A piece with no base is in the expansion's own list.
+    Span *segs;
+    size_t nsegs, segs_alloc;
+
+    // The files being included, the innermost on top. A file seen once
+    // is known by its identity; when it is all inside an include guard
+    // that is still defined, or has #pragma once, it is not read again.
+    Include *includes;
+    size_t nincludes, includes_alloc;
+    IncludePaths *paths;
+
+    // For a snapshot of the macros: every file read.
+    SnapFile *read;
+    size_t nread, read_alloc;
+};
+
+static void scan_read(Scan *s, SnapFile read)
 {
-    Scan *s = cc_malloc(sizeof(Scan));
-    s->tokens = tokens;
-    s->rescan = vec_new(token);
+    if (s->nread == s->read_alloc) {
+        s->read_alloc = s->read_alloc ? s->read_alloc * 2 : 16;
+        s->read = cc_realloc(s->read, sizeof(SnapFile) * s->read_alloc);
+    }
+    read.path = cc_strdup(read.path);
+    s->read[s->nread++] = read;
+}
 
-    s->size = vec_size(tokens);
+// The file ctx reads, as the file system knows it.
+static SnapFile ctx_read(Context *ctx, SourceFile *file)
+{
+    FileData *data = ctx->data;
+    return (SnapFile) {
+        .path = ctx->filename, .file = file, .dev = data->dev, .ino = data->ino, .size = data->size,
+        .mtime_sec = data->mtime_sec, .mtime_nsec = data->mtime_nsec
+    };
+}
+
+Scan* scan_new(Context *ctx)
+{
+    Scan *s = cc_malloc(sizeof(Scan));
+    s->ctx = ctx;
+    s->stream = NULL;
+    s->tokens = tokenize_region(ctx);
+    s->directive_at = 0;
+    s->source_at = NULL;
+    s->conds = vec_new(u32);
+    s->rescan = (SpanStack) { .top = NULL, .spare = NULL, .size = 0 };
+    s->hidesets = hidesets_new();
+    s->hs = NULL;
+    s->defs = macros_new();
+    s->macros = 0;
+    s->generation = 1;
+    s->argcache = cc_malloc(sizeof(ArgCacheSlot) * ARGCACHE_SIZE);
+    s->condcache = cc_malloc(sizeof(CondCacheSlot) * CONDCACHE_SIZE);
+    s->floor = 0;
+    s->isolated = 0;
+    s->flattening = 0;
+    s->deps = vec_new(ident);
+    s->uses = NULL;
+
+    s->scratch = (Str) STR_INIT;
+    s->paster = *ctx;
+    s->paster.buffer = &s->pastebuf;
+    s->pasted = make_pastes_map();
+    s->segs = NULL;
+    s->nsegs = s->segs_alloc = 0;
+
+    s->includes = NULL;
+    s->nincludes = s->includes_alloc = 0;
+    s->paths = incpaths_new();
+
+    s->read = NULL;
+    s->nread = s->read_alloc = 0;
+    scan_read(s, ctx_read(ctx, NULL));
+
+    s->size = vec_size(s->tokens);
     s->offset = 0;
     return s;
 }
 
+// The directories searched for #include, in order.
+void scan_add_include_dir(Scan *s, char *dir)
+{
+    incpaths_add_dir(s->paths, dir);
+}
+
+static void scan_leave(Scan *s);
+
+// The next region is lexed only when the one before it is used up, that is,
+// after its directive is done with. The end of an included file is not
+// seen: the includer goes on from there.
 int scan_has_tokens(Scan *s)
 {
-    return s->offset < s->size;
+    for (;;) {
+        if (s->offset < s->size) {
+            if (s->nincludes == 0 || vec_get(s->tokens, s->offset)->type != TOKEN_EOF) {
+                return 1;
+            }
+            scan_leave(s);
+            continue;
+        }
+        if (s->ctx->eof) {
+            return 0;
+        }
+        s->tokens = tokenize_region(s->ctx);
+        s->size = vec_size(s->tokens);
+        s->offset = 0;
+    }
 }
 
 int scan_is_empty(Scan *s)
 {
+    if (s->isolated) {
+        return s->rescan.size <= s->floor;
+    }
     if (scan_has_tokens(s)) {
         return 0;
     }
-    if (!vec_is_empty(s->rescan)) {
+    if (s->rescan.size) {
         return 0;
     }
     return 1;
 }
 
-Token* scan_pop_noppdirective(Scan *s)
+static void scan_push(Scan *s, Token **base, size_t begin, size_t end, HideSet *hs)
+{
+    if (begin == end) {
+        return;
+    }
+    Span *span = spans_push(&s->rescan);
+    span->base = base;
+    span->begin = begin;
+    span->end = end;
+    span->hs = hs;
+}
+
+void scan_push_span(Scan *s, vec(token) *list, size_t begin, size_t end, HideSet *hs)
+{
+    scan_push(s, list->data, begin, end, hs);
+}
+
+// The next token, left where it is.
+static Token* scan_peek(Scan *s)
 {
-    if (!vec_is_empty(s->rescan)) {
-        return vec_pop_back(s->rescan);
+    size_t left = s->rescan.size - s->floor;
+    for (SpanChunk *chunk = s->rescan.top; chunk && left; chunk = chunk->prev) {
+        for (size_t k = chunk->size; k-- > 0 && left; left--) {
+            Span *span = &chunk->spans[k];
+            for (size_t i = span->begin; i < span->end; i += 1) {
+                if (span->base[i]->type != T_SPEC_PLACEMARKER) {
+                    return span->base[i];
+                }
+            }
+        }
     }
-    if (s->offset >= s->size) {
+    if (s->isolated || !scan_has_tokens(s)) {
         return EOF_TOKEN_ENTRY;
     }
-    Token *t = vec_get(s->tokens, s->offset);
-    s->offset += 1;
-    return t;
+    return vec_get(s->tokens, s->offset);
 }
 
-Token* scan_pop(Scan *s)
+// Whether the '(' ahead is closed before the floor. While isolated,
+// a call that goes on past what is in reach is left alone.
+static int scan_call_in_reach(Scan *s)
 {
-    Token *t = scan_pop_noppdirective(s);
-    if (t->type == T_SHARP && (t->fposition & fatbol)) {
-        if (t->fposition & fnewline) {
-            t->type = PT_HEOL;
-            return t;
+    size_t left = s->rescan.size - s->floor, depth = 0;
+    for (SpanChunk *chunk = s->rescan.top; chunk && left; chunk = chunk->prev) {
+        for (size_t k = chunk->size; k-- > 0 && left; left--) {
+            Span *span = &chunk->spans[k];
+            for (size_t i = span->begin; i < span->end; i += 1) {
+                T type = span->base[i]->type;
+                if (type == T_LEFT_PAREN) {
+                    depth += 1;
+                } else if (type == T_RIGHT_PAREN && --depth == 0) {
+                    return 1;
+                }
+            }
         }
-        Token *pp = scan_pop_noppdirective(s);
-        assert(pp->type == TOKEN_IDENT);
+    }
+    return 0;
+}
 
-        Ident *directive = pp->ident;
-        if (directive == define_ident) {
-            pp->type = PT_HDEFINE;
-        } else {
-            assert(0 && "todo!");
+// Pops one token, placemarkers included, and tells where it was,
+// so that a run of them can be kept as a Span instead of a copy.
+static Token* scan_pop_at(Scan *s, Span *at)
+{
+    if (s->rescan.size > s->floor) {
+        Span *top = spans_peek(&s->rescan);
+        Token *t = top->base[top->begin];
+        *at = (Span) { .base = top->base, .begin = top->begin, .end = top->begin + 1, .hs = top->hs };
+
+        top->begin += 1;
+        if (top->begin == top->end) {
+            spans_pop(&s->rescan);
         }
-        return pp;
+        s->hs = t->hideset ? hs_union(s->hidesets, at->hs, t->hideset) : at->hs;
+        return t;
     }
+    if (s->isolated || !scan_has_tokens(s)) {
+        return EOF_TOKEN_ENTRY;
+    }
+    *at = (Span) { .base = s->tokens->data, .begin = s->offset, .end = s->offset + 1, .hs = NULL };
+    Token *t = vec_get(s->tokens, s->offset);
+    s->offset += 1;
+    s->hs = t->hideset;
     return t;
 }
 
-vec(token)* paste_all(Token *head, vec(token) *repl);
-
-void replace_simple(Scan *s, Token *head, PpSym *macros)
+Token* scan_pop_noppdirective(Scan *s)
 {
-    assert(!macros->is_hidden);
-    macros->is_hidden = 1;
+    while (s->rescan.size > s->floor) {
+        Span *top = spans_peek(&s->rescan);
+        Token *t = top->base[top->begin++];
+        HideSet *hs = top->hs;
 
-    vec(token) *res = paste_all(head, macros->repl);
-
-    Token *tok = NULL;
-    vec_foreach_rev(res, tok)
-    {
-        if (tok->type == T_SPEC_PLACEMARKER) {
+        if (top->begin == top->end) {
+            spans_pop(&s->rescan);
+        }
+        if (t->type == T_SPEC_PLACEMARKER) {
             continue;
         }
-        vec_push_back(s->rescan, tok);
+
+        s->hs = t->hideset ? hs_union(s->hidesets, hs, t->hideset) : hs;
+        return t;
+    }
+    if (s->isolated || !scan_has_tokens(s)) {
+        return EOF_TOKEN_ENTRY;
     }
+    Token *t = vec_get(s->tokens, s->offset);
+    s->offset += 1;
+    s->hs = t->hideset;
+    return t;
 }
 
-vec(token)* paste_all(Token *head, vec(token) *repl)
+static Include* scan_include_top(Scan *s)
 {
-    vec(token) *rv = vec_new(token);
+    return s->nincludes ? &s->includes[s->nincludes - 1] : NULL;
+}
 
-    Token *tok = NULL;
-    vec_foreach(repl, tok)
-    {
-        Token *ntok = token_copy(tok);
-        vec_push_back(rv, ntok);
+// Something from the file being included that is not the opening
+// of its guard group, or is outside of it.
+static void guard_watch(Scan *s, T type)
+{
+    Include *inc = scan_include_top(s);
+    if (inc == NULL || inc->guard == GUARD_INSIDE || inc->guard == GUARD_NONE) {
+        return;
     }
-
-    return rv;
+    // whether an #if opens a guard group is up to dline_cond()
+    if (inc->guard == GUARD_START && (type == PT_HIFNDEF || type == PT_HIF)) {
+        return;
+    }
+    inc->guard = GUARD_NONE;
 }
 
-int unhide(Token *u)
+Token* scan_pop(Scan *s)
 {
-    if (u->type == T_SPEC_UNHIDE) {
-        assert(u->ident->sym->is_hidden);
-        u->ident->sym->is_hidden = 0;
-        return 1;
+    // a '#' that came out of a macro expansion is not a directive
+    int from_source = s->rescan.size == 0;
+
+    Token *t = scan_pop_noppdirective(s);
+    if (from_source && t->type == PT_HEOL) {
+        return t;
     }
-    return 0;
+    if (from_source && t->type == T_SHARP && (t->fposition & fatbol)) {
+        s->directive_at = s->offset - 1;
+        Token *pp = scan_pop_noppdirective(s);
+        if (!is_ppdirtype(pp->type)) {
+            assert(0 && "todo!");
+        }
+        guard_watch(s, pp->type);
+        return pp;
+    }
+    if (from_source && t->type != TOKEN_EOF) {
+        guard_watch(s, t->type);
+        s->source_at = t;
+    }
+    if (from_source && t->type == TOKEN_EOF && !vec_is_empty(s->conds)) {
+        cc_fatal("unterminated #if at the end of %s\n", s->ctx->filename);
+    }
+    return t;
 }
 
-int is_ppdirtype(T tp)
+// Object-like: the replacement is hidden by what the name was hidden by,
+// plus the macro itself. Nothing is copied: the list is pushed as a whole.
+void replace_simple(Scan *s, HideSet *hs, PpSym *macros)
 {
-#   define prepr(op, en) if(tp == en) { return 1; };
-#   include "ops"
-
-    return 0;
+    hs = hs_add(s->hidesets, hs, macros->id);
+    scan_push_span(s, macros->repl, 0, vec_size(macros->repl), hs);
 }
 
-vec(token)* scan_cut_line(Scan *s)
+Token* scan_get(Scan *s);
+
+static void note_uses(Scan *s, vec(ident) *deps, HideSet *uses)
 {
-    vec(token) *rv = vec_new(token);
+    if (s->flattening) {
+        vec_add_all(s->deps, deps);
+        s->uses = hs_union(s->hidesets, s->uses, uses);
+    }
+}
+
+// Expands the macro on its own, with nothing around it and hidden by
+// itself only. When every token that comes out is final, the result
+// does not depend on where the macro is used, and can be spliced
+// instead of expanding it again.
+static void flatten(Scan *s, PpSym *macros)
+{
+    size_t floor = s->floor;
+    size_t deps = vec_size(s->deps);
+    HideSet *uses = s->uses;
+
+    s->floor = s->rescan.size;
+    s->isolated += 1;
+    s->flattening += 1;
+    macros->flat_state = FLAT_BUSY;
+    s->uses = hs_add(s->hidesets, NULL, macros->id);
+    replace_simple(s, NULL, macros);
+
+    vec(token) *flat = vec_new(token);
+    enum flat_state state = FLAT_CLOSED;
+    for (;;) {
+        Token *t = scan_get(s);
+        if (t == EOF_TOKEN_ENTRY) {
+            break;
+        }
+        // in #if, what follows 'defined' is not expanded
+        if (t->type == TOKEN_IDENT && !t->noexpand && (macros_get(s->defs, t->ident) || t->ident == defined_ident)) {
+            state = FLAT_OPEN;
+        }
+        vec_push_back(flat, t);
+    }
+
+    s->floor = floor;
+    s->isolated -= 1;
+    s->flattening -= 1;
+
+    macros->flat_state = state;
+    macros->flat_uses = s->uses;
+    macros->flat_deps = vec_new(ident);
+    for (size_t i = deps; i < vec_size(s->deps); i += 1) {
+        Ident *id = vec_get(s->deps, i);
+        vec(sym) *users = macros_users(s->defs, id);
+        if (vec_is_empty(users) || users->data[users->size - 1] != macros) {
+            vec_push_back(users, macros);
+            vec_push_back(macros->flat_deps, id);
+        }
+    }
+    s->uses = hs_union(s->hidesets, uses, s->uses);
+    if (!s->flattening) {
+        vec_clear(s->deps);
+    }
+
+    if (state == FLAT_CLOSED) {
+        macros->flat = flat;
+    } else {
+        cc_free(&flat->data);
+        cc_free(&flat);
+    }
+}
+
+// The name is about to mean something else: forget what was built on it.
+static void invalidate(Scan *s, Ident *id)
+{
+    vec(sym) *users = id->id < s->defs->size ? s->defs->users[id->id] : NULL;
+    if (users == NULL) {
+        return;
+    }
+    PpSym *user = NULL;
+    vec_foreach(users, user)
+    {
+        if (user->flat) {
+            cc_free(&user->flat->data);
+            cc_free(&user->flat);
+        }
+        user->flat_state = FLAT_NONE;
+    }
+    vec_clear(users);
+}
+
+void replace_object(Scan *s, HideSet *hs, PpSym *macros)
+{
+    if (macros->flat_state == FLAT_NONE) {
+        flatten(s, macros);
+    } else if (macros->flat_state != FLAT_BUSY) {
+        note_uses(s, macros->flat_deps, macros->flat_uses);
+    }
+    // the flattened result is good here unless the expansion went through
+    // a macro that this name is already hidden by
+    if (macros->flat_state == FLAT_CLOSED
+            && hs_intersect(s->hidesets, hs, macros->flat_uses) == s->hidesets->empty)
+    {
+        hs = hs_add(s->hidesets, hs, macros->id);
+        scan_push_span(s, macros->flat, 0, vec_size(macros->flat), hs);
+        return;
+    }
+    if (s->flattening) {
+        s->uses = hs_add(s->hidesets, s->uses, macros->id);
+    }
+    replace_simple(s, hs, macros);
+}
+
+// An argument is kept where it was found: in a replacement list, in an
+// argument expanded earlier or in the source. It is copied only when it
+// runs across two of them.
+typedef struct Arg {
+    Span raw;
+    Span expanded; // the same as raw when nothing in it can expand
+    int done;
+} Arg;
+
+static void arg_append(Scan *s, Span *arg, vec(token) **copy, Token *t, Span *at)
+{
+    if (*copy == NULL) {
+        if (arg->begin == arg->end) {
+            *arg = *at;
+            return;
+        }
+        if (at->base == arg->base && at->begin == arg->end && at->hs == arg->hs) {
+            arg->end += 1;
+            return;
+        }
+        *copy = vec_new(token);
+        for (size_t i = arg->begin; i < arg->end; i += 1) {
+            Token *prev = arg->base[i];
+            if (prev->type == T_SPEC_PLACEMARKER) {
+                continue;
+            }
+            HideSet *hs = prev->hideset ? hs_union(s->hidesets, arg->hs, prev->hideset) : arg->hs;
+            if (hs != prev->hideset) {
+                prev = token_copy(prev);
+                prev->hideset = hs;
+            }
+            vec_push_back(*copy, prev);
+        }
+    }
+    if (t->type == T_SPEC_PLACEMARKER) {
+        return;
+    }
+    if (s->hs != t->hideset) {
+        t = token_copy(t);
+        t->hideset = s->hs;
+    }
+    vec_push_back(*copy, t);
+}
+
+static void arg_close(Span *arg, vec(token) *copy)
+{
+    if (copy) {
+        *arg = (Span) { .base = copy->data, .begin = 0, .end = vec_size(copy), .hs = NULL };
+    }
+}
+
+// Reads the arguments after the '(' that has been seen by peeking.
+// On return, s->hs is the hide set of the closing ')'.
+static void collect_args(Scan *s, PpSym *macros, Arg *args, size_t nargs)
+{
+    char *name = macros->macid->value;
+    Span at;
+
+    scan_pop_noppdirective(s);
+
+    size_t n = 0, depth = 0;
+    vec(token) *copy = NULL;
+    args[0].raw = (Span) { .base = NULL, .begin = 0, .end = 0, .hs = NULL };
+
+    for (;;) {
+        Token *t = scan_pop_at(s, &at);
+        if (t->type == TOKEN_EOF) {
+            cc_fatal("unterminated argument list invoking macro %s\n", name);
+        }
+        int variadic = macros->is_vararg && n == (size_t) macros->arity;
+        if (depth == 0 && (t->type == T_RIGHT_PAREN || (t->type == T_COMMA && !variadic))) {
+            arg_close(&args[n].raw, copy);
+            n += 1;
+            if (t->type == T_RIGHT_PAREN) {
+                break;
+            }
+            if (n == nargs) {
+                cc_fatal("macro %s passed too many arguments\n", name);
+            }
+            copy = NULL;
+            args[n].raw = (Span) { .base = NULL, .begin = 0, .end = 0, .hs = NULL };
+            continue;
+        }
+        if (t->type == T_LEFT_PAREN) {
+            depth += 1;
+        } else if (t->type == T_RIGHT_PAREN) {
+            depth -= 1;
+        }
+        arg_append(s, &args[n].raw, &copy, t, &at);
+    }
+
+    // F() is one empty argument, or none; the variadic one may be left out
+    if (n == nargs - 1 && macros->is_vararg) {
+        args[n].raw = (Span) { .base = NULL, .begin = 0, .end = 0, .hs = NULL };
+        n += 1;
+    }
+    int none = macros->arity == 0 && !macros->is_vararg;
+    if (n != nargs || (none && args[0].raw.begin != args[0].raw.end)) {
+        cc_fatal("macro %s requires %d arguments, but %lu given\n", name, macros->arity, n);
+    }
+    for (size_t i = 0; i < nargs; i += 1) {
+        args[i].done = 0;
+    }
+}
+
+static int span_is_empty(Span *span)
+{
+    for (size_t i = span->begin; i < span->end; i += 1) {
+        if (span->base[i]->type != T_SPEC_PLACEMARKER) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// The tokens, macro-replaced on their own as if they were the rest of the file.
+static vec(token)* expand_isolated(Scan *s, Span *span)
+{
+    size_t floor = s->floor;
+    s->floor = s->rescan.size;
+    s->isolated += 1;
+    scan_push(s, span->base, span->begin, span->end, span->hs);
+
+    vec(token) *out = vec_new(token);
+    for (;;) {
+        Token *t = scan_get(s);
+        if (t == EOF_TOKEN_ENTRY) {
+            break;
+        }
+        if (s->hs != t->hideset) {
+            t = token_copy(t);
+            t->hideset = s->hs;
+        }
+        vec_push_back(out, t);
+    }
+
+    s->floor = floor;
+    s->isolated -= 1;
+    return out;
+}
+
+// What an argument expands to depends on the tokens and their hide sets,
+// not on where they are. Spellings are compared only for the tokens that
+// are not told apart by type or name.
+static size_t span_hash(Span *span)
+{
+    size_t hash = 14695981039346656037ul ^ (size_t) span->hs;
+    for (size_t i = span->begin; i < span->end; i += 1) {
+        Token *t = span->base[i];
+        size_t h = (size_t) t->type;
+        if (t->ident) {
+            h ^= (size_t) t->ident;
+        } else if (t->type == TOKEN_NUMBER || t->type == TOKEN_STRING || t->type == TOKEN_CHAR) {
+            h ^= hashmap_hash_str(t->value);
+        }
+        h ^= (size_t) t->hideset;
+        h ^= (size_t) (t->noexpand | ((t->fposition & fleadws) << 1)) << 56;
+        hash = (hash ^ h) * 1099511628211ul;
+    }
+    return hash;
+}
+
+static int span_equal(Span *a, Span *b)
+{
+    if (a->end - a->begin != b->end - b->begin || a->hs != b->hs) {
+        return 0;
+    }
+    for (size_t i = a->begin, j = b->begin; i < a->end; i += 1, j += 1) {
+        Token *x = a->base[i], *y = b->base[j];
+        if (x == y) {
+            continue;
+        }
+        if (x->type != y->type || x->ident != y->ident || x->hideset != y->hideset) {
+            return 0;
+        }
+        if (x->noexpand != y->noexpand || (x->fposition & fleadws) != (y->fposition & fleadws)) {
+            return 0;
+        }
+        if (x->ident == NULL && strcmp(x->value, y->value)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// The argument, macro-replaced on its own as if it were the rest of
+// the file. Done once per argument, and only when it is used; the same
+// tokens met again before the macros change are not expanded again.
+// While flattening, the cache is passed by: what the expansion looks up
+// has to be seen.
+static Span* arg_expanded(Scan *s, Arg *arg)
+{
+    if (arg->done) {
+        return &arg->expanded;
+    }
+    arg->done = 1;
+    arg->expanded = arg->raw;
+
+    Span *raw = &arg->raw;
+    int may_expand = 0;
+    for (size_t i = raw->begin; i < raw->end; i += 1) {
+        Token *t = raw->base[i];
+        if (t->type == TOKEN_IDENT && !t->noexpand && macros_get(s->defs, t->ident)) {
+            may_expand = 1;
+            break;
+        }
+    }
+    if (!may_expand) {
+        return &arg->expanded;
+    }
+
+    ArgCacheSlot *slot = NULL;
+    size_t hash = 0;
+    if (!s->flattening) {
+        hash = span_hash(raw);
+        slot = &s->argcache[hash & (ARGCACHE_SIZE - 1)];
+        if (slot->generation == s->generation && slot->hash == hash && span_equal(&slot->raw, raw)) {
+            arg->expanded = slot->expanded;
+            return &arg->expanded;
+        }
+    }
+
+    vec(token) *out = expand_isolated(s, raw);
+    arg->expanded = (Span) { .base = out->data, .begin = 0, .end = vec_size(out), .hs = NULL };
+    if (slot) {
+        *slot = (ArgCacheSlot) { .hash = hash, .generation = s->generation, .raw = *raw, .expanded = arg->expanded };
+    }
+    return &arg->expanded;
+}
+
+static void segs_push(Scan *s, Token **base, size_t begin, size_t end, HideSet *hs)
+{
+    if (begin == end) {
+        return;
+    }
+    if (s->nsegs == s->segs_alloc) {
+        s->segs_alloc = s->segs_alloc ? s->segs_alloc * 2 : 64;
+        s->segs = cc_realloc(s->segs, sizeof(Span) * s->segs_alloc);
+    }
+    s->segs[s->nsegs++] = (Span) { .base = base, .begin = begin, .end = end, .hs = hs };
+}
+
+// The token a spelling stands for, lexed once per spelling.
+static Token* intern_spelling(Scan *s, size_t len)
+{
+    map_result(pastes) opt = map_get(s->pasted, s->scratch.data);
+    if (opt.found) {
+        return opt.value;
+    }
+
+    // the lexer looks a few characters ahead, the zeros are for it
+    for (size_t i = 0; i < 8; i += 1) {
+        sb_addc(&s->scratch, '\0');
+    }
+    s->scratch.size = len;
+    s->pastebuf = (CharBuf) { .buf = s->scratch.data, .size = len, .offset = 0,
+        .line = 1, .column = 0, .prevc = 0, .eofs = -1 };
+
+    Token *t = nex2(&s->paster);
+    if (t == EOF_TOKEN_ENTRY || t->type == TOKEN_ERROR || s->pastebuf.offset != len) {
+        return NULL;
+    }
+    map_put(s->pasted, cc_strdup(s->scratch.data), t);
+    return t;
+}
+
+// a ## b: one token spelled as both of them, hidden by what both were.
+static Token* paste_tokens(Scan *s, Token *a, HideSet *ahs, Token *b, HideSet *bhs)
+{
+    s->scratch.size = 0;
+    sb_adds(&s->scratch, a->value);
+    sb_adds(&s->scratch, b->value);
+
+    Token *pasted = intern_spelling(s, s->scratch.size);
+    if (pasted == NULL) {
+        cc_fatal("pasting [%s] and [%s] does not give a valid preprocessing token\n", a->value, b->value);
+    }
+    Token *t = token_copy(pasted);
+    t->fposition = a->fposition & fleadws;
+    t->pos = a->pos;
+    t->hideset = hs_intersect(s->hidesets, ahs, bhs);
+    return t;
+}
+
+// #a: the spelling of the argument as a string literal, with one space
+// where there was any white space, and the quotes and the backslashes of
+// the literals in it escaped.
+static Token* stringize(Scan *s, Span *raw, Token *at)
+{
+    Str *sb = &s->scratch;
+    sb->size = 0;
+    sb_addc(sb, '"');
+
+    int first = 1;
+    for (size_t i = raw->begin; i < raw->end; i += 1) {
+        Token *t = raw->base[i];
+        if (t->type == T_SPEC_PLACEMARKER) {
+            continue;
+        }
+        if (!first && (t->fposition & fleadws)) {
+            sb_addc(sb, ' ');
+        }
+        first = 0;
+        if (t->type != TOKEN_STRING && t->type != TOKEN_CHAR) {
+            sb_adds(sb, t->value);
+            continue;
+        }
+        for (char *c = t->value; *c; c += 1) {
+            if (*c == '"' || *c == '\\') {
+                sb_addc(sb, '\\');
+            }
+            sb_addc(sb, *c);
+        }
+    }
+    sb_addc(sb, '"');
+
+    Token *str = intern_spelling(s, sb->size);
+    if (str == NULL) {
+        cc_fatal("stringizing gives an invalid string literal: %s\n", sb->data);
+    }
+    Token *t = token_copy(str);
+    t->fposition = at->fposition & fleadws;
+    t->pos = at->pos;
+    return t;
+}
+
+static Token* span_take(Scan *s, Span *span, int last, HideSet **hs)
+{
+    while (span->begin < span->end) {
+        Token *t = last ? span->base[--span->end] : span->base[span->begin++];
+        if (t->type == T_SPEC_PLACEMARKER) {
+            continue;
+        }
+        *hs = t->hideset ? hs_union(s->hidesets, span->hs, t->hideset) : span->hs;
+        return t;
+    }
+    return NULL;
+}
+
+// An argument takes the white space before the parameter it replaces:
+// its first token is copied when it has other white space before it.
+// NULL when the first token is good as it is.
+static Token* arg_lead(Span *arg, Token *formal_token, size_t *at)
+{
+    for (size_t i = arg->begin; i < arg->end; i += 1) {
+        Token *t = arg->base[i];
+        if (t->type == T_SPEC_PLACEMARKER) {
+            continue;
+        }
+        if ((t->fposition & fleadws) == (formal_token->fposition & fleadws)) {
+            return NULL;
+        }
+        Token *lead = token_copy(t);
+        lead->fposition = (t->fposition & ~fleadws) | (formal_token->fposition & fleadws);
+        *at = i;
+        return lead;
+    }
+    return NULL;
+}
+
+static void emit_token(Scan *s, vec(token) *own, Token *t, HideSet *hs)
+{
+    if (hs != t->hideset) {
+        t = token_copy(t);
+        t->hideset = hs;
+    }
+    vec_push_back(own, t);
+    segs_push(s, NULL, vec_size(own) - 1, vec_size(own), NULL);
+}
+
+// The pieces from the one at 'from' up, taken off, as one list.
+static Span segs_take(Scan *s, vec(token) *own, size_t from)
+{
+    vec(token) *list = vec_new(token);
+    for (size_t k = from; k < s->nsegs; k += 1) {
+        Span *seg = &s->segs[k];
+        Token **base = seg->base ? seg->base : own->data;
+        for (size_t i = seg->begin; i < seg->end; i += 1) {
+            vec_push_back(list, base[i]);
+        }
+    }
+    s->nsegs = from;
+    return (Span) { .base = list->data, .begin = 0, .end = vec_size(list), .hs = NULL };
+}
+
+// A function-like macro with # or ## in it: the result is built piece by
+// piece, left to right. The tokens made here go into the expansion's own list,
+// the rest stays where it is as before.
+static void replace_function_hashes(Scan *s, HideSet *hs, PpSym *macros, Arg *args)
+{
+    vec(token) *repl = macros->repl;
+    vec(token) *own = vec_new(token);
+    size_t size = vec_size(repl);
+    size_t segs = s->nsegs;
+
+    Token *carry = NULL; // the left operand of ## waiting for the right one
+    HideSet *carryhs = NULL;
+    int pasting = 0;
+    size_t vaopt_segs = 0; // where the pieces of #__VA_OPT__ start
+
+    for (size_t i = 0; i < size; i += 1) {
+        Token *t = repl->data[i];
+        Span item = { .base = repl->data, .begin = i, .end = i + 1, .hs = NULL };
+        int in_own = 0;
+
+        if (t->fcategory & vaopt) {
+            Token *opt = t->type == TOKEN_IDENT ? t : repl->data[t->argnum];
+            int empty = span_is_empty(arg_expanded(s, &args[macros->arity]));
+            if (t->type == TOKEN_IDENT) {
+                if (!empty) {
+                    vaopt_segs = s->nsegs;
+                    continue;
+                }
+                i = t->argnum;
+                t = repl->data[i];
+            }
+            if (t->type == T_LEFT_PAREN || !(opt->fcategory & stringized)) {
+                continue;
+            }
+            // #__VA_OPT__ ( ... ): what is inside, replaced, as one string
+            if (carry) {
+                emit_token(s, own, carry, carryhs);
+                carry = NULL;
+            }
+            Span inside = { .base = NULL, .begin = 0, .end = 0, .hs = NULL };
+            if (!empty) {
+                inside = segs_take(s, own, vaopt_segs);
+            }
+            vec_push_back(own, stringize(s, &inside, opt));
+            item = (Span) { .base = own->data, .begin = vec_size(own) - 1, .end = vec_size(own), .hs = NULL };
+            in_own = 1;
+            pasting = 0;
+        } else if (t->fcategory & commaopt) {
+            // , ## __VA_ARGS__: the comma goes when there is nothing after it
+            if (span_is_empty(&args[macros->arity].raw)) {
+                i += 1;
+                continue;
+            }
+        } else if (t->fcategory & stringized) {
+            Token *str = stringize(s, &args[t->argnum].raw, t);
+            vec_push_back(own, str);
+            item = (Span) { .base = own->data, .begin = vec_size(own) - 1, .end = vec_size(own), .hs = NULL };
+            in_own = 1;
+        } else if (t->fcategory & formal) {
+            Arg *arg = &args[t->argnum];
+            item = (t->fcategory & unscanned) ? arg->raw : *arg_expanded(s, arg);
+
+            size_t at = 0;
+            Token *lead = pasting ? NULL : arg_lead(&item, t, &at);
+            if (lead) {
+                HideSet *leadhs = NULL;
+                span_take(s, &item, 0, &leadhs);
+                // the left operand of ## all by itself
+                if ((t->fcategory & hashhash) && span_is_empty(&item)) {
+                    carry = lead;
+                    carryhs = leadhs;
+                    pasting = 1;
+                    continue;
+                }
+                emit_token(s, own, lead, leadhs);
+            }
+        }
+
+        if (pasting) {
+            HideSet *firsths = NULL;
+            Token *first = span_take(s, &item, 0, &firsths);
+            if (first && carry) {
+                carry = paste_tokens(s, carry, carryhs, first, firsths);
+                carryhs = carry->hideset;
+            } else if (first) {
+                carry = first;
+                carryhs = firsths;
+            }
+        }
+        if (t->fcategory & hashhash) {
+            HideSet *lasths = NULL;
+            Token *last = span_take(s, &item, 1, &lasths);
+            if (last) {
+                if (carry) {
+                    emit_token(s, own, carry, carryhs);
+                }
+                segs_push(s, in_own ? NULL : item.base, item.begin, item.end, item.hs);
+                carry = last;
+                carryhs = lasths;
+            }
+            pasting = 1;
+            continue;
+        }
+        if (carry) {
+            emit_token(s, own, carry, carryhs);
+            carry = NULL;
+        }
+        segs_push(s, in_own ? NULL : item.base, item.begin, item.end, item.hs);
+        pasting = 0;
+    }
+    if (carry) {
+        emit_token(s, own, carry, carryhs);
+    }
+
+    while (s->nsegs > segs) {
+        Span *seg = &s->segs[--s->nsegs];
+        Token **base = seg->base ? seg->base : own->data;
+        scan_push(s, base, seg->begin, seg->end, hs_union(s->hidesets, seg->hs, hs));
+    }
+}
+
+// Function-like: the replacement is hidden by what both the name and the
+// closing parenthesis were hidden by, plus the macro itself. It goes on the
+// stack as the runs of the replacement list between the parameters, and
+// the arguments in place of them, last first.
+void replace_function(Scan *s, HideSet *hs, PpSym *macros)
+{
+    size_t nargs = macros->arity + macros->is_vararg;
+    Arg args[nargs ? nargs : 1];
+    collect_args(s, macros, args, nargs ? nargs : 1);
+
+    hs = hs_add(s->hidesets, hs_intersect(s->hidesets, hs, s->hs), macros->id);
+    if (s->flattening) {
+        s->uses = hs_add(s->hidesets, s->uses, macros->id);
+    }
+
+    if (macros->has_hashes) {
+        replace_function_hashes(s, hs, macros, args);
+        return;
+    }
+
+    vec(token) *repl = macros->repl;
+    size_t size = vec_size(repl);
+    size_t end = size;
+    Token **leads = NULL; // the first tokens of the arguments, with their white space
+    size_t nleads = 0;
+    for (size_t i = size; i-- > 0;) {
+        Token *t = repl->data[i];
+        if (!(t->fcategory & (formal | vaopt))) {
+            continue;
+        }
+        scan_push(s, repl->data, i + 1, end, hs);
+        end = i;
+
+        if (t->fcategory & formal) {
+            Span *arg = arg_expanded(s, &args[t->argnum]);
+            HideSet *arghs = hs_union(s->hidesets, arg->hs, hs);
+            size_t at = 0;
+            Token *lead = arg_lead(arg, t, &at);
+            if (lead == NULL) {
+                scan_push(s, arg->base, arg->begin, arg->end, arghs);
+                continue;
+            }
+            if (leads == NULL) {
+                leads = cc_malloc(sizeof(Token*) * size);
+            }
+            leads[nleads] = lead;
+            scan_push(s, arg->base, at + 1, arg->end, arghs);
+            scan_push(s, leads, nleads, nleads + 1, arghs);
+            nleads += 1;
+        }
+        // __VA_OPT__ ( ... ): the parentheses go, and what is inside
+        // goes too when there are no variable arguments
+        else if (t->type == T_RIGHT_PAREN
+                && span_is_empty(arg_expanded(s, &args[macros->arity])))
+        {
+            i = t->argnum;
+            end = i;
+        }
+    }
+    scan_push(s, repl->data, 0, end, hs);
+}
+
+vec(token)* scan_cut_line(Scan *s)
+{
+    vec(token) *rv = vec_new(token);
     while (!scan_is_empty(s)) {
         Token *t = scan_pop_noppdirective(s);
-        if ((t->fposition & fnewline) || t->type == TOKEN_EOF) {
+        if (t->type == TOKEN_EOF) {
+            break;
+        }
+        if (t->fposition & fnewline) {
             vec_push_back(rv, t);
             break;
         }
-        vec_push_back(rv, t);
+        vec_push_back(rv, t);
+    }
+    return rv;
+}
+
+// The position of the parameter the token names, or -1.
+static int parm_index(vec(token) *parm, int is_vararg, Token *t)
+{
+    if (parm == NULL || t->type != TOKEN_IDENT) {
+        return -1;
+    }
+    if (t->ident == VA_ARGS_ident && is_vararg) {
+        return (int) vec_size(parm);
+    }
+    for (size_t k = 0; k < vec_size(parm); k += 1) {
+        if (vec_get(parm, k)->ident == t->ident) {
+            return (int) k;
+        }
+    }
+    return -1;
+}
+
+// Takes # and ## out of the list, and marks what they apply to instead:
+// the parameter after # is stringized, the token before ## is pasted with
+// the one after it, and a parameter next to ## is used as written.
+// GNU ', ## __VA_ARGS__' marks the comma, which goes with empty arguments.
+// An object-like macro has no parameters, and # is just a token there.
+static vec(token)* mark_hashes(vec(token) *repl, vec(token) *parm, int is_vararg, char *macro, int *found)
+{
+    vec(token) *out = vec_new(token);
+    size_t size = vec_size(repl);
+    int operand = 0;
+
+    *found = 0;
+    for (size_t i = 0; i < size; i += 1) {
+        Token *t = vec_get(repl, i);
+
+        if (t->type == T_SHARP && parm) {
+            Token *next = (i + 1 < size) ? vec_get(repl, i + 1) : NULL;
+            int is_vaopt = next && is_vararg && next->ident == VA_OPT_ident;
+            if (next == NULL || (parm_index(parm, is_vararg, next) < 0 && !is_vaopt)) {
+                cc_fatal("'#' is not followed by a macro parameter in macro %s\n", macro);
+            }
+            next = token_copy(next);
+            next->fcategory |= stringized;
+            next->fposition = (next->fposition & ~fleadws) | (t->fposition & fleadws);
+            vec_push_back(out, next);
+            *found = 1;
+            operand = 0;
+            i += 1;
+            continue;
+        }
+
+        if (t->type == T_SHARP_SHARP) {
+            if (vec_is_empty(out) || i + 1 == size) {
+                cc_fatal("'##' cannot appear at either end of macro %s\n", macro);
+            }
+            Token *left = token_copy(vec_get(out, vec_size(out) - 1));
+            Token *right = vec_get(repl, i + 1);
+            if (left->type == T_COMMA && is_vararg && right->ident == VA_ARGS_ident) {
+                left->fcategory |= commaopt;
+            } else {
+                left->fcategory |= hashhash;
+            }
+            if (parm_index(parm, is_vararg, left) >= 0) {
+                left->fcategory |= unscanned;
+            }
+            vec_set(out, vec_size(out) - 1, left);
+            *found = 1;
+            operand = 1;
+            continue;
+        }
+
+        if (operand && parm_index(parm, is_vararg, t) >= 0) {
+            t = token_copy(t);
+            t->fcategory |= unscanned;
+        }
+        vec_push_back(out, t);
+        operand = 0;
+    }
+    return out;
+}
+
+// The operands of ## in an object-like macro are all in the list,
+// so they are pasted once, when it is defined.
+static vec(token)* paste_list(Scan *s, vec(token) *repl)
+{
+    vec(token) *out = vec_new(token);
+    for (size_t i = 0; i < vec_size(repl); i += 1) {
+        Token *t = vec_get(repl, i);
+        while (vec_get(repl, i)->fcategory & hashhash) {
+            i += 1;
+            t = paste_tokens(s, t, NULL, vec_get(repl, i), NULL);
+        }
+        vec_push_back(out, t);
+    }
+    return out;
+}
+
+// The parameters and the replacement list of a function-like macro.
+// Parameters in the list are marked with their position, so substitution
+// needs no lookups.
+static PpSym* define_function(Scan *s, Token *name)
+{
+    char *macro = name->value;
+    vec(token) *parm = vec_new(token);
+    int is_vararg = 0;
+
+    scan_pop_noppdirective(s);
+    Token *t = scan_pop_noppdirective(s);
+    if (t->type != T_RIGHT_PAREN) {
+        for (;;) {
+            if (t->type == T_DOT_DOT_DOT) {
+                is_vararg = 1;
+                t = scan_pop_noppdirective(s);
+                if (t->type != T_RIGHT_PAREN) {
+                    cc_fatal("missing ')' after '...' in macro %s parameters\n", macro);
+                }
+                break;
+            }
+            if (t->type != TOKEN_IDENT) {
+                cc_fatal("expected parameter name in macro %s, found [%s]\n", macro, t->value);
+            }
+            vec_push_back(parm, t);
+            t = scan_pop_noppdirective(s);
+            if (t->type == T_RIGHT_PAREN) {
+                break;
+            }
+            if (t->type != T_COMMA) {
+                cc_fatal("expected ',' or ')' in macro %s parameters, found [%s]\n", macro, t->value);
+            }
+            t = scan_pop_noppdirective(s);
+        }
+    }
+
+    vec(token) *repl = (t->fposition & fnewline) ? vec_new(token) : scan_cut_line(s);
+    int arity = (int) vec_size(parm);
+    int has_hashes = 0;
+    repl = mark_hashes(repl, parm, is_vararg, macro, &has_hashes);
+
+    for (size_t i = 0; i < vec_size(repl); i += 1) {
+        Token *r = vec_get(repl, i);
+        if (r->type != TOKEN_IDENT) {
+            continue;
+        }
+        if (r->ident == VA_OPT_ident && is_vararg) {
+            size_t j = i + 1, depth = 0;
+            if (j == vec_size(repl) || vec_get(repl, j)->type != T_LEFT_PAREN) {
+                cc_fatal("missing '(' after __VA_OPT__ in macro %s\n", macro);
+            }
+            for (; j < vec_size(repl); j += 1) {
+                T type = vec_get(repl, j)->type;
+                if (type == T_LEFT_PAREN) {
+                    depth += 1;
+                } else if (type == T_RIGHT_PAREN && --depth == 0) {
+                    break;
+                }
+            }
+            if (j == vec_size(repl)) {
+                cc_fatal("unterminated __VA_OPT__ in macro %s\n", macro);
+            }
+            // __VA_OPT__ knows where it ends, the parentheses where it starts
+            Token *marks[] = { r, vec_get(repl, i + 1), vec_get(repl, j) };
+            size_t where[] = { i, i + 1, j };
+            for (size_t k = 0; k < 3; k += 1) {
+                Token *mark = token_copy(marks[k]);
+                mark->fcategory |= vaopt;
+                mark->argnum = (int) (k == 0 ? j : i);
+                vec_set(repl, where[k], mark);
+            }
+            continue;
+        }
+
+        int argnum = parm_index(parm, is_vararg, r);
+        if (argnum >= 0) {
+            Token *formal_token = token_copy(r);
+            formal_token->fcategory |= formal;
+            formal_token->argnum = argnum;
+            vec_set(repl, i, formal_token);
+        }
+    }
+
+    PpSym *m = sym_new(name, repl, ++s->macros);
+    m->parm = parm;
+    m->arity = arity;
+    m->is_vararg = is_vararg;
+    m->has_hashes = has_hashes;
+    return m;
+}
+
+static void cond_forget(CondCacheSlot *slot)
+{
+    if (slot->deps) {
+        cc_free(&slot->deps->data);
+        cc_free(&slot->deps);
+        cc_free(&slot->meant->data);
+        cc_free(&slot->meant);
+    }
+}
+
+static int cond_fresh(Scan *s, CondCacheSlot *slot)
+{
+    for (size_t i = 0; i < vec_size(slot->deps); i += 1) {
+        if (macros_get(s->defs, vec_get(slot->deps, i)) != vec_get(slot->meant, i)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// The line macro-replaced, with the operands of 'defined' left as they are,
+// those of a 'defined' that a macro expands to as well.
+static int cond_expand(Scan *s, Token *t, vec(token) *line, CondCacheSlot *slot)
+{
+    cond_forget(slot);
+    vec(ident) *deps = vec_new(ident);
+    vec(token) *expanded = vec_new(token);
+
+    HideSet *uses = s->uses;
+    size_t floor = s->floor;
+    s->floor = s->rescan.size;
+    s->isolated += 1;
+    s->flattening += 1;
+    scan_push_span(s, line, 0, vec_size(line), NULL);
+    for (;;) {
+        Token *r = scan_get(s);
+        if (r == EOF_TOKEN_ENTRY) {
+            break;
+        }
+        vec_push_back(expanded, r);
+        if (r->type != TOKEN_IDENT || r->ident != defined_ident) {
+            continue;
+        }
+        Token *name = scan_pop_noppdirective(s);
+        if (name->type == T_LEFT_PAREN) {
+            vec_push_back(expanded, name);
+            name = scan_pop_noppdirective(s);
+        }
+        if (name != EOF_TOKEN_ENTRY) {
+            vec_push_back(expanded, name);
+        }
+        if (name->type == TOKEN_IDENT) {
+            vec_push_back(deps, name->ident);
+        }
+    }
+    s->floor = floor;
+    s->isolated -= 1;
+    s->flattening -= 1;
+    s->uses = uses;
+
+    Ident *id = NULL;
+    vec_foreach(s->deps, id)
+    {
+        if (vec_is_empty(deps) || vec_get(deps, vec_size(deps) - 1) != id) {
+            vec_push_back(deps, id);
+        }
+    }
+    vec_clear(s->deps);
+    slot->deps = deps;
+    slot->meant = vec_new(sym);
+    vec_foreach(deps, id)
+    {
+        vec_push_back(slot->meant, macros_get(s->defs, id));
+    }
+
+    PpExpr *e = ppexpr_compile(expanded->data, vec_size(expanded), 0);
+    if (e == NULL) {
+        cc_fatal("#%s: invalid expression at %s:%d\n", t->value, t->pos.filename, t->pos.line);
+    }
+    PpValue value;
+    ppexpr_eval(e, s->defs, &value);
+    ppexpr_free(&e);
+    cc_free(&expanded->data);
+    cc_free(&expanded);
+    return value.value != 0;
+}
+
+// The controlling expression of #if and #elif. Most lines are tests of
+// 'defined' and of macros that are numbers; those are evaluated on the
+// line as written, without expanding it.
+static int cond_eval(Scan *s, Token *t, vec(token) *line)
+{
+    if (vec_is_empty(line)) {
+        cc_fatal("#%s with no expression at %s:%d\n", t->value, t->pos.filename, t->pos.line);
+    }
+    CondCacheSlot *slot = &s->condcache[(size_t) t->pos.line & (CONDCACHE_SIZE - 1)];
+    if (slot->filename == NULL || slot->line != t->pos.line || strcmp(slot->filename, t->pos.filename)) {
+        cond_forget(slot);
+        if (slot->expr) {
+            ppexpr_free(&slot->expr);
+        }
+        if (slot->filename) {
+            cc_free(&slot->filename);
+        }
+        slot->filename = cc_strdup(t->pos.filename);
+        slot->line = t->pos.line;
+        slot->expr = ppexpr_compile(line->data, vec_size(line), 1);
+    }
+
+    PpValue value;
+    if (slot->expr && ppexpr_eval(slot->expr, s->defs, &value)) {
+        return value.value != 0;
+    }
+    if (slot->deps == NULL || !cond_fresh(s, slot)) {
+        slot->value = cond_expand(s, t, line, slot);
+    }
+    return slot->value;
+}
+
+// The rest of the directive line; nothing when the directive name ends it.
+static vec(token)* directive_rest(Scan *s, Token *name)
+{
+    if (name->fposition & fnewline) {
+        return vec_new(token);
+    }
+    return scan_cut_line(s);
+}
+
+// Enters a branch of the group on top, or skips it in the buffer.
+static void cond_branch(Scan *s, int taken)
+{
+    if (taken) {
+        unsigned *top = &s->conds->data[vec_size(s->conds) - 1];
+        *top |= COND_TAKEN;
+        return;
+    }
+    if (s->stream) {
+        s->offset = tokstream_skip(s->stream, s->directive_at);
+        return;
+    }
+    // what is left of the region is the end of file, if anything
+    if (s->offset == s->size) {
+        skip_group(s->ctx);
+    }
+}
+
+// The file being included starts with #ifndef name, or with
+// #if !defined name; NULL when it starts with any other #if.
+static void guard_open(Scan *s, Ident *name)
+{
+    Include *inc = scan_include_top(s);
+    if (inc && inc->guard == GUARD_START) {
+        inc->guard = name ? GUARD_INSIDE : GUARD_NONE;
+        inc->guard_name = name;
+    }
+}
+
+static Ident* guard_if_name(vec(token) *line)
+{
+    size_t size = vec_size(line);
+    Token **t = line->data;
+    if (size < 3 || t[0]->type != T_EXCLAMATION || t[1]->ident != defined_ident) {
+        return NULL;
+    }
+    if (size == 3 && t[2]->type == TOKEN_IDENT) {
+        return t[2]->ident;
+    }
+    if (size == 5 && t[2]->type == T_LEFT_PAREN && t[3]->type == TOKEN_IDENT && t[4]->type == T_RIGHT_PAREN) {
+        return t[3]->ident;
+    }
+    return NULL;
+}
+
+static int dline_cond(Scan *s, Token *t)
+{
+    if (t->type == PT_HIF || t->type == PT_HIFDEF || t->type == PT_HIFNDEF) {
+        vec_push_back(s->conds, 0);
+        if (t->type == PT_HIF) {
+            vec(token) *line = directive_rest(s, t);
+            guard_open(s, guard_if_name(line));
+            cond_branch(s, cond_eval(s, t, line));
+            return 1;
+        }
+        Token *name = scan_pop_noppdirective(s);
+        if (name->type != TOKEN_IDENT) {
+            cc_fatal("macro name expected after #%s\n", t->value);
+        }
+        if (!(name->fposition & fnewline)) {
+            scan_cut_line(s);
+        }
+        guard_open(s, t->type == PT_HIFNDEF ? name->ident : NULL);
+        int defined = macros_get(s->defs, name->ident) != NULL;
+        cond_branch(s, t->type == PT_HIFDEF ? defined : !defined);
+        return 1;
+    }
+
+    if (vec_is_empty(s->conds)) {
+        cc_fatal("#%s without #if\n", t->value);
+    }
+    unsigned *top = &s->conds->data[vec_size(s->conds) - 1];
+    if ((*top & COND_ELSE) && t->type != PT_HENDIF) {
+        cc_fatal("#%s after #else\n", t->value);
+    }
+
+    // the guard group is the only group at the top of the file
+    Include *inc = scan_include_top(s);
+    if (inc && inc->guard == GUARD_INSIDE && vec_size(s->conds) == inc->conds + 1) {
+        inc->guard = t->type == PT_HENDIF ? GUARD_AFTER : GUARD_NONE;
+    }
+
+    if (t->type == PT_HELIF) {
+        vec(token) *line = directive_rest(s, t);
+        cond_branch(s, !(*top & COND_TAKEN) && cond_eval(s, t, line));
+        return 1;
+    }
+    if (t->type == PT_HELSE) {
+        directive_rest(s, t);
+        int taken = !(*top & COND_TAKEN);
+        *top |= COND_ELSE;
+        cond_branch(s, taken);
+        return 1;
+    }
+    if (t->type == PT_HENDIF) {
+        directive_rest(s, t);
+        vec_pop_back(s->conds);
+        return 1;
+    }
+    return 0;
+}
+
+// The name in #include "name" or #include <name>, or NULL.
+static char* include_name(vec(token) *line, int *angled)
+{
+    if (vec_is_empty(line)) {
+        return NULL;
+    }
+    Token *first = vec_get(line, 0);
+    if (first->type == TOKEN_STRING && first->value[0] == '"') {
+        *angled = 0;
+        return sb_mid(first->value, 1, strlen(first->value) - 2);
+    }
+    if (first->type != T_LT) {
+        return NULL;
+    }
+
+    Str name = STR_INIT;
+    for (size_t i = 1; i < vec_size(line); i += 1) {
+        Token *t = vec_get(line, i);
+        if (t->type == T_GT && name.size) {
+            *angled = 1;
+            return name.data;
+        }
+        if (i > 1 && (t->fposition & fleadws)) {
+            sb_addc(&name, ' ');
+        }
+        sb_adds(&name, t->value);
+    }
+    cc_free(&name.data);
+    return NULL;
+}
+
+// The directory of the file being read: "" for the current one.
+static char* include_dir(Scan *s)
+{
+    char *filename = s->ctx->filename;
+    char *slash = strrchr(filename, '/');
+    if (slash == NULL) {
+        return cc_strdup("");
+    }
+    return sb_left(filename, slash == filename ? 1 : (size_t) (slash - filename));
+}
+
+static Ident* ctx_ident(void *ctx, char *name)
+{
+    return ctx_make_ident(ctx, name);
+}
+
+static Strtox* ctx_number(void *ctx, char *spelling, size_t len)
+{
+    return ctx_make_number(ctx, spelling, len);
+}
+
+// Frees the tokens of tokenize_context(), with the spellings they own
+// (a name's is its Ident's), and the vec.
+static void free_lexed(vec(token) **tokens)
+{
+    for (size_t i = 0; i < vec_size(*tokens); i += 1) {
+        Token *t = vec_get(*tokens, i);
+        if (t == EOF_TOKEN_ENTRY) {
+            continue;
+        }
+        if (t->ident == NULL || t->value != t->ident->name) {
+            cc_free(&t->value);
+        }
+        cc_free(&t);
+    }
+    cc_free(&(*tokens)->data);
+    cc_free(tokens);
+}
+
+// The whole file, as lexed by whoever read it first: in this process,
+// or in one before it that saved it.
+static TokenStream* ctx_stream(Context *ctx)
+{
+    TokenStream *stream = tokcache_get(ctx->tokcache, ctx->data);
+    if (stream == NULL) {
+        // the tokens go in the cache, and outlive the paths of this scan:
+        // the name they have is theirs, and like them, it is never freed
+        char *path = ctx->filename;
+        ctx->filename = cc_strdup(path);
+        TokFileNames names = {
+            .ctx = ctx, .ident = &ctx_ident, .number = ctx->eval_numbers ? &ctx_number : NULL
+        };
+        vec(token) *tokens = tokfile_load(ctx->data, ctx->filename, &names);
+        int lexed = tokens == NULL;
+        if (lexed) {
+            tokenize_context(ctx);
+            tokens = ctx->tokenlist;
+            ctx->tokenlist = vec_new(token);
+            tokfile_save(ctx->data, tokens);
+        }
+        stream = tokcache_put(ctx->tokcache, ctx->data, tokens);
+
+        if (stream->tokens.data != tokens->data) {
+            // another thread has put them first: these, and their name,
+            // are nobody's
+            if (lexed) {
+                free_lexed(&tokens);
+            } else {
+                tokfile_free(&tokens);
+            }
+            cc_free(&ctx->filename);
+            ctx->filename = path;
+        } else {
+            // the stream has the tokens now, the vec is ours
+            cc_free(&tokens);
+        }
+    }
+    ctx->eof = 1;
+    return stream;
+}
+
+static void include_context_free(Context **ctx)
+{
+    context_close(*ctx);
+    cc_free(&(*ctx)->tokenlist->data);
+    cc_free(&(*ctx)->tokenlist);
+    cc_free(ctx);
+}
+
+static void scan_enter(Scan *s, char *path, SourceFile *file)
+{
+    if (s->nincludes == s->includes_alloc) {
+        s->includes_alloc = s->includes_alloc ? s->includes_alloc * 2 : 16;
+        s->includes = cc_realloc(s->includes, sizeof(Include) * s->includes_alloc);
+    }
+    s->includes[s->nincludes++] = (Include) {
+        .ctx = s->ctx, .stream = s->stream, .tokens = s->tokens, .size = s->size, .offset = s->offset,
+        .file = file, .conds = vec_size(s->conds), .guard = GUARD_START, .guard_name = NULL
+    };
+    s->ctx = make_include_context(s->ctx, path);
+    scan_read(s, ctx_read(s->ctx, file));
+    s->stream = ctx_stream(s->ctx);
+    s->tokens = &s->stream->tokens;
+    s->size = vec_size(s->tokens);
+    s->offset = 0;
+}
+
+static void scan_leave(Scan *s)
+{
+    Include *inc = &s->includes[--s->nincludes];
+    if (vec_size(s->conds) != inc->conds) {
+        cc_fatal("unterminated #if at the end of %s\n", s->ctx->filename);
+    }
+    inc->file->guard = inc->guard == GUARD_AFTER ? inc->guard_name : NULL;
+
+    include_context_free(&s->ctx);
+    s->ctx = inc->ctx;
+    s->stream = inc->stream;
+    s->tokens = inc->tokens;
+    s->size = inc->size;
+    s->offset = inc->offset;
+}
+
+static void dline_include(Scan *s, Token *t)
+{
+    vec(token) *line = directive_rest(s, t);
+    int angled = 0;
+    char *name = include_name(line, &angled);
+    if (name == NULL) {
+        Span span = { .base = line->data, .begin = 0, .end = vec_size(line), .hs = NULL };
+        name = include_name(expand_isolated(s, &span), &angled);
+    }
+    if (name == NULL) {
+        cc_fatal("#include expects \"FILENAME\" or <FILENAME> at %s:%d\n", t->pos.filename, t->pos.line);
+    }
+
+    char *dir = include_dir(s);
+    Resolved *found = incpaths_find(s->paths, dir, name, angled);
+    if (found == NULL) {
+        cc_fatal("%s: no such file, included at %s:%d\n", name, t->pos.filename, t->pos.line);
+    }
+    cc_free(&dir);
+    cc_free(&name);
+
+    SourceFile *file = found->file;
+    if (file->once || (file->guard && macros_get(s->defs, file->guard))) {
+        return;
+    }
+    if (s->nincludes == INCLUDE_DEPTH_MAX) {
+        cc_fatal("#include nested too deeply at %s:%d\n", t->pos.filename, t->pos.line);
+    }
+    scan_enter(s, found->path, file);
+}
+
+// Only #pragma once is looked at; the others are not passed on yet.
+static void dline_pragma(Scan *s, Token *t)
+{
+    vec(token) *line = directive_rest(s, t);
+    Include *inc = scan_include_top(s);
+    if (inc && vec_size(line) == 1 && vec_get(line, 0)->ident == once_ident) {
+        inc->file->once = 1;
     }
-    return rv;
 }
 
 int dline(Scan *s, Token *t)
 {
+    if (t->type == PT_HEOL) {
+        return 1;
+    }
     if (t->type == PT_HDEFINE) {
         Token *name = scan_pop_noppdirective(s);
         assert(name->type == TOKEN_IDENT);
 
-        vec(token) *repl = scan_cut_line(s);
-        PpSym *m = sym_new(name, repl);
-        name->ident->sym = m;
+        PpSym *m = NULL;
+        Token *lparen = scan_peek(s);
+        if (!(name->fposition & fnewline) && lparen->type == T_LEFT_PAREN && !(lparen->fposition & fleadws)) {
+            m = define_function(s, name);
+        } else {
+            vec(token) *repl = (name->fposition & fnewline) ? vec_new(token) : scan_cut_line(s);
+            int has_hashes = 0;
+            repl = mark_hashes(repl, NULL, 0, name->value, &has_hashes);
+            if (has_hashes) {
+                repl = paste_list(s, repl);
+            }
+            m = sym_new(name, repl, ++s->macros);
+        }
+        invalidate(s, name->ident);
+        macros_set(s->defs, name->ident, m);
+        s->generation += 1;
         return 1;
     }
-    return 0;
+    if (t->type == PT_HUNDEF) {
+        Token *name = scan_pop_noppdirective(s);
+        assert(name->type == TOKEN_IDENT);
+
+        if (!(name->fposition & fnewline)) {
+            scan_cut_line(s);
+        }
+        invalidate(s, name->ident);
+        macros_set(s->defs, name->ident, NULL);
+        s->generation += 1;
+        return 1;
+    }
+    if (t->type == PT_HINCLUDE) {
+        dline_include(s, t);
+        return 1;
+    }
+    if (t->type == PT_HPRAGMA) {
+        dline_pragma(s, t);
+        return 1;
+    }
+    return dline_cond(s, t);
+}
+
+// A file read before the main one, as if the main file began with an
+// #include "path" of it.
+void scan_include_prefix(Scan *s, char *path)
+{
+    Resolved *found = incpaths_find(s->paths, "", path, 0);
+    if (found == NULL) {
+        cc_fatal("%s: no such file, given as the prefix\n", path);
+    }
+    scan_enter(s, found->path, found->file);
+}
+
+// Done with the scan: what it has made for itself goes, the contexts of
+// the files it was still in too, but not the one it was made with. The
+// tokens it gave, and the macros, stay.
+void scan_free(Scan **s)
+{
+    assert(s);
+
+    Scan *scan = *s;
+    if (scan == NULL) {
+        return;
+    }
+    for (size_t i = scan->nincludes; i > 0; i -= 1) {
+        include_context_free(&scan->ctx);
+        scan->ctx = scan->includes[i - 1].ctx;
+    }
+    cc_free(&scan->includes);
+    incpaths_free(&scan->paths);
+    for (size_t i = 0; i < scan->nread; i += 1) {
+        cc_free(&scan->read[i].path);
+    }
+    cc_free(&scan->read);
+
+    for (SpanChunk *chunk = scan->rescan.top; chunk;) {
+        SpanChunk *prev = chunk->prev;
+        cc_free(&chunk);
+        chunk = prev;
+    }
+    cc_free(&scan->rescan.spare);
+    cc_free(&scan->segs);
+
+    for (size_t i = 0; i < CONDCACHE_SIZE; i += 1) {
+        CondCacheSlot *slot = &scan->condcache[i];
+        cond_forget(slot);
+        if (slot->expr) {
+            ppexpr_free(&slot->expr);
+        }
+        cc_free(&slot->filename);
+    }
+    cc_free(&scan->condcache);
+    cc_free(&scan->argcache);
+
+    map_entry(pastes) *e;
+    map_foreach(scan->pasted, e) {
+        cc_free(&e->key);
+    }
+    map_destroy(scan->pasted);
+    cc_free(&scan->scratch.data);
+    cc_free(&scan->deps->data);
+    cc_free(&scan->deps);
+    cc_free(&scan->conds->data);
+    cc_free(&scan->conds);
+    macros_free(&scan->defs);
+    hidesets_free(&scan->hidesets);
+    cc_free(s);
+}
+
+Token* scan_source_at(Scan *s)
+{
+    return s->source_at;
+}
+
+// A scan of the prefix alone, read to the end and saved. What a macro
+// gave is saved where the macro was used, as scan_write() would see it:
+// once restored, it has no source token to be placed by.
+int scan_save_prefix(Scan *s, char *path)
+{
+    vec(token) *output = vec_new(token);
+    for (Token *t = scan_get(s); t->type != TOKEN_EOF; t = scan_get(s)) {
+        Token *at = scan_source_at(s);
+        if (at && at != t) {
+            t = token_copy(t);
+            t->pos = at->pos;
+        }
+        vec_push_back(output, t);
+    }
+    int ok = macsnap_save(path, output, s->defs, s->read, s->nread, s->paths->dirs);
+    cc_free(&output->data);
+    cc_free(&output);
+    return ok;
+}
+
+// A prefix saved, as if it were included here: its tokens come next, and
+// its macros are defined. 0, with nothing done, when it is not good.
+int scan_load_prefix(Scan *s, char *path)
+{
+    MacSnapNames names = {
+        .ctx = s->ctx, .ident = &ctx_ident, .number = s->ctx->eval_numbers ? &ctx_number : NULL
+    };
+    MacSnap snap;
+    if (!macsnap_load(path, s->paths->dirs, &names, &snap)) {
+        return 0;
+    }
+
+    PpSym *m = NULL;
+    vec_foreach(snap.macros, m)
+    {
+        Ident *name = m->macid->ident;
+        m->id = ++s->macros;
+        invalidate(s, name);
+        macros_set(s->defs, name, m);
+    }
+    s->generation += 1;
+
+    for (size_t i = 0; i < snap.nfiles; i += 1) {
+        SnapFile *f = &snap.files[i];
+        SourceFile *file = incpaths_file(s->paths, f->dev, f->ino);
+        file->guard = f->file->guard;
+        file->once = f->file->once;
+        cc_free(&f->file);
+        f->file = file;
+        scan_read(s, *f);
+    }
+    cc_free(&snap.files);
+
+    // what has been given has been expanded
+    Token *t = NULL;
+    vec_foreach(snap.output, t)
+    {
+        t->noexpand = t->type == TOKEN_IDENT;
+    }
+    scan_push_span(s, snap.output, 0, vec_size(snap.output), NULL);
+    return 1;
 }
 
 Token* scan_get(Scan *s)
 {
     restart: while (!scan_is_empty(s)) {
         Token *t = scan_pop(s);
+        HideSet *hs = s->hs;
         if (is_ppdirtype(t->type)) {
             assert(dline(s, t));
             continue;
         }
-        if (unhide(t)) {
-            continue;
-        }
         if (t->type != TOKEN_IDENT) {
             return t;
         }
         if (t->noexpand) {
             return t;
         }
-        PpSym *macros = t->ident->sym;
+        if (s->flattening) {
+            vec_push_back(s->deps, t->ident);
+        }
+        PpSym *macros = macros_get(s->defs, t->ident);
         if (macros == NULL) {
             return t;
         }
-        if (macros->is_hidden) {
+        if (hs_contains(hs, macros->id)) {
             Token *noexpand = token_copy(t);
             noexpand->noexpand = 1;
+            noexpand->hideset = hs;
             return noexpand;
         }
-        replace_simple(s, t, macros);
+        if (macros->parm) {
+            if (scan_peek(s)->type != T_LEFT_PAREN) {
+                return t;
+            }
+            if (s->isolated && !scan_call_in_reach(s)) {
+                return t;
+            }
+            replace_function(s, hs, macros);
+        } else {
+            replace_object(s, hs, macros);
+        }
         goto restart;
 
     }
     return EOF_TOKEN_ENTRY;
 }
 
-int main(int argc, char **argv)
+// Whether b, written right after a, is lexed into something else:
+// "int" "x", "-" "-1", "1" ".5", "/" "*" are not the tokens they were.
+static int would_paste(Token *a, Token *b)
 {
-    Context *ctx = make_context("input.txt");
-    vec(token) *tokens = tokenize(ctx);
+    size_t len = strlen(a->value);
+    char last = len ? a->value[len - 1] : '\0';
+    char first = b->value[0];
+    if (a->type == TOKEN_IDENT || a->type == TOKEN_NUMBER) {
+        if (is_ident_char(first)) {
+            return 1;
+        }
+        if (a->type == TOKEN_IDENT) {
+            return first == '\'' || first == '"'; // L'x', u8"x"
+        }
+        return first == '.' || ((first == '+' || first == '-') && strchr("eEpP", last));
+    }
+    if (a->type == TOKEN_STRING || a->type == TOKEN_CHAR || len == 0) {
+        return 0;
+    }
+    if ((last == '/' && (first == '/' || first == '*')) || (last == '.' && is_dec(first))) {
+        return 1;
+    }
+
+    // the longest operator the two start with, as the lexer takes it
+    char op[5];
+    size_t n = len < 4 ? len : 4;
+    memcpy(op, a->value, n);
+    for (char *c = b->value; n < 4 && *c; c += 1) {
+        op[n++] = *c;
+    }
+    for (; n > len; n -= 1) {
+        Slice key = slice_new(op, n);
+        if (map_get(ops_map(), &key).found) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// A line of output for every line of the source the tokens come from:
+// what a macro gives is on the line the macro was used in. The spaces
+// between tokens are the ones the source had, and one more where two
+// tokens would be lexed as something else.
+void scan_write(Scan *s, Str *out)
+{
+    Token *prev = NULL;
+    char *file = NULL;
+    int line = 0;
+    for (Token *t = scan_get(s); t->type != TOKEN_EOF; t = scan_get(s)) {
+        Token *at = scan_source_at(s) ? scan_source_at(s) : t;
+        char *at_file = at->pos.filename ? at->pos.filename : "";
+        if (prev && (at->pos.line != line || strcmp(at_file, file) != 0)) {
+            sb_addc(out, '\n');
+            prev = NULL;
+        }
+        file = at_file;
+        line = at->pos.line;
+
+        if (prev && ((t->fposition & fleadws) || would_paste(prev, t))) {
+            sb_addc(out, ' ');
+        }
+        sb_adds(out, t->value);
+        prev = t;
+    }
+    if (file) {
+        sb_addc(out, '\n');
+    }
+}
+
+// The driver: files from the command line, from @response files, and
+// from stdin after a "-", one per line, are lexed (or preprocessed,
+// with -E) by --jobs workers. Every worker makes a Context per file,
+// and they all share one table of names; the operators are shared by
+// every context already. The token stream of a header is made once, by
+// the first worker to include it, and read by all the others. What a
+// file gives is kept until the ones before it are written, so the output
+// is in the order of the inputs, whatever the order the workers finish in.
+// A --prefix is read before every file; with --prefix-snap, it is
+// preprocessed once, saved there, and restored in every file instead.
+//
+//   tokenize [-E] [-I dir]... [--jobs N] [--tok-cache dir]
+//            [--prefix file [--prefix-snap path]] file|@list|-...
+
+typedef struct Job {
+    char *path;
+    Str out;
+    int done;
+} Job;
+
+typedef struct Driver {
+    pthread_mutex_t lock;
+    pthread_cond_t done; // a job is done
+    pthread_cond_t room; // a job is written out
+    Job *jobs;
+    size_t njobs, jobs_alloc;
+    size_t next; // the next job to take
+    size_t written; // the jobs below are written out
+    size_t window; // how far the workers may be ahead of the output
+
+    IdentTable *idents;
+    TokenCache *tokcache; // of the files in every translation unit
+    int preprocess;
+    vec(str) *include_dirs;
+    char *prefix; // NULL for none
+    char *snapshot; // of the prefix, NULL for none
+} Driver;
+
+static void driver_add(Driver *d, char *path)
+{
+    if (d->njobs == d->jobs_alloc) {
+        d->jobs_alloc = d->jobs_alloc ? d->jobs_alloc * 2 : 64;
+        d->jobs = cc_realloc(d->jobs, sizeof(Job) * d->jobs_alloc);
+    }
+    d->jobs[d->njobs++] = (Job) { .path = cc_strdup(path), .out = STR_INIT, .done = 0 };
+}
+
+// The paths in fp, one per line, or separated by blanks when words.
+static void driver_add_list(Driver *d, FILE *fp, int words)
+{
+    Str path = STR_INIT;
+    for (;;) {
+        int c = fgetc(fp);
+        int ends = c == EOF || c == '\n' || c == '\r' || (words && (c == ' ' || c == '\t'));
+        if (!ends) {
+            sb_addc(&path, (char) c);
+            continue;
+        }
+        if (path.size) {
+            driver_add(d, path.data);
+            sb_reset(&path);
+        }
+        if (c == EOF) {
+            break;
+        }
+    }
+    cc_free(&path.data);
+}
+
+static void driver_add_response(Driver *d, char *path)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        cc_fatal("cannot read %s\n", path);
+    }
+    driver_add_list(d, fp, 1);
+    fclose(fp);
+}
 
+static void lex_file(Job *job, Context *ctx)
+{
+    char line[64];
+    vec(token) *tokens = tokenize(ctx);
     Token *t = NULL;
     vec_foreach(tokens, t)
     {
-        printf("%3lu [%s]\n", __i__, t->value);
+        snprintf(line, sizeof(line), "%3lu [", (unsigned long) __i__);
+        sb_adds(&job->out, line);
+        sb_adds(&job->out, t->value);
+        sb_adds(&job->out, "]\n");
     }
+}
 
-    printf("\n:ok:\n");
-    return 0;
+static Scan* driver_scan(Driver *d, Context *ctx)
+{
+    Scan *s = scan_new(ctx);
+    char *dir = NULL;
+    vec_foreach(d->include_dirs, dir)
+    {
+        scan_add_include_dir(s, dir);
+    }
+    return s;
+}
+
+// The snapshot of the prefix, saved when the one there is not good. When
+// it cannot be saved, every file reads the prefix.
+static void driver_snapshot(Driver *d)
+{
+    Context *ctx = make_shared_context(d->prefix, d->idents, d->tokcache);
+    Scan *s = driver_scan(d, ctx);
+    if (!scan_load_prefix(s, d->snapshot)) {
+        scan_save_prefix(s, d->snapshot);
+    }
+    scan_free(&s);
+    context_free(&ctx);
+}
+
+static void preprocess_file(Driver *d, Job *job, Context *ctx)
+{
+    Scan *s = driver_scan(d, ctx);
+    if (d->prefix && (d->snapshot == NULL || !scan_load_prefix(s, d->snapshot))) {
+        scan_include_prefix(s, d->prefix);
+    }
+    scan_write(s, &job->out);
+    scan_free(&s);
+}
+
+static void* driver_work(void *arg)
+{
+    Driver *d = arg;
+    for (;;) {
+        pthread_mutex_lock(&d->lock);
+        while (d->next < d->njobs && d->next >= d->written + d->window) {
+            pthread_cond_wait(&d->room, &d->lock);
+        }
+        if (d->next == d->njobs) {
+            pthread_mutex_unlock(&d->lock);
+            return NULL;
+        }
+        Job *job = &d->jobs[d->next++];
+        pthread_mutex_unlock(&d->lock);
+
+        if (d->njobs > 1) {
+            sb_adds(&job->out, "# 1 \"");
+            sb_adds(&job->out, job->path);
+            sb_adds(&job->out, "\"\n");
+        }
+        Context *ctx = make_shared_context(job->path, d->idents, d->tokcache);
+        if (d->preprocess) {
+            preprocess_file(d, job, ctx);
+        } else {
+            lex_file(job, ctx);
+        }
+        context_free(&ctx);
+
+        pthread_mutex_lock(&d->lock);
+        job->done = 1;
+        pthread_cond_broadcast(&d->done);
+        pthread_mutex_unlock(&d->lock);
+    }
+}
+
+static void driver_run(Driver *d, size_t nworkers)
+{
+    pthread_t *workers = cc_malloc(sizeof(pthread_t) * nworkers);
+    for (size_t i = 0; i < nworkers; i += 1) {
+        if (pthread_create(&workers[i], NULL, &driver_work, d) != 0) {
+            cc_fatal("cannot start a worker\n");
+        }
+    }
+
+    // the reorder buffer: job i is written when it and all before it are done
+    for (size_t i = 0; i < d->njobs; i += 1) {
+        Job *job = &d->jobs[i];
+        pthread_mutex_lock(&d->lock);
+        while (!job->done) {
+            pthread_cond_wait(&d->done, &d->lock);
+        }
+        pthread_mutex_unlock(&d->lock);
+
+        fwrite(job->out.data, 1, job->out.size, stdout);
+        cc_free(&job->out.data);
+        cc_free(&job->path);
+
+        pthread_mutex_lock(&d->lock);
+        d->written = i + 1;
+        pthread_cond_broadcast(&d->room);
+        pthread_mutex_unlock(&d->lock);
+    }
+
+    for (size_t i = 0; i < nworkers; i += 1) {
+        pthread_join(workers[i], NULL);
+    }
+    cc_free(&workers);
+}
+
+// The value of an option, in the same argument (-jN, --jobs=N) or in
+// the next one.
+static char* option_value(int argc, char **argv, int *i, char *name)
+{
+    char *arg = argv[*i];
+    size_t len = strlen(name);
+    if (arg[len] == '=') {
+        return arg + len + 1;
+    }
+    if (arg[len] != '\0') {
+        return arg + len;
+    }
+    if (*i + 1 == argc) {
+        cc_fatal("%s expects a value\n", name);
+    }
+    *i += 1;
+    return argv[*i];
+}
+
+static int is_option(char *arg, char *name)
+{
+    size_t len = strlen(name);
+    return strncmp(arg, name, len) == 0 && (name[1] != '-' || arg[len] == '\0' || arg[len] == '=');
 }
 
+int main(int argc, char **argv)
+{
+    Driver d = { .window = 0, .include_dirs = vec_new(str) };
+    pthread_mutex_init(&d.lock, NULL);
+    pthread_cond_init(&d.done, NULL);
+    pthread_cond_init(&d.room, NULL);
+    long jobs = 1;
+
+    for (int i = 1; i < argc; i += 1) {
+        char *arg = argv[i];
+        if (strcmp(arg, "-") == 0) {
+            driver_add_list(&d, stdin, 0);
+        } else if (arg[0] == '@') {
+            driver_add_response(&d, arg + 1);
+        } else if (strcmp(arg, "-E") == 0) {
+            d.preprocess = 1;
+        } else if (is_option(arg, "--jobs") || is_option(arg, "-j")) {
+            jobs = strtol(option_value(argc, argv, &i, arg[1] == '-' ? "--jobs" : "-j"), NULL, 10);
+            if (jobs < 1) {
+                cc_fatal("--jobs expects a number above 0\n");
+            }
+        } else if (is_option(arg, "-I")) {
+            vec_push_back(d.include_dirs, option_value(argc, argv, &i, "-I"));
+        } else if (is_option(arg, "--prefix")) {
+            d.prefix = option_value(argc, argv, &i, "--prefix");
+        } else if (is_option(arg, "--prefix-snap")) {
+            d.snapshot = option_value(argc, argv, &i, "--prefix-snap");
+        } else if (is_option(arg, "--tok-cache")) {
+            tokfile_set_dir(option_value(argc, argv, &i, "--tok-cache"), TOKFILE_DEFAULT_CAP);
+        } else if (arg[0] == '-') {
+            cc_fatal("unknown option %s\n", arg);
+        } else {
+            driver_add(&d, arg);
+        }
+    }
+    if (d.njobs == 0) {
+        driver_add(&d, "input.txt");
+    }
+
+    size_t nworkers = (size_t) jobs < d.njobs ? (size_t) jobs : d.njobs;
+    d.window = 4 * nworkers;
+    d.idents = identtable_new();
+    d.tokcache = tokcache_new();
+    if (d.snapshot && d.prefix == NULL) {
+        cc_fatal("--prefix-snap expects a --prefix\n");
+    }
+    if (d.snapshot && d.preprocess) {
+        driver_snapshot(&d);
+    }
+    driver_run(&d, nworkers);
+
+    if (!d.preprocess) {
+        printf("\n:ok:\n");
+    }
+    return 0;
+}
@@ -0,0 +1,63 @@
+#ifndef TOKENIZE_H_
+#define TOKENIZE_H_
+
+#include "drcc.h"
+#include "idents.h"
+#include "tokcache.h"
+
+// The lexer, and the preprocessor on top of it.
+//
+// A Context reads one file and gives its tokens; a Scan takes them from
+// a Context and gives what they are after preprocessing: macros replaced,
+// the groups not taken skipped, the included files read in place.
+
+typedef struct Context Context;
+typedef struct Scan Scan;
+
+Context* make_context(char *filename);
+
+/// A context on a thread of its own, with the names of idents and the
+/// token streams of tokcache, shared with the contexts on the other
+/// threads. The streams go with the names they were lexed into.
+Context* make_shared_context(char *filename, IdentTable *idents, TokenCache *tokcache);
+void context_free(Context **ctx);
+
+/// Whether the lexer evaluates the pp-numbers it makes, see Token::number;
+/// off unless set before anything is lexed. The files included from it,
+/// and the scan made with it, do as it does. The numbers are kept with the
+/// token cache, and shared like the streams: a token lexed without it has
+/// no number, whoever reads it.
+void context_eval_numbers(Context *ctx, int eval);
+
+/// Every token of the file, up to TOKEN_EOF.
+vec(token)* tokenize(Context *ctx);
+
+Scan* scan_new(Context *ctx);
+void scan_add_include_dir(Scan *s, char *dir);
+
+/// The next token after preprocessing; TOKEN_EOF at the end.
+Token* scan_get(Scan *s);
+
+/// Where the scan is in the source: the token it took from there last,
+/// the name or the ')' of the macro when what scan_get() gave came out
+/// of one. NULL before the first.
+Token* scan_source_at(Scan *s);
+
+/// What is left of the scan, as text: a line for every line of the
+/// source, and a space where the source had one, or where two tokens
+/// written together would be lexed as something else.
+void scan_write(Scan *s, Str *out);
+
+/// Frees the scan, and the files it was still in, and sets *s to NULL.
+/// The context it was made with stays, and so do the tokens it gave.
+void scan_free(Scan **s);
+
+/// A prefix that every file starts with: read as if included first, or
+/// restored from a snapshot saved by a scan of the prefix alone, read to
+/// its end by the save. The snapshot is good for scans with the same
+/// include dirs; 0, with nothing done, when it is not good.
+void scan_include_prefix(Scan *s, char *path);
+int scan_save_prefix(Scan *s, char *path);
+int scan_load_prefix(Scan *s, char *path);
+
+#endif /* TOKENIZE_H_ */
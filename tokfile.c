@@ -0,0 +1,432 @@
+#include "tokfile.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+map_proto(char*, size_t, spellings);
+map_impl(char*, size_t, spellings);
+
+enum {
+    SEC_SPELLINGS, SEC_TYPES, SEC_INDEXES, SEC_FLAGS, SEC_LINES, SEC_COLUMNS, SEC_COUNT
+};
+
+typedef struct TokFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t order; // 0x01020304 on the machine that wrote it
+    uint64_t types; // ops_fingerprint() of the build that wrote it
+    uint64_t len, hash;
+    uint64_t nspellings, ntokens;
+    uint64_t size[SEC_COUNT];
+} TokFileHeader;
+
+#define TOKFILE_MAGIC "drcctok"
+#define TOKFILE_ORDER (0x01020304u)
+#define TOKFILE_EVICT_EVERY (64)
+#define TOKFILE_STALE_SECONDS (600) // a file being written is renamed long before
+#define TOKENS_PER_BLOCK (1024)
+
+static char *tokfile_dir;
+static size_t tokfile_cap;
+static unsigned saves;
+
+void tokfile_set_dir(char *dir, size_t cap)
+{
+    if (tokfile_dir) {
+        cc_free(&tokfile_dir);
+    }
+    tokfile_dir = dir ? cc_strdup(dir) : NULL;
+    tokfile_cap = cap;
+    saves = 0;
+    if (dir) {
+        mkdir(dir, 0755);
+    }
+}
+
+static char* tokfile_path(FileData *data, char *suffix)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "/%016llx-%llx.tok", (unsigned long long) data->hash, (unsigned long long) data->len);
+    Str path = STR_INIT;
+    sb_adds(&path, tokfile_dir);
+    sb_adds(&path, name);
+    if (suffix) {
+        sb_adds(&path, suffix);
+    }
+    return path.data;
+}
+
+// Columns
+
+static void put_varint(vec(u8) *out, uint64_t v)
+{
+    while (v >= 0x80) {
+        vec_push_back(out, (unsigned char) (v | 0x80));
+        v >>= 7;
+    }
+    vec_push_back(out, (unsigned char) v);
+}
+
+static uint64_t zigzag(int64_t v)
+{
+    return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v)
+{
+    return (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+}
+
+typedef struct Reader {
+    unsigned char *at, *end;
+    int bad;
+} Reader;
+
+static uint64_t get_varint(Reader *r)
+{
+    uint64_t v = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        if (r->at == r->end) {
+            break;
+        }
+        unsigned char b = *r->at++;
+        v |= (uint64_t) (b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            return v;
+        }
+    }
+    r->bad = 1;
+    return 0;
+}
+
+// Saving
+
+static int write_all(FILE *fp, void *data, size_t size)
+{
+    return size == 0 || fwrite(data, 1, size, fp) == size;
+}
+
+typedef struct TokFileEntry {
+    time_t mtime;
+    char *path;
+    off_t size;
+} TokFileEntry;
+
+static int cmp_mtime(const void *a, const void *b)
+{
+    const TokFileEntry *x = a, *y = b;
+    return x->mtime < y->mtime ? -1 : x->mtime > y->mtime;
+}
+
+// The files loaded least recently go first, down to nine tenths of the cap.
+static void evict()
+{
+    DIR *d = opendir(tokfile_dir);
+    if (d == NULL) {
+        return;
+    }
+    TokFileEntry *entries = NULL;
+    size_t n = 0, alloc = 0, total = 0;
+    struct dirent *e = NULL;
+    time_t now = time(NULL);
+    while ((e = readdir(d)) != NULL) {
+        // name.tok, or name.tok.pid.n while it is written
+        int is_tmp = strstr(e->d_name, ".tok.") != NULL;
+        if (!strends(e->d_name, ".tok") && !is_tmp) {
+            continue;
+        }
+        Str path = STR_INIT;
+        sb_adds(&path, tokfile_dir);
+        sb_addc(&path, '/');
+        sb_adds(&path, e->d_name);
+        struct stat st;
+        if (stat(path.data, &st) != 0) {
+            cc_free(&path.data);
+            continue;
+        }
+        // left by a writer that was killed before the rename
+        if (is_tmp) {
+            if (now - st.st_mtime > TOKFILE_STALE_SECONDS) {
+                unlink(path.data);
+            }
+            cc_free(&path.data);
+            continue;
+        }
+        if (n == alloc) {
+            alloc = alloc ? alloc * 2 : 64;
+            entries = cc_realloc(entries, sizeof(TokFileEntry) * alloc);
+        }
+        entries[n++] = (TokFileEntry) { st.st_mtime, path.data, st.st_size };
+        total += (size_t) st.st_size;
+    }
+    closedir(d);
+
+    if (total > tokfile_cap) {
+        qsort(entries, n, sizeof(TokFileEntry), &cmp_mtime);
+        for (size_t i = 0; i < n && total > tokfile_cap / 10 * 9; i += 1) {
+            // another process may have removed it first
+            if (unlink(entries[i].path) == 0) {
+                total -= (size_t) entries[i].size;
+            }
+        }
+    }
+    for (size_t i = 0; i < n; i += 1) {
+        cc_free(&entries[i].path);
+    }
+    cc_free(&entries);
+}
+
+int tokfile_save(FileData *data, vec(token) *tokens)
+{
+    if (tokfile_dir == NULL) {
+        return 0;
+    }
+
+    vec(u8) *sec[SEC_COUNT];
+    for (size_t i = 0; i < SEC_COUNT; i += 1) {
+        sec[i] = vec_new(u8);
+    }
+    map(spellings) *dict = map_new(spellings, &hashmap_hash_str, &hashmap_equal_str);
+    size_t nspellings = 0, ntokens = 0;
+    int64_t line = 0;
+
+    Token *t = NULL;
+    vec_foreach(tokens, t)
+    {
+        if (t == EOF_TOKEN_ENTRY) {
+            break;
+        }
+        map_result(spellings) known = map_get(dict, t->value);
+        size_t index = known.value;
+        if (!known.found) {
+            index = nspellings++;
+            map_put(dict, t->value, index);
+            size_t len = strlen(t->value);
+            put_varint(sec[SEC_SPELLINGS], len);
+            for (size_t i = 0; i < len; i += 1) {
+                vec_push_back(sec[SEC_SPELLINGS], (unsigned char) t->value[i]);
+            }
+        }
+        put_varint(sec[SEC_TYPES], (uint64_t) t->type);
+        put_varint(sec[SEC_INDEXES], index);
+        vec_push_back(sec[SEC_FLAGS], (unsigned char) t->fposition);
+        put_varint(sec[SEC_LINES], zigzag(t->pos.line - line));
+        put_varint(sec[SEC_COLUMNS], zigzag(t->pos.column));
+        line = t->pos.line;
+        ntokens += 1;
+    }
+
+    TokFileHeader header = {
+        .magic = TOKFILE_MAGIC, .version = TOKFILE_VERSION, .order = TOKFILE_ORDER, .types = ops_fingerprint(),
+        .len = data->len, .hash = data->hash, .nspellings = nspellings, .ntokens = ntokens
+    };
+    for (size_t i = 0; i < SEC_COUNT; i += 1) {
+        header.size[i] = vec_size(sec[i]);
+    }
+
+    // unique to the process and to the save, whatever thread makes it:
+    // renamed into place when whole
+    unsigned save = __atomic_fetch_add(&saves, 1, __ATOMIC_RELAXED);
+    char suffix[64];
+    snprintf(suffix, sizeof(suffix), ".%ld.%u", (long) getpid(), save);
+    char *tmp = tokfile_path(data, suffix);
+    char *path = tokfile_path(data, NULL);
+
+    int ok = 0;
+    FILE *fp = fopen(tmp, "wb");
+    if (fp) {
+        ok = write_all(fp, &header, sizeof(header));
+        for (size_t i = 0; ok && i < SEC_COUNT; i += 1) {
+            ok = write_all(fp, sec[i]->data, vec_size(sec[i]));
+        }
+        ok = (fclose(fp) == 0) && ok;
+        ok = ok && rename(tmp, path) == 0;
+        if (!ok) {
+            unlink(tmp);
+        }
+    }
+
+    for (size_t i = 0; i < SEC_COUNT; i += 1) {
+        cc_free(&sec[i]->data);
+        cc_free(&sec[i]);
+    }
+    cc_free(&tmp);
+    cc_free(&path);
+
+    if (ok && save % TOKFILE_EVICT_EVERY == 0) {
+        evict();
+    }
+    return ok;
+}
+
+// Loading
+
+// Frees the tokens, chunk by chunk, and the vec: the first token of
+// every chunk is where the chunk starts.
+static void free_chunks(vec(token) *tokens)
+{
+    for (size_t i = 0; i < vec_size(tokens); i += TOKENS_PER_BLOCK) {
+        Token *first = vec_get(tokens, i);
+        cc_free(&first);
+    }
+    cc_free(&tokens->data);
+    cc_free(&tokens);
+}
+
+static vec(token)* decode(TokFileHeader *h, unsigned char *body, char *filename, TokFileNames *names)
+{
+    Reader sec[SEC_COUNT];
+    unsigned char *at = body;
+    for (size_t i = 0; i < SEC_COUNT; i += 1) {
+        sec[i] = (Reader) { .at = at, .end = at + h->size[i], .bad = 0 };
+        at += h->size[i];
+    }
+    if (h->size[SEC_FLAGS] != h->ntokens) {
+        return NULL;
+    }
+
+    // every spelling takes one byte at least
+    if (h->nspellings > h->size[SEC_SPELLINGS]) {
+        return NULL;
+    }
+
+    // every spelling in one block, NUL-terminated; the tokens point there
+    char **spellings = cc_malloc(sizeof(char*) * (h->nspellings + 1));
+    Ident **idents = cc_malloc(sizeof(Ident*) * (h->nspellings + 1));
+    Strtox **numbers = cc_malloc(sizeof(Strtox*) * (h->nspellings + 1));
+    char *block = cc_malloc(h->size[SEC_SPELLINGS] + h->nspellings + 1);
+    char *next = block;
+    Reader *r = &sec[SEC_SPELLINGS];
+    for (size_t i = 0; i < h->nspellings; i += 1) {
+        uint64_t len = get_varint(r);
+        if (r->bad || len > (uint64_t) (r->end - r->at)) {
+            cc_free(&spellings);
+            cc_free(&idents);
+            cc_free(&numbers);
+            cc_free(&block);
+            return NULL;
+        }
+        memcpy(next, r->at, len);
+        next[len] = '\0';
+        spellings[i] = next;
+        next += len + 1;
+        r->at += len;
+    }
+
+    vec(token) *tokens = vec_new(token);
+    Token *chunk = NULL;
+    int64_t line = 0;
+    int bad = 0;
+    for (size_t i = 0; i < h->ntokens && !bad; i += 1) {
+        T type = (T) get_varint(&sec[SEC_TYPES]);
+        uint64_t index = get_varint(&sec[SEC_INDEXES]);
+        unsigned flags = sec[SEC_FLAGS].at[i];
+        line += unzigzag(get_varint(&sec[SEC_LINES]));
+        int64_t column = unzigzag(get_varint(&sec[SEC_COLUMNS]));
+        // spellings are numbered as they are met: the first token's is
+        // the first, and where the block starts, for tokfile_free()
+        if (index >= h->nspellings || (i == 0 && index != 0)) {
+            bad = 1;
+            break;
+        }
+
+        if (i % TOKENS_PER_BLOCK == 0) {
+            chunk = cc_malloc(sizeof(Token) * TOKENS_PER_BLOCK);
+        }
+        Token *t = &chunk[i % TOKENS_PER_BLOCK];
+        t->type = type;
+        t->value = spellings[index];
+        t->fposition = flags;
+        t->pos.filename = filename;
+        t->pos.line = (int) line;
+        t->pos.column = (int) column;
+
+        // directive names are names too
+        if (type == TOKEN_IDENT || (is_ppdirtype(type) && type != PT_HEOL)) {
+            if (idents[index] == NULL) {
+                idents[index] = names->ident(names->ctx, t->value);
+            }
+            t->ident = idents[index];
+        }
+        if (type == TOKEN_NUMBER && names->number) {
+            if (numbers[index] == NULL) {
+                numbers[index] = names->number(names->ctx, t->value, strlen(t->value));
+            }
+            t->number = numbers[index];
+        }
+        vec_push_back(tokens, t);
+    }
+    for (size_t i = 0; i < SEC_COUNT; i += 1) {
+        bad |= sec[i].bad;
+    }
+
+    cc_free(&spellings);
+    cc_free(&idents);
+    cc_free(&numbers);
+    if (bad || vec_is_empty(tokens)) {
+        // no token points into the block
+        cc_free(&block);
+    }
+    if (bad) {
+        free_chunks(tokens);
+        return NULL;
+    }
+    vec_push_back(tokens, EOF_TOKEN_ENTRY);
+    return tokens;
+}
+
+void tokfile_free(vec(token) **tokens)
+{
+    vec(token) *loaded = *tokens;
+    if (vec_size(loaded) > 1) {
+        char *block = vec_get(loaded, 0)->value;
+        cc_free(&block);
+    }
+    vec_pop_back(loaded);
+    free_chunks(loaded);
+    *tokens = NULL;
+}
+
+vec(token)* tokfile_load(FileData *data, char *filename, TokFileNames *names)
+{
+    if (tokfile_dir == NULL) {
+        return NULL;
+    }
+    char *path = tokfile_path(data, NULL);
+    int fd = open(path, O_RDONLY);
+    cc_free(&path);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat st;
+    vec(token) *tokens = NULL;
+    if (fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(TokFileHeader)) {
+        size_t size = (size_t) st.st_size;
+        void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            TokFileHeader *h = map;
+            size_t body = 0;
+            int fits = 1;
+            for (size_t i = 0; i < SEC_COUNT; i += 1) {
+                fits = fits && h->size[i] <= size - body;
+                body += fits ? h->size[i] : 0;
+            }
+            if (memcmp(h->magic, TOKFILE_MAGIC, sizeof(h->magic)) == 0 && h->version == TOKFILE_VERSION
+                    && h->order == TOKFILE_ORDER && h->types == ops_fingerprint()
+                    && h->len == data->len && h->hash == data->hash
+                    && fits && sizeof(TokFileHeader) + body == size)
+            {
+                tokens = decode(h, (unsigned char*) map + sizeof(TokFileHeader), filename, names);
+            }
+            munmap(map, size);
+        }
+        // used now: the last one to be evicted
+        if (tokens) {
+            futimens(fd, NULL);
+        }
+    }
+    close(fd);
+    return tokens;
+}
@@ -0,0 +1,58 @@
+#ifndef TOKFILE_H_
+#define TOKFILE_H_
+
+#include "drcc.h"
+#include "filecache.h"
+
+// The tokens of a file, saved in a directory to be loaded by the next run.
+//
+// A .tok file is named by the length and the hash of the contents it was
+// lexed from, and holds:
+//
+//   header   magic, version, a fingerprint of the token types, the
+//            length and the hash again, the count of the spellings and
+//            of the tokens, the size of each column
+//   spellings  every distinct spelling once: varint length, bytes
+//   types    varint per token
+//   spelling varint per token, an index into the spellings
+//   flags    one byte per token, Token::fposition
+//   lines    varint per token, the line minus the line of the token before
+//   columns  varint per token
+//
+// It is mapped, not read, and decoded column by column: there is no
+// lexing, and every spelling, every name in it, is made once.
+//
+// A file is written under a name of its own and renamed into place, so
+// the processes sharing the directory never see one half written. When
+// the directory holds more than its cap, the files least recently loaded
+// are removed, and so are the ones left half written by a writer that died.
+
+#define TOKFILE_VERSION (2)
+#define TOKFILE_DEFAULT_CAP ((size_t) 512 * 1024 * 1024)
+
+typedef struct TokFileNames TokFileNames;
+
+// How a loaded name becomes an Ident, and a number a Strtox (when
+// 'number' is NULL, numbers are not evaluated).
+struct TokFileNames {
+    void *ctx;
+    struct Ident* (*ident)(void *ctx, char *name);
+    Strtox* (*number)(void *ctx, char *spelling, size_t len);
+};
+
+/// Where the files go; NULL to not save nor load any.
+void tokfile_set_dir(char *dir, size_t cap);
+
+/// The tokens lexed from data, up to the EOF_TOKEN_ENTRY; NULL when
+/// they were never saved. Positions are in filename.
+vec(token)* tokfile_load(FileData *data, char *filename, TokFileNames *names);
+
+/// Frees what tokfile_load() gave, tokens and spellings, when nothing
+/// points to them (the stream was put in the cache by someone else), and
+/// sets *tokens to NULL.
+void tokfile_free(vec(token) **tokens);
+
+/// 0 when the file could not be written.
+int tokfile_save(FileData *data, vec(token) *tokens);
+
+#endif /* TOKFILE_H_ */